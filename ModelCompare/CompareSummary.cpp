@@ -0,0 +1,158 @@
+//
+//  CompareSummary.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "CompareSummary.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+#include <cmath>
+
+using namespace RootUtil;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// field names, in record order
+static const char * const SummaryFields[] =
+{
+    "figure", "observable", "base", "compare", "luminosity",
+    "ks_prob",
+    "chi2", "chi2_ndf", "chi2_prob",
+    "fit1_chi2", "fit1_ndf", "fit1_prob",
+    "fitc_value", "fitc_error", "fitc_chi2", "fitc_ndf", "fitc_prob",
+    "good_bins", "bad_bins", "empty_bins",
+    "toys", "toys_ks_prob", "toys_chi2_prob",
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static std::string SummaryNumber( double value, bool bCSV )
+{
+    if (!std::isfinite(value))
+        return bCSV ? "" : "null";
+
+    return StringFormat( "%.10g", FMT_F(value) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static std::string SummaryString( const std::string & text, bool bCSV )
+{
+    std::string result = "\"";
+
+    for (char c : text)
+    {
+        if (c == '"')
+            result += bCSV ? "\"\"" : "\\\"";
+        else if ((c == '\\') && !bCSV)
+            result += "\\\\";
+        else if ((unsigned char)c < 0x20)
+            result += bCSV ? std::string(" ") : StringFormat( "\\u%04x", FMT_I(c) );
+        else
+            result += c;
+    }
+
+    return result + "\"";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+CompareSummaryWriter::CompareSummaryWriter( const char * fileName )
+{
+    const std::string name( fileName );
+
+    bCSV = (name.size() >= 4) && (name.compare( name.size() - 4, 4, ".csv" ) == 0);
+
+    file.open( fileName, std::ios::out | std::ios::app );
+    if (!file)
+    {
+        LogMsgError( "Failed to open summary file (%hs).", FMT_HS(fileName) );
+        ThrowError( std::invalid_argument( fileName ) );
+    }
+
+    LogMsgInfo( "Summary file: %hs", FMT_HS(fileName) );
+
+    // header line for a new CSV file
+    file.seekp( 0, std::ios::end );
+    if (bCSV && (file.tellp() == std::streampos(0)))
+    {
+        std::string header;
+        for (const char * field : SummaryFields)
+            header += (header.empty() ? "" : ",") + std::string(field);
+
+        file << header << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CompareSummaryWriter::Write( const CompareSummaryRecord & record )
+{
+    const CompareStats &    stats = record.stats;
+    const bool              bToys = (record.toys.nToys != 0);
+
+    const std::string values[] =
+    {
+        SummaryString( record.figure,     bCSV ),
+        SummaryString( record.observable, bCSV ),
+        SummaryString( record.baseModel,  bCSV ),
+        SummaryString( record.compModel,  bCSV ),
+        SummaryNumber( record.luminosity, bCSV ),
+
+        SummaryNumber( stats.ksProb, bCSV ),
+
+        SummaryNumber( stats.chi2.chi2, bCSV ),
+        SummaryNumber( stats.chi2.ndf,  bCSV ),
+        SummaryNumber( stats.chi2.prob, bCSV ),
+
+        SummaryNumber( stats.fitOne.chi2, bCSV ),
+        SummaryNumber( stats.fitOne.ndf,  bCSV ),
+        SummaryNumber( stats.fitOne.prob, bCSV ),
+
+        SummaryNumber( stats.fitValue,      bCSV ),
+        SummaryNumber( stats.fitError,      bCSV ),
+        SummaryNumber( stats.fitConst.chi2, bCSV ),
+        SummaryNumber( stats.fitConst.ndf,  bCSV ),
+        SummaryNumber( stats.fitConst.prob, bCSV ),
+
+        SummaryNumber( (double)record.ratioBins.nGood,  bCSV ),
+        SummaryNumber( (double)record.ratioBins.nBad,   bCSV ),
+        SummaryNumber( (double)record.ratioBins.nEmpty, bCSV ),
+
+        SummaryNumber( (double)record.toys.nToys, bCSV ),
+        SummaryNumber( bToys ? record.toys.ksProb   : NAN, bCSV ),
+        SummaryNumber( bToys ? record.toys.chi2Prob : NAN, bCSV ),
+    };
+
+    static_assert( sizeof(values) / sizeof(values[0]) == sizeof(SummaryFields) / sizeof(SummaryFields[0]),
+                   "summary field count mismatch" );
+
+    std::string line;
+
+    if (bCSV)
+    {
+        for (const std::string & value : values)
+            line += (line.empty() ? "" : ",") + value;
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+            line += std::string(line.empty() ? "{" : ", ") + "\"" + SummaryFields[i] + "\": " + values[i];
+        line += "}";
+    }
+
+    file << line << std::endl;  // flush, so each record is available at once
+
+    if (!file)
+        ThrowError( "CompareSummaryWriter: write failed." );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
@@ -0,0 +1,56 @@
+//
+//  CompareSummary.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef COMPARE_SUMMARY_H
+#define COMPARE_SUMMARY_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+
+#include <fstream>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// statistics of one compared model in one figure (see CompareFigureStats)
+struct CompareSummaryRecord
+{
+    std::string             figure;
+    std::string             observable;
+    std::string             baseModel;
+    std::string             compModel;
+    double                  luminosity  = 0;    // in fb^-1, 0 = not scaled
+    CompareStats            stats;
+    RootUtil::ToyPValues    toys;
+    GoodBadMask             ratioBins;          // good/bad bins of the ratio, only the counts are written
+};
+
+// Machine-readable summary file, one record per line, appended to an existing file.
+// CSV if the file name ends in ".csv" (with a header line for a new file), otherwise JSON Lines.
+// Each record is flushed as it is written, so the file can be read while the run continues.
+struct CompareSummaryWriter
+{
+    explicit CompareSummaryWriter( const char * fileName );
+
+    void Write( const CompareSummaryRecord & record );
+
+private:
+    std::ofstream   file;
+    bool            bCSV = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
+
+#endif // COMPARE_SUMMARY_H
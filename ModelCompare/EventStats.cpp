@@ -0,0 +1,273 @@
+//
+//  EventStats.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "EventStats.h"
+
+#include "common.h"
+#include "Parallel.h"
+
+// Root includes
+#include <TMath.h>
+#include <TRandom3.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const size_t PermutationBlockSize = 16;  // permutations per random number stream
+
+////////////////////////////////////////////////////////////////////////////////
+void SortEventSamples( const std::vector<EventSample *> & samples )
+{
+    ParallelFor( samples.size(), [&]( size_t index )
+    {
+        EventSample * pSample = samples[index];
+        if (pSample)
+            std::sort( pSample->begin(), pSample->end() );
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void CheckSamples( const EventSample & s1, const EventSample & s2, const char * func )
+{
+    if (s1.empty() || s2.empty())
+        ThrowError( std::string(func) + ": empty sample." );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UnbinnedTestResult UnbinnedKolmogorovTest( const EventSample & s1, const EventSample & s2 )
+{
+    CheckSamples( s1, s2, "UnbinnedKolmogorovTest" );
+
+    const size_t n1 = s1.size();
+    const size_t n2 = s2.size();
+
+    size_t i1(0), i2(0);
+    Double_t dist(0);
+
+    while ((i1 < n1) && (i2 < n2))
+    {
+        // step past all values equal to the smallest, so ties are compared after both steps
+        Double_t value = std::min( s1[i1], s2[i2] );
+
+        while ((i1 < n1) && (s1[i1] == value)) ++i1;
+        while ((i2 < n2) && (s2[i2] == value)) ++i2;
+
+        dist = std::max( dist, std::abs( Double_t(i1) / n1 - Double_t(i2) / n2 ) );
+    }
+
+    UnbinnedTestResult result;
+    result.statistic = dist;
+    result.prob      = TMath::KolmogorovProb( dist * std::sqrt( Double_t(n1) * n2 / (n1 + n2) ) );
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static Double_t AndersonDarlingProb( Double_t t )
+{
+    // critical values of the standardized statistic for k = 2 samples (m = 1),
+    // t_m = b0 + b1/sqrt(m) + b2/m, Scholz and Stephens (1987) table 1
+    static const Double_t crit[]  = { 0.325, 1.226, 1.961, 2.718, 3.752 };
+    static const Double_t alpha[] = { 0.25,  0.10,  0.05,  0.025, 0.01  };
+    static const size_t   nCrit   = sizeof(crit) / sizeof(crit[0]);
+
+    // linear interpolation of log(alpha), extrapolated from the end segments
+    size_t i = 0;
+    while ((i < nCrit - 2) && (t > crit[i + 1]))
+        ++i;
+
+    Double_t logA0 = std::log( alpha[i]     );
+    Double_t logA1 = std::log( alpha[i + 1] );
+
+    Double_t logProb = logA0 + (t - crit[i]) * (logA1 - logA0) / (crit[i + 1] - crit[i]);
+
+    return std::min( std::exp( logProb ), 1.0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UnbinnedTestResult UnbinnedAndersonDarlingTest( const EventSample & s1, const EventSample & s2 )
+{
+    CheckSamples( s1, s2, "UnbinnedAndersonDarlingTest" );
+
+    const Double_t n1 = (Double_t)s1.size();
+    const Double_t n2 = (Double_t)s2.size();
+    const size_t   nPooled = s1.size() + s2.size();
+    const Double_t N  = (Double_t)nPooled;
+
+    if (nPooled < 4)
+        ThrowError( "UnbinnedAndersonDarlingTest: too few values." );
+
+    // A^2 = 1/N sum_k 1/n_k sum_{j=1}^{N-1} (N M_kj - j n_k)^2 / (j (N - j))
+    // where M_kj is the number of values of sample k among the first j pooled values
+
+    Double_t sum1(0), sum2(0);
+    {
+        size_t i1(0), i2(0);
+        for (size_t j = 1; j < nPooled; ++j)
+        {
+            if ((i2 >= s2.size()) || ((i1 < s1.size()) && (s1[i1] <= s2[i2])))
+                ++i1;
+            else
+                ++i2;
+
+            const Double_t jj    = (Double_t)j;
+            const Double_t denom = jj * (N - jj);
+
+            Double_t d1 = N * i1 - jj * n1;
+            Double_t d2 = N * i2 - jj * n2;
+
+            sum1 += d1 * d1 / denom;
+            sum2 += d2 * d2 / denom;
+        }
+    }
+
+    const Double_t A2 = (sum1 / n1 + sum2 / n2) / N;
+
+    // variance of A^2, Scholz and Stephens (1987) eq. 4, with k = 2
+    Double_t h(0), g(0);
+    {
+        Double_t inner(0);  // sum_{i=1}^{j-1} 1/(N-i)
+        for (size_t j = 1; j < nPooled; ++j)
+        {
+            const Double_t jj = (Double_t)j;
+
+            h += 1 / jj;
+
+            if (j >= 2)
+            {
+                inner += 1 / (N - (jj - 1));
+                g     += inner / jj;
+            }
+        }
+    }
+
+    const Double_t k = 2;
+    const Double_t H = 1 / n1 + 1 / n2;
+
+    const Double_t a = (4*g - 6) * (k - 1) + (10 - 6*g) * H;
+    const Double_t b = (2*g - 4) * k*k + 8*h*k + (2*g - 14*h - 4) * H - 8*h + 4*g - 6;
+    const Double_t c = (6*h + 2*g - 2) * k*k + (4*h - 4*g + 6) * k + (2*h - 6) * H + 4*h;
+    const Double_t d = (2*h + 6) * k*k - 4*h*k;
+
+    const Double_t variance = (((a * N + b) * N + c) * N + d) / ((N - 1) * (N - 2) * (N - 3));
+
+    UnbinnedTestResult result;
+    result.statistic = (A2 - (k - 1)) / std::sqrt( variance );
+    result.prob      = AndersonDarlingProb( result.statistic );
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static Double_t EnergyDistance( const EventSample & pooled, const std::vector<UChar_t> & label, Double_t n1, Double_t n2 )
+{
+    // For sorted values, sum_{j<i} |v_i - v_j| = v_i * count_j - sum_j over the preceding values,
+    // so all three mean distances are found in a single pass.
+
+    Double_t count[2] = { }, sum[2] = { }, within[2] = { };
+    Double_t cross(0);
+
+    const size_t nPooled = pooled.size();
+    for (size_t i = 0; i < nPooled; ++i)
+    {
+        const Double_t v     = pooled[i];
+        const UChar_t  l     = label[i];
+        const UChar_t  other = 1 - l;
+
+        within[l] += v * count[l]     - sum[l];
+        cross     += v * count[other] - sum[other];
+
+        count[l] += 1;
+        sum[l]   += v;
+    }
+
+    // within sums count each pair once, the mean is over all ordered pairs
+    return 2 * cross / (n1 * n2) - 2 * within[0] / (n1 * n1) - 2 * within[1] / (n2 * n2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UnbinnedTestResult UnbinnedEnergyTest( const EventSample & s1, const EventSample & s2,
+                                       size_t nPermutations /*= 0*/, UInt_t seed /*= 4357*/ )
+{
+    CheckSamples( s1, s2, "UnbinnedEnergyTest" );
+
+    const Double_t n1 = (Double_t)s1.size();
+    const Double_t n2 = (Double_t)s2.size();
+
+    // merge into the pooled sample, labeled by sample
+    EventSample          pooled( s1.size() + s2.size() );
+    std::vector<UChar_t> label(  s1.size() + s2.size() );
+    {
+        size_t i1(0), i2(0);
+        for (size_t i = 0; i < pooled.size(); ++i)
+        {
+            if ((i2 >= s2.size()) || ((i1 < s1.size()) && (s1[i1] <= s2[i2])))
+            {
+                pooled[i] = s1[i1++];
+                label[i]  = 0;
+            }
+            else
+            {
+                pooled[i] = s2[i2++];
+                label[i]  = 1;
+            }
+        }
+    }
+
+    UnbinnedTestResult result;
+    result.statistic = EnergyDistance( pooled, label, n1, n2 );
+
+    if (nPermutations == 0)
+        return result;
+
+    // the pooled sample stays sorted, only the labels are permuted
+
+    const size_t nBlocks = (nPermutations + PermutationBlockSize - 1) / PermutationBlockSize;
+
+    std::vector<size_t> count( nBlocks, 0 );    // [block] permutations with distance >= observed
+
+    ParallelFor( nBlocks, [&]( size_t block )
+    {
+        // seed each block independently of the thread it runs on; 0 would be a random seed
+        UInt_t blockSeed = seed + 0x9E3779B9u * (UInt_t)(block + 1);
+        TRandom3 random( blockSeed ? blockSeed : 1 );
+
+        std::vector<UChar_t> permLabel( label );
+
+        const size_t permEnd = std::min( (block + 1) * PermutationBlockSize, nPermutations );
+
+        for (size_t perm = block * PermutationBlockSize; perm < permEnd; ++perm)
+        {
+            // Fisher-Yates shuffle
+            for (size_t i = permLabel.size() - 1; i > 0; --i)
+            {
+                size_t j = std::min( (size_t)(random.Rndm() * (i + 1)), i );
+                std::swap( permLabel[i], permLabel[j] );
+            }
+
+            if (EnergyDistance( pooled, permLabel, n1, n2 ) >= result.statistic)
+                ++count[block];
+        }
+    });
+
+    size_t total(0);
+    for (size_t c : count)
+        total += c;
+
+    result.prob = (1.0 + total) / (1.0 + nPermutations);
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
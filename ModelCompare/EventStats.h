@@ -0,0 +1,58 @@
+//
+//  EventStats.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef EVENT_STATS_H
+#define EVENT_STATS_H
+
+#include "common.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Unbinned two-sample tests of unweighted per-event values.
+// The samples must be sorted in ascending order (see SortEventSamples), so each test is a
+// single merge of the two samples, and a sorted sample can be reused for any number of tests.
+
+typedef std::vector<Double_t> EventSample;
+
+// sort each sample, in parallel (see ParallelFor)
+void SortEventSamples( const std::vector<EventSample *> & samples );
+
+struct UnbinnedTestResult
+{
+    Double_t    statistic   = 0;
+    Double_t    prob        = -1;   // p-value, -1 if not calculated
+};
+
+// Kolmogorov-Smirnov test, statistic = maximum distance between the two empirical distributions
+UnbinnedTestResult UnbinnedKolmogorovTest( const EventSample & s1, const EventSample & s2 );
+
+// Anderson-Darling two-sample test of Scholz and Stephens (1987), statistic = standardized T.
+// Ties are not corrected for. The p-value is interpolated from the critical values of the paper,
+// and is approximate outside the range 0.01 to 0.25.
+UnbinnedTestResult UnbinnedAndersonDarlingTest( const EventSample & s1, const EventSample & s2 );
+
+// Energy distance test of Szekely and Rizzo, statistic = energy distance:
+//      2 E|X-Y| - E|X-X'| - E|Y-Y'|
+// The p-value is from nPermutations random permutations of the pooled sample, in parallel
+// with reproducible random number streams (as StatToyPValues), or not calculated if 0.
+UnbinnedTestResult UnbinnedEnergyTest( const EventSample & s1, const EventSample & s2,
+                                       size_t nPermutations = 0, UInt_t seed = 4357 );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // EVENT_STATS_H
@@ -0,0 +1,592 @@
+//
+//  HistBank.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "HistBank.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+#include <iterator>
+
+// Root includes
+#include <TH1.h>
+#include <TProfile.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace RootUtil;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// bin kernels, used for both double and float storage (calculations are always in double)
+
+template <typename T>
+static void ScaleBins( T * pContent, T * pErrorSqr, size_t n, Double_t scale )
+{
+    const Double_t scaleSqr = scale * scale;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        pContent [i] = (T)(pContent [i] * scale);
+        pErrorSqr[i] = (T)(pErrorSqr[i] * scaleSqr);
+    }
+}
+
+template <typename T>
+static void ScaleBinEntries( T * pContent, T * pErrorSqr, size_t n, Double_t scale, bool bProfile )
+{
+    // same as HistBinView with a scale
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!bProfile)
+        {
+            pContent [i] = (T)(pContent [i] * scale);
+            pErrorSqr[i] = (T)(pErrorSqr[i] * scale);
+        }
+        else
+        {
+            pErrorSqr[i] = (T)(pErrorSqr[i] / scale);     // bin mean unchanged
+        }
+    }
+}
+
+template <typename T>
+static void RatioBins( const T * pComp, const T * pCompErr, const T * pBase, const T * pBaseErr,
+                       T * pContent, T * pErrorSqr, size_t n )
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        // same as TH1::Divide
+        Double_t c1 = pComp[i];
+        Double_t c2 = pBase[i];
+
+        Double_t c = 0;
+        Double_t e = 0;
+
+        if (c2 != 0)
+        {
+            Double_t c2sqr = c2 * c2;
+
+            c = c1 / c2;
+            e = ((Double_t)pCompErr[i] * c2sqr + (Double_t)pBaseErr[i] * c1 * c1) / (c2sqr * c2sqr);
+        }
+
+        pContent [i] = (T)c;
+        pErrorSqr[i] = (T)e;
+    }
+}
+
+template <typename T>
+static void ExpandBins( const T * pSource, const std::vector<Int_t> & bins, size_t nStored, Double_t * pDest, Int_t nSize )
+{
+    if (!pDest)
+        return;
+
+    if (bins.empty())
+    {
+        std::copy_n( pSource, nSize, pDest );   // dense
+        return;
+    }
+
+    std::fill_n( pDest, nSize, 0.0 );
+    for (size_t i = 0; i < nStored; ++i)
+        pDest[ bins[i] ] = pSource[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HistBank::HistBank( const std::vector<TH1DVector> & hists, const std::vector<UInt_t> & storage /*= {}*/ )
+{
+    nModels = hists.size();
+    nObs    = hists.empty() ? 0 : hists.front().size();
+
+    for (const TH1DVector & modelHists : hists)
+    {
+        if (modelHists.size() != nObs)
+            ThrowError( "HistBank: inconsistent number of observables." );
+    }
+
+    if (!storage.empty() && (storage.size() != nObs))
+        ThrowError( "HistBank: storage count mismatch." );
+
+    // determine layout
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        // a null histogram is an observable not loaded for the model (see ObsSelection)
+        const TH1D * pFirst = nullptr;
+        for (const TH1DVector & modelHists : hists)
+        {
+            if (!pFirst)
+                pFirst = modelHists[obs];
+        }
+
+        Int_t nSize    = pFirst ? pFirst->GetSize() : 0;
+        bool  bProfile = pFirst && pFirst->InheritsFrom(TProfile::Class());
+
+        for (const TH1DVector & modelHists : hists)
+        {
+            const TH1D * pHist = modelHists[obs];
+            if (pHist && ((pHist->GetSize() != nSize) || (pHist->InheritsFrom(TProfile::Class()) != bProfile)))
+                ThrowError( "HistBank: inconsistent histograms for " + std::string(pFirst->GetName()) );
+        }
+
+        obsSize   .push_back( nSize );
+        obsStorage.push_back( storage.empty() ? (UInt_t)kHistStorageDense : storage[obs] );
+        obsProfile.push_back( bProfile );
+
+        std::vector<Int_t> bins;
+
+        if (IsSparse(obs))
+        {
+            // keep bins that are non-empty in any model
+            std::vector<bool> used( nSize, false );
+
+            for (const TH1DVector & modelHists : hists)
+            {
+                if (!modelHists[obs])
+                    continue;
+
+                HistBinView view( *modelHists[obs] );
+                for (Int_t bin = 0; bin < nSize; ++bin)
+                {
+                    if ((view.pSumw[bin] != 0) || (view.pSumw2 && (view.pSumw2[bin] != 0)) ||
+                        (view.pBinEntries && (view.pBinEntries[bin] != 0)))
+                        used[bin] = true;
+                }
+            }
+
+            for (Int_t bin = 0; bin < nSize; ++bin)
+            {
+                if (used[bin])
+                    bins.push_back( bin );
+            }
+        }
+
+        obsStored.push_back( IsSparse(obs) ? bins.size() : (size_t)nSize );
+        obsBins  .push_back( std::move(bins) );
+    }
+
+    Allocate();
+
+    entries.resize( nObs * nModels );
+    source .resize( nObs * nModels );
+
+    modelScale.assign( nModels, 1.0 );
+
+    // copy bin contents
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        const std::vector<Int_t> & bins = obsBins[obs];
+        const size_t nStored = obsStored[obs];
+
+        for (size_t model = 0; model < nModels; ++model)
+        {
+            if (!hists[model][obs])
+                continue;   // empty bins, no source
+
+            const TH1D & hist = *hists[model][obs];
+            HistBinView  view( hist );
+
+            const size_t index = Index( obs, model );
+
+            for (size_t i = 0; i < nStored; ++i)
+            {
+                Int_t bin = bins.empty() ? (Int_t)i : bins[i];
+
+                Double_t c = view.Content(  bin );
+                Double_t e = view.ErrorSqr( bin );
+
+                if (IsFloat(obs))
+                {
+                    contentF [index + i] = (Float_t)c;
+                    errorSqrF[index + i] = (Float_t)e;
+                }
+                else
+                {
+                    content [index + i] = c;
+                    errorSqr[index + i] = e;
+                }
+            }
+
+            entries[obs * nModels + model] = hist.GetEntries();
+            source [obs * nModels + model] = &hist;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistBank::Allocate()
+{
+    size_t nDouble = 0;
+    size_t nFloat  = 0;
+
+    obsOffset.clear();
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        size_t & nTotal = IsFloat(obs) ? nFloat : nDouble;
+
+        obsOffset.push_back( nTotal );
+        nTotal += nModels * obsStored[obs];
+    }
+
+    content .assign( nDouble, 0.0 );
+    errorSqr.assign( nDouble, 0.0 );
+
+    contentF .assign( nFloat, 0.0f );
+    errorSqrF.assign( nFloat, 0.0f );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t HistBank::MemorySize() const
+{
+    size_t size = (content .size() + errorSqr .size()) * sizeof(Double_t) +
+                  (contentF.size() + errorSqrF.size()) * sizeof(Float_t);
+
+    for (const std::vector<Int_t> & bins : obsBins)
+        size += bins.size() * sizeof(Int_t);
+
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistBank::GetBins( size_t obs, size_t model, Double_t * pContent, Double_t * pErrorSqr ) const
+{
+    const size_t index = Index( obs, model );
+    const size_t n     = obsStored[obs];
+    const Int_t  nSize = obsSize[obs];
+
+    const std::vector<Int_t> & bins = obsBins[obs];
+
+    if (IsFloat(obs))
+    {
+        ExpandBins( contentF .data() + index, bins, n, pContent,  nSize );
+        ExpandBins( errorSqrF.data() + index, bins, n, pErrorSqr, nSize );
+    }
+    else
+    {
+        ExpandBins( content .data() + index, bins, n, pContent,  nSize );
+        ExpandBins( errorSqr.data() + index, bins, n, pErrorSqr, nSize );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HistBank HistBank::Select( const std::vector<size_t> & models ) const
+{
+    HistBank result;
+
+    result.nModels    = models.size();
+    result.nObs       = nObs;
+    result.obsSize    = obsSize;
+    result.obsStorage = obsStorage;
+    result.obsProfile = obsProfile;
+    result.obsStored  = obsStored;
+    result.obsBins    = obsBins;
+    result.entryScaled = entryScaled;
+
+    result.Allocate();
+
+    result.entries.resize( nObs * result.nModels );
+    result.source .resize( nObs * result.nModels );
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        for (size_t i = 0; i < models.size(); ++i)
+        {
+            size_t model = models[i];
+            if (model >= nModels)
+                ThrowError( "HistBank: model index out of range." );
+
+            const size_t from = Index( obs, model );
+            const size_t to   = result.Index( obs, i );
+            const size_t n    = obsStored[obs];
+
+            if (IsFloat(obs))
+            {
+                std::copy_n( contentF .cbegin() + from, n, result.contentF .begin() + to );
+                std::copy_n( errorSqrF.cbegin() + from, n, result.errorSqrF.begin() + to );
+            }
+            else
+            {
+                std::copy_n( content .cbegin() + from, n, result.content .begin() + to );
+                std::copy_n( errorSqr.cbegin() + from, n, result.errorSqr.begin() + to );
+            }
+
+            result.entries[obs * result.nModels + i] = entries[obs * nModels + model];
+            result.source [obs * result.nModels + i] = source [obs * nModels + model];
+        }
+    }
+
+    for (size_t model : models)
+        result.modelScale.push_back( modelScale[model] );
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HistBank HistBank::Join( const std::vector<const HistBank *> & banks )
+{
+    HistBank result;
+
+    if (banks.empty())
+        return result;
+
+    result.nObs = banks.front()->nObs;
+
+    for (const HistBank * pBank : banks)
+    {
+        if (pBank->nObs != result.nObs)
+            ThrowError( "HistBank: inconsistent number of observables." );
+
+        result.nModels += pBank->nModels;
+    }
+
+    // layout: the union of the banks, a bank with no bins has the observable not loaded
+
+    for (size_t obs = 0; obs < result.nObs; ++obs)
+    {
+        Int_t  nSize    = 0;
+        UInt_t storage  = banks.front()->obsStorage[obs];
+        bool   bProfile = false;
+
+        std::vector<Int_t> bins;
+
+        for (const HistBank * pBank : banks)
+        {
+            if (pBank->obsStorage[obs] != storage)
+                ThrowError( "HistBank: inconsistent storage." );
+
+            if (pBank->obsSize[obs] == 0)
+                continue;
+
+            if ((nSize != 0) && ((pBank->obsSize[obs] != nSize) || (pBank->obsProfile[obs] != bProfile)))
+                ThrowError( "HistBank: inconsistent histograms." );
+
+            nSize    = pBank->obsSize[obs];
+            bProfile = pBank->obsProfile[obs];
+
+            std::vector<Int_t> merged;
+            std::set_union( bins.cbegin(), bins.cend(), pBank->obsBins[obs].cbegin(), pBank->obsBins[obs].cend(),
+                            std::back_inserter(merged) );
+            bins.swap( merged );
+        }
+
+        result.obsSize   .push_back( nSize );
+        result.obsStorage.push_back( storage );
+        result.obsProfile.push_back( bProfile );
+        result.obsStored .push_back( result.IsSparse(obs) ? bins.size() : (size_t)nSize );
+        result.obsBins   .push_back( std::move(bins) );
+    }
+
+    result.Allocate();
+
+    result.entries.resize( result.nObs * result.nModels );
+    result.source .resize( result.nObs * result.nModels );
+
+    // copy bin contents
+
+    size_t first   = 0;         // first result model of the bank
+    bool   bScaled = false;     // a model is scaled, as result.entryScaled
+
+    for (const HistBank * pBank : banks)
+    {
+        for (size_t obs = 0; obs < result.nObs; ++obs)
+        {
+            const std::vector<Int_t> & bins   = pBank->obsBins[obs];
+            const std::vector<Int_t> & toBins = result.obsBins[obs];
+            const size_t               n      = pBank->obsStored[obs];
+
+            for (size_t model = 0; model < pBank->nModels; ++model)
+            {
+                const size_t from = pBank->Index( obs, model );
+                const size_t to   = result.Index( obs, first + model );
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    size_t j = bins.empty() ? i : (size_t)(std::lower_bound( toBins.cbegin(), toBins.cend(), bins[i] ) - toBins.cbegin());
+
+                    if (result.IsFloat(obs))
+                    {
+                        result.contentF [to + j] = pBank->contentF [from + i];
+                        result.errorSqrF[to + j] = pBank->errorSqrF[from + i];
+                    }
+                    else
+                    {
+                        result.content [to + j] = pBank->content [from + i];
+                        result.errorSqr[to + j] = pBank->errorSqr[from + i];
+                    }
+                }
+
+                result.entries[obs * result.nModels + first + model] = pBank->entries[obs * pBank->nModels + model];
+                result.source [obs * result.nModels + first + model] = pBank->source [obs * pBank->nModels + model];
+            }
+        }
+
+        result.modelScale.insert( result.modelScale.end(), pBank->modelScale.cbegin(), pBank->modelScale.cend() );
+
+        for (double scale : pBank->modelScale)
+        {
+            if (scale == 1.0)
+                continue;
+
+            if (bScaled && (pBank->entryScaled != result.entryScaled))
+                ThrowError( "HistBank: cannot mix TH1::Scale and ScaleHistEntries scales." );
+
+            bScaled            = true;
+            result.entryScaled = pBank->entryScaled;
+        }
+
+        first += pBank->nModels;
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistBank::Scale( const std::vector<double> & scales, bool bEntries /*= false*/ )
+{
+    if (scales.size() != nModels)
+        ThrowError( "HistBank: scale count mismatch." );
+
+    for (double scale : modelScale)
+    {
+        if ((scale != 1.0) && (bEntries != entryScaled))
+            ThrowError( "HistBank: cannot mix TH1::Scale and ScaleHistEntries scales." );
+    }
+
+    entryScaled = bEntries;
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        const size_t n = obsStored[obs];
+
+        for (size_t model = 0; model < nModels; ++model)
+        {
+            const size_t index = Index( obs, model );
+
+            if (bEntries)
+            {
+                if (IsFloat(obs))
+                    ScaleBinEntries( contentF.data() + index, errorSqrF.data() + index, n, scales[model], obsProfile[obs] );
+                else
+                    ScaleBinEntries( content .data() + index, errorSqr .data() + index, n, scales[model], obsProfile[obs] );
+            }
+            else
+            {
+                if (IsFloat(obs))
+                    ScaleBins( contentF.data() + index, errorSqrF.data() + index, n, scales[model] );
+                else
+                    ScaleBins( content .data() + index, errorSqr .data() + index, n, scales[model] );
+            }
+        }
+    }
+
+    for (size_t model = 0; model < nModels; ++model)
+        modelScale[model] *= scales[model];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HistBank HistBank::Ratio( size_t baseModel ) const
+{
+    if (baseModel >= nModels)
+        ThrowError( "HistBank: base model index out of range." );
+
+    HistBank result( *this );
+
+    result.obsProfile.assign( nObs, false );    // ratios are TH1D
+    result.modelScale.assign( nModels, 1.0 );
+
+    for (size_t obs = 0; obs < nObs; ++obs)
+    {
+        const size_t n    = obsStored[obs];
+        const size_t base = Index( obs, baseModel );
+
+        for (size_t model = 0; model < nModels; ++model)
+        {
+            const size_t index = Index( obs, model );
+
+            if (IsFloat(obs))
+            {
+                RatioBins( contentF.data() + index, errorSqrF.data() + index, contentF.data() + base, errorSqrF.data() + base,
+                           result.contentF.data() + index, result.errorSqrF.data() + index, n );
+            }
+            else
+            {
+                RatioBins( content.data() + index, errorSqr.data() + index, content.data() + base, errorSqr.data() + base,
+                           result.content.data() + index, result.errorSqr.data() + index, n );
+            }
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1D * HistBank::MakeHist( size_t obs, size_t model, const char * name /*= nullptr*/, const char * title /*= nullptr*/ ) const
+{
+    const TH1D * pSource = source[obs * nModels + model];
+    if (!pSource)
+        ThrowError( "HistBank: observable not loaded for the model." );
+
+    TH1D * pHist = nullptr;
+
+    if (obsProfile[obs])
+    {
+        pHist = static_cast<TH1D *>( pSource->Clone() );
+        pHist->SetDirectory( nullptr );     // ensure not owned by any directory
+
+        if (modelScale[model] != 1.0)
+        {
+            if (entryScaled)
+                ScaleHistEntries( *pHist, modelScale[model] );
+            else
+                pHist->Scale( modelScale[model] );
+        }
+    }
+    else
+    {
+        pHist = ConvertTProfileToTH1D( pSource, false );  // binning and attributes of the source
+        RestoreHistBins( *pHist );                          // the bins of the source may be released
+        if (pHist->GetSumw2()->fN == 0)
+            pHist->Sumw2();
+
+        HistBinArrays arrays( *pHist );
+
+        GetBins( obs, model, arrays.pSumw, arrays.pSumw2 );
+
+        pHist->ResetStats();
+        pHist->SetEntries( entries[obs * nModels + model] );
+    }
+
+    if (name)
+        pHist->SetName( name );
+    if (title)
+        pHist->SetTitle( title );
+
+    return pHist;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1DVector HistBank::MakeHists( size_t obs ) const
+{
+    TH1DVector hists;
+
+    for (size_t model = 0; model < nModels; ++model)
+        hists.push_back( MakeHist( obs, model ) );
+
+    return hists;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
@@ -0,0 +1,124 @@
+//
+//  HistBank.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef HIST_BANK_H
+#define HIST_BANK_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// forward declarations
+
+class TH1D;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bin contents of all models and observables in contiguous arrays.
+//
+// Each observable has a block of nModels * obsStored bins, so the bins of one observable
+// are contiguous across all models:
+//      index = obsOffset[obs] + model * obsStored[obs] + i
+// where i is the stored bin. The block is in the double arrays, or the float arrays if the
+// observable has kHistStorageFloat. With kHistStorageSparse only the bins that are non-empty
+// in any model are stored, and obsBins[obs][i] is the histogram bin of stored bin i.
+// Use GetBins to expand an observable to all bins, independent of the storage.
+//
+// The stored values are those of the histogram as drawn, i.e. a TProfile is stored as its
+// TH1D projection (content = bin mean, error = bin error).
+// The source histograms are not owned, and are used only for their binning and attributes when
+// making histograms for drawing, so the bins of a TH1D source may be released once the bank is
+// made (see ReleaseHistBins and ModelStore). A TProfile source is cloned, so must keep its bins:
+// a TProfile observable has its four source bin arrays in memory as well as the projection in
+// the bank, so more memory than without a bank, whatever its storage.
+// A null source histogram (an observable not loaded for the model, see ObsSelection) is stored
+// as empty bins, and no histogram can be made of it.
+
+struct HistBank
+{
+    size_t                      nModels     = 0;
+    size_t                      nObs        = 0;
+
+    std::vector<Int_t>          obsSize;        // obsSize[obs]    = number of bins, including under/overflow
+    std::vector<UInt_t>         obsStorage;     // obsStorage[obs] = HistStorage flags
+    std::vector<bool>           obsProfile;     // obsProfile[obs] = source is a TProfile
+    std::vector<size_t>         obsStored;      // obsStored[obs]  = number of stored bins per model
+    std::vector<size_t>         obsOffset;      // obsOffset[obs]  = start of observable block
+    std::vector< std::vector<Int_t> > obsBins;  // obsBins[obs][i] = bin of stored bin i, sparse only
+
+    std::vector<Double_t>       content;        // [index]
+    std::vector<Double_t>       errorSqr;       // [index]
+
+    std::vector<Float_t>        contentF;       // [index], kHistStorageFloat
+    std::vector<Float_t>        errorSqrF;      // [index], kHistStorageFloat
+
+    std::vector<Double_t>       entries;        // [obs * nModels + model] histogram entries
+    RootUtil::ConstTH1DVector   source;         // [obs * nModels + model]
+    std::vector<double>         modelScale;     // [model] scale applied since loading
+    bool                        entryScaled = false;    // modelScale applied as ScaleHistEntries, see Scale
+
+    HistBank() = default;
+    explicit HistBank( const std::vector<RootUtil::TH1DVector> & hists,    // hists[model][observable]
+                       const std::vector<UInt_t> & storage = {} );         // storage[observable], default is dense
+
+    size_t Index( size_t obs, size_t model ) const  { return obsOffset[obs] + model * obsStored[obs]; }
+
+    bool IsFloat(  size_t obs ) const   { return (obsStorage[obs] & kHistStorageFloat)  != 0; }
+    bool IsSparse( size_t obs ) const   { return (obsStorage[obs] & kHistStorageSparse) != 0; }
+
+    size_t MemorySize() const;  // in bytes, bin arrays only
+
+    // Expand one model and observable to obsSize[obs] bins. Any of the arrays may be null.
+    void GetBins( size_t obs, size_t model, Double_t * pContent, Double_t * pErrorSqr ) const;
+
+    // new bank with a subset of the models, in the given order
+    HistBank Select( const std::vector<size_t> & models ) const;
+
+    // new bank with the models of all banks, in the given order; the banks must have the same
+    // observables and storage, an observable with no bins in a bank is not loaded for its models
+    static HistBank Join( const std::vector<const HistBank *> & banks );
+
+    // Scale each model, as TH1::Scale:
+    //   content *= scale, error^2 *= scale^2
+    // TProfile::Scale scales the bin means, so profiles are scaled the same way.
+    // With bEntries, scale as a change of luminosity, as ScaleHistEntries (see "Luminosity scaling" in ModelCompare.h):
+    //   TH1D:     content *= scale, error^2 *= scale
+    //   TProfile: content unchanged, error^2 /= scale
+    // A scaled bank can only be scaled again the same way.
+    void Scale( const std::vector<double> & scales, bool bEntries = false );    // scales[model]
+
+    // new bank with the ratio of each model to the base model, as TH1::Divide
+    HistBank Ratio( size_t baseModel ) const;
+
+    // Make a histogram of one model and observable (caller takes ownership).
+    // A TProfile observable is made as a scaled clone of the source, otherwise a TH1D is made
+    // with the binning and attributes of the source, and the contents of the bank.
+    TH1D * MakeHist( size_t obs, size_t model, const char * name = nullptr, const char * title = nullptr ) const;
+
+    RootUtil::TH1DVector MakeHists( size_t obs ) const;    // all models of observable, with source names
+
+private:
+    void Allocate();    // set obsOffset and allocate the bin arrays from the layout
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif // HIST_BANK_H
@@ -0,0 +1,572 @@
+//
+//  HistStats.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "HistStats.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <TH1.h>
+#include <TAxis.h>
+#include <TMath.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+bool StatBinMaskNonEmpty( Double_t effEntries1, Double_t effEntries2 )
+{
+    return (effEntries1 == 0) == (effEntries2 == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static inline bool IsPairSelected( const StatBins & h1, const StatBins & h2, Int_t bin, StatBinMask * pMask )
+{
+    if ((h1.pSelect && !h1.pSelect[bin]) || (h2.pSelect && !h2.pSelect[bin]))
+        return false;
+
+    if (!pMask)
+        return true;
+
+    return pMask( h1.pHist->EffectiveEntries( bin, h1.scale ), h2.pHist->EffectiveEntries( bin, h2.scale ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void CheckStatBins( const char * function, const StatBins & h1, const StatBins & h2 )
+{
+    if (h1.pHist->nSize != h2.pHist->nSize)
+        ThrowError( std::string(function) + ": histogram size mismatch." );
+
+    if (h1.pDenom || h2.pDenom)
+        ThrowError( std::string(function) + ": ratio bins not supported." );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StatBins::GetBin( Int_t bin, Double_t & content, Double_t & errorSqr ) const
+{
+    if (!pDenom)
+    {
+        content  = pHist->Content(  bin, scale );
+        errorSqr = pHist->ErrorSqr( bin, scale );
+        return;
+    }
+
+    // same as TH1::Divide
+
+    Double_t c1 = pHist ->Content( bin, scale );
+    Double_t c2 = pDenom->Content( bin, denomScale );
+
+    if (c2 == 0)
+    {
+        content = errorSqr = 0;
+        return;
+    }
+
+    Double_t c2sq = c2 * c2;
+
+    content  = c1 / c2;
+    errorSqr = (pHist->ErrorSqr( bin, scale ) * c2sq + pDenom->ErrorSqr( bin, denomScale ) * c1 * c1) / (c2sq * c2sq);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool StatBins::IsSelected( Int_t bin, StatBinMask * pMask ) const
+{
+    if (pSelect && !pSelect[bin])
+        return false;
+
+    if (!pMask || !pDenom)
+        return true;
+
+    return pMask( pDenom->EffectiveEntries( bin, denomScale ), pHist->EffectiveEntries( bin, scale ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t StatKolmogorovTest( const StatBins & h1, const StatBins & h2, StatBinMask * pMask /*= nullptr*/ )
+{
+    CheckStatBins( "StatKolmogorovTest", h1, h2 );
+
+    const Int_t nBins = h1.NumBins();
+
+    Double_t sum1(0), sum2(0), w1(0), w2(0);
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!IsPairSelected( h1, h2, bin, pMask ))
+            continue;
+
+        Double_t c1, e1sq, c2, e2sq;
+        h1.GetBin( bin, c1, e1sq );
+        h2.GetBin( bin, c2, e2sq );
+
+        sum1 += c1;
+        sum2 += c2;
+        w1   += e1sq;
+        w2   += e2sq;
+    }
+
+    if ((sum1 == 0) || (sum2 == 0))
+        return 0;
+
+    // effective entries; zero errors are equivalent to comparing to a function
+    const bool bFunc1 = (w1 <= 0);
+    const bool bFunc2 = (w2 <= 0);
+    if (bFunc1 && bFunc2)
+        return 0;
+
+    Double_t esum1 = bFunc1 ? 0 : sum1 * sum1 / w1;
+    Double_t esum2 = bFunc2 ? 0 : sum2 * sum2 / w2;
+
+    const Double_t s1 = 1 / sum1;
+    const Double_t s2 = 1 / sum2;
+
+    Double_t dfmax(0), rsum1(0), rsum2(0);
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!IsPairSelected( h1, h2, bin, pMask ))
+            continue;
+
+        Double_t c1, e1sq, c2, e2sq;
+        h1.GetBin( bin, c1, e1sq );
+        h2.GetBin( bin, c2, e2sq );
+
+        rsum1 += s1 * c1;
+        rsum2 += s2 * c2;
+        dfmax  = std::max( dfmax, std::abs(rsum1 - rsum2) );
+    }
+
+    Double_t z = bFunc1 ? dfmax * std::sqrt(esum2) :
+                 bFunc2 ? dfmax * std::sqrt(esum1) :
+                          dfmax * std::sqrt(esum1 * esum2 / (esum1 + esum2));
+
+    return TMath::KolmogorovProb( z );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result StatChi2Test( const StatBins & h1, const StatBins & h2, Chi2TestType type, StatBinMask * pMask /*= nullptr*/ )
+{
+    CheckStatBins( "StatChi2Test", h1, h2 );
+
+    const Int_t nBins = h1.NumBins();
+
+    Chi2Result res;
+
+    Double_t sum1(0), sum2(0);
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!IsPairSelected( h1, h2, bin, pMask ))
+            continue;
+
+        Double_t c1, e1sq, c2, e2sq;
+        h1.GetBin( bin, c1, e1sq );
+        h2.GetBin( bin, c2, e2sq );
+
+        sum1 += c1;
+        sum2 += c2;
+    }
+
+    if ((sum1 == 0) || (sum2 == 0))
+        return res;     // Chi2TestX fails if either histogram is empty
+
+    const Double_t sum = sum1 + sum2;
+
+    Int_t m(0), n(0);   // bins with too few entries in h1, h2
+
+    res.ndf = nBins - 1;
+
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        Double_t cnt1(0), e1sq(0), cnt2(0), e2sq(0);
+        if (IsPairSelected( h1, h2, bin, pMask ))
+        {
+            h1.GetBin( bin, cnt1, e1sq );
+            h2.GetBin( bin, cnt2, e2sq );
+        }
+
+        if ((cnt1 == 0) && (cnt2 == 0))
+        {
+            --res.ndf;  // skip bins where both are empty
+            continue;
+        }
+
+        if (type == kChi2TestUU)
+        {
+            Double_t cntsum = cnt1 + cnt2;
+
+            if (cntsum * sum1 / sum < 1) ++m;
+            if (cntsum * sum2 / sum < 1) ++n;
+
+            Double_t delta = sum2 * cnt1 - sum1 * cnt2;
+
+            res.chi2 += delta * delta / cntsum;
+        }
+        else
+        {
+            Double_t sigma = sum1 * sum1 * e2sq + sum2 * sum2 * e1sq;
+            if (sigma == 0)
+                return Chi2Result();    // Chi2TestX fails if both errors are zero
+
+            if ((e1sq > 0) && (cnt1 * cnt1 / e1sq < 10)) ++m;
+            if ((e2sq > 0) && (cnt2 * cnt2 / e2sq < 10)) ++n;
+
+            Double_t delta = sum1 * cnt2 - sum2 * cnt1;
+
+            res.chi2 += delta * delta / sigma;
+        }
+    }
+
+    if (type == kChi2TestUU)
+        res.chi2 /= sum1 * sum2;
+
+    res.igood    = (m ? 1 : 0) + (n ? 2 : 0);
+    res.prob     = TMath::Prob( res.chi2, res.ndf );
+    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
+
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result StatPointChi2Test( const StatBins & h1, const StatBins & h2, StatBinMask * pMask /*= nullptr*/ )
+{
+    CheckStatBins( "StatPointChi2Test", h1, h2 );
+
+    const Int_t nBins = h1.NumBins();
+
+    Chi2Result res;
+    res.ndf = nBins - 1;
+
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        Double_t n1 = h1.pHist->EffectiveEntries( bin, h1.scale );
+        Double_t n2 = h2.pHist->EffectiveEntries( bin, h2.scale );
+
+        if ((n1 == 0) || (n2 == 0) || !IsPairSelected( h1, h2, bin, pMask ))
+        {
+            // skip this bin, and reduce the ndf
+            --res.ndf;
+            continue;
+        }
+
+        Double_t v1, e1sq, v2, e2sq;
+        h1.GetBin( bin, v1, e1sq );
+        h2.GetBin( bin, v2, e2sq );
+
+        Double_t delta  = v1 - v2;
+        Double_t errsqr = e1sq + e2sq;
+
+        if (errsqr == 0)
+        {
+            // skip this bin, and reduce the ndf
+            --res.ndf;
+            continue;
+        }
+
+        res.chi2 += delta * delta / errsqr;
+    }
+
+    if (res.ndf < 0) res.ndf = 0;
+
+    res.prob     = TMath::Prob( res.chi2, res.ndf );   // can handle ndf <= 0 (see TMath.cxx)
+    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
+
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result StatChi2ToValue( const StatBins & h, Double_t value, StatBinMask * pMask /*= nullptr*/ )
+{
+    const Int_t nBins = h.NumBins();
+
+    Chi2Result res;
+
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!h.IsSelected( bin, pMask ))
+            continue;
+
+        Double_t c, esq;
+        h.GetBin( bin, c, esq );
+
+        if (esq == 0)
+            continue;   // skip bins with zero error
+
+        res.chi2 += (c - value) * (c - value) / esq;
+        ++res.ndf;
+    }
+
+    res.prob     = (res.ndf > 0 ? TMath::Prob( res.chi2, res.ndf ) : 0.0);
+    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
+
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool SolveSymmetric( Int_t n, Double_t (&a)[3][3], Double_t (&inv)[3][3] )
+{
+    // invert the symmetric positive definite matrix a (n x n) by Gauss-Jordan elimination with partial pivoting
+
+    Double_t m[3][6] = { };
+    for (Int_t i = 0; i < n; ++i)
+    {
+        for (Int_t j = 0; j < n; ++j)
+            m[i][j] = a[i][j];
+        m[i][n + i] = 1;
+    }
+
+    for (Int_t col = 0; col < n; ++col)
+    {
+        Int_t pivot = col;
+        for (Int_t row = col + 1; row < n; ++row)
+        {
+            if (std::abs(m[row][col]) > std::abs(m[pivot][col]))
+                pivot = row;
+        }
+
+        if (m[pivot][col] == 0)
+            return false;   // singular
+
+        if (pivot != col)
+        {
+            for (Int_t j = 0; j < 2 * n; ++j)
+                std::swap( m[col][j], m[pivot][j] );
+        }
+
+        Double_t f = 1 / m[col][col];
+        for (Int_t j = 0; j < 2 * n; ++j)
+            m[col][j] *= f;
+
+        for (Int_t row = 0; row < n; ++row)
+        {
+            if (row == col)
+                continue;
+
+            Double_t g = m[row][col];
+            for (Int_t j = 0; j < 2 * n; ++j)
+                m[row][j] -= g * m[col][j];
+        }
+    }
+
+    for (Int_t i = 0; i < n; ++i)
+    {
+        for (Int_t j = 0; j < n; ++j)
+            inv[i][j] = m[i][n + j];
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+PolyFitResult StatFitPolynomial( const StatBins & h, Int_t degree, StatBinMask * pMask /*= nullptr*/ )
+{
+    if ((degree < 0) || (degree > PolyFitResult::MaxDegree))
+        ThrowError( "StatFitPolynomial: degree must be 0, 1 or 2." );
+
+    const Int_t nBins  = h.NumBins();
+    const Int_t nParam = degree + 1;
+    const TAxis * pAxis = h.pHist->pHist->GetXaxis();
+
+    PolyFitResult result;
+    result.degree = degree;
+
+    // To keep the normal equations well conditioned, fit in t = (x - x0) / dx,
+    // where x0 and dx are the center and half width of the axis, then transform back.
+
+    const Double_t x0 = (pAxis->GetXmax() + pAxis->GetXmin()) / 2;
+    const Double_t dx = (pAxis->GetXmax() - pAxis->GetXmin()) / 2;
+
+    // accumulate the normal equations: sum w t^(i+j) and sum w y t^i
+    Double_t sumWT[2 * PolyFitResult::MaxDegree + 1] = { };
+    Double_t sumWYT[PolyFitResult::MaxDegree + 1]    = { };
+    Int_t    nPoints(0);
+
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!h.IsSelected( bin, pMask ))
+            continue;
+
+        Double_t y, esq;
+        h.GetBin( bin, y, esq );
+
+        if (esq == 0)
+            continue;   // skip bins with zero error
+
+        const Double_t w = 1 / esq;
+        const Double_t t = (pAxis->GetBinCenter(bin) - x0) / dx;
+
+        Double_t tk = 1;
+        for (Int_t k = 0; k <= 2 * degree; ++k, tk *= t)
+        {
+            sumWT[k] += w * tk;
+            if (k <= degree)
+                sumWYT[k] += w * y * tk;
+        }
+
+        ++nPoints;
+    }
+
+    if (nPoints < nParam)
+        return result;  // fit fails with too few points
+
+    Double_t a[3][3]   = { };
+    Double_t cov[3][3] = { };
+    for (Int_t i = 0; i < nParam; ++i)
+    {
+        for (Int_t j = 0; j < nParam; ++j)
+            a[i][j] = sumWT[i + j];
+    }
+
+    if (!SolveSymmetric( nParam, a, cov ))
+        return result;
+
+    Double_t q[3] = { };
+    for (Int_t i = 0; i < nParam; ++i)
+    {
+        for (Int_t j = 0; j < nParam; ++j)
+            q[i] += cov[i][j] * sumWYT[j];
+    }
+
+    // transform from t to x: p = T q, cov_p = T cov_q T^T
+    //   q0 + q1 t + q2 t^2, with t = (x - x0) / dx
+    Double_t T[3][3] = { };
+    {
+        const Double_t s = 1 / dx;
+        const Double_t c = -x0 / dx;    // t = s x + c
+
+        T[0][0] = 1;    T[0][1] = c;    T[0][2] = c * c;
+                        T[1][1] = s;    T[1][2] = 2 * s * c;
+                                        T[2][2] = s * s;
+    }
+
+    for (Int_t i = 0; i < nParam; ++i)
+    {
+        Double_t value(0), variance(0);
+        for (Int_t j = 0; j < nParam; ++j)
+        {
+            value += T[i][j] * q[j];
+            for (Int_t k = 0; k < nParam; ++k)
+                variance += T[i][j] * cov[j][k] * T[i][k];
+        }
+
+        result.param[i] = value;
+        result.error[i] = std::sqrt( std::max( variance, 0.0 ) );
+    }
+
+    // chi2 of the fit, evaluated in t
+    Chi2Result & res = result.chi2;
+
+    for (Int_t bin = 1; bin <= nBins; ++bin)
+    {
+        if (!h.IsSelected( bin, pMask ))
+            continue;
+
+        Double_t y, esq;
+        h.GetBin( bin, y, esq );
+
+        if (esq == 0)
+            continue;
+
+        const Double_t t = (pAxis->GetBinCenter(bin) - x0) / dx;
+        const Double_t f = q[0] + t * (q[1] + t * q[2]);
+
+        res.chi2 += (y - f) * (y - f) / esq;
+    }
+
+    res.ndf      = nPoints - nParam;
+    res.prob     = (res.ndf > 0 ? TMath::Prob( res.chi2, res.ndf ) : 0.0);
+    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
+
+    result.bValid = true;
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result StatFitToConstant( const StatBins & h, Double_t & cValue, Double_t & cError, StatBinMask * pMask /*= nullptr*/ )
+{
+    PolyFitResult fit = StatFitPolynomial( h, 0, pMask );
+
+    cValue = fit.param[0];
+    cError = fit.error[0];
+
+    return fit.chi2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result StatCovarianceChi2( const std::vector<Double_t> & diff, std::vector<Double_t> & cov )
+{
+    const size_t n = diff.size();
+
+    if (cov.size() != n * n)
+        ThrowError( "StatCovarianceChi2: covariance size mismatch." );
+
+    // relative pivot below which a bin is dependent on the preceding bins
+    const Double_t DependentPivot = 1E-9;
+
+    // in-place Cholesky decomposition V = L L^T, lower triangle,
+    // then forward substitution L z = d, so chi2 = z^T z
+
+    std::vector<Double_t> z( n, 0.0 );
+    std::vector<bool>     used( n, false );
+
+    Chi2Result res;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        Double_t * Li = &cov[i * n];
+
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (!used[j])
+            {
+                Li[j] = 0;
+                continue;
+            }
+
+            const Double_t * Lj = &cov[j * n];
+
+            Double_t sum = Li[j];
+            for (size_t k = 0; k < j; ++k)
+                sum -= Li[k] * Lj[k];
+
+            Li[j] = sum / Lj[j];
+        }
+
+        Double_t diag  = Li[i];
+        Double_t pivot = diag;
+        for (size_t k = 0; k < i; ++k)
+            pivot -= Li[k] * Li[k];
+
+        if (!(diag > 0) || (pivot <= diag * DependentPivot))
+        {
+            Li[i] = 0;
+            continue;   // dependent or empty bin
+        }
+
+        Li[i]   = std::sqrt( pivot );
+        used[i] = true;
+
+        Double_t sum = diff[i];
+        for (size_t k = 0; k < i; ++k)
+            sum -= Li[k] * z[k];
+
+        z[i] = sum / Li[i];
+
+        res.chi2 += z[i] * z[i];
+        ++res.ndf;
+    }
+
+    res.prob     = (res.ndf > 0 ? TMath::Prob( res.chi2, res.ndf ) : 0.0);
+    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
+
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
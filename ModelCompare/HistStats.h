@@ -0,0 +1,117 @@
+//
+//  HistStats.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef HIST_STATS_H
+#define HIST_STATS_H
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Statistical comparison kernels that work directly on the bin arrays (see HistBinView).
+// They reproduce the ROOT functions named in the comments, but do not clone or modify
+// the histograms, and allocate nothing.
+// Only the bins 1..nBins are used (no under/overflow), as in the ROOT functions.
+
+// A bin mask selects bins from the effective entries of the two histograms (or, for a ratio,
+// of the denominator and numerator). Bins not selected are treated as empty in both histograms.
+typedef bool StatBinMask( Double_t effEntries1, Double_t effEntries2 );
+
+// Selects all bins except those empty in only one histogram (same as ZeroHistEmptyBins).
+bool StatBinMaskNonEmpty( Double_t effEntries1, Double_t effEntries2 );
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bins of a histogram, with an optional luminosity scale (see HistBinView),
+// and an optional denominator histogram (bins are then the ratio, as TH1::Divide).
+// The optional per-bin selection excludes bins where it is zero, as if they were empty.
+struct StatBins
+{
+    const HistBinView * pHist       = nullptr;
+    const HistBinView * pDenom      = nullptr;
+    Double_t            scale       = 1;
+    Double_t            denomScale  = 1;
+    const UChar_t *     pSelect     = nullptr;  // [bin], including under/overflow
+
+    explicit StatBins( const HistBinView & hist, Double_t scale = 1 )
+      : pHist(&hist), scale(scale)
+    {
+    }
+
+    StatBins( const HistBinView & hist, Double_t scale, const HistBinView & denom, Double_t denomScale )
+      : pHist(&hist), pDenom(&denom), scale(scale), denomScale(denomScale)
+    {
+    }
+
+    Int_t NumBins() const { return pHist->nSize - 2; }
+
+    void GetBin( Int_t bin, Double_t & content, Double_t & errorSqr ) const;
+
+    StatBins & Select( const UChar_t * pSelectBins )    { pSelect = pSelectBins; return *this; }
+
+    bool IsSelected( Int_t bin, StatBinMask * pMask ) const;    // pMask is applied to ratios only
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum Chi2TestType
+{
+    kChi2TestUU,    // unweighted - unweighted
+    kChi2TestWW,    // weighted - weighted
+};
+
+// TH1::KolmogorovTest, default options
+Double_t StatKolmogorovTest( const StatBins & h1, const StatBins & h2, StatBinMask * pMask = nullptr );
+
+// TH1::Chi2TestX with option "UU" or "WW"
+Chi2Result StatChi2Test( const StatBins & h1, const StatBins & h2, Chi2TestType type, StatBinMask * pMask = nullptr );
+
+// HistPointChi2Test
+Chi2Result StatPointChi2Test( const StatBins & h1, const StatBins & h2, StatBinMask * pMask = nullptr );
+
+// TH1::Chisquare with a horizontal line at value, ndf = number of bins with non-zero error
+Chi2Result StatChi2ToValue( const StatBins & h, Double_t value, StatBinMask * pMask = nullptr );
+
+// Weighted least squares fit of a polynomial of degree 0, 1 or 2 to the bin centers,
+// same as TH1::Fit with "pol0", "pol1" or "pol2", but solved in closed form.
+// Bins with zero error are skipped, as in TH1::Fit.
+struct PolyFitResult
+{
+    static const Int_t MaxDegree = 2;
+
+    Int_t       degree  = 0;
+    Double_t    param[MaxDegree + 1] = { };
+    Double_t    error[MaxDegree + 1] = { };
+    Chi2Result  chi2;
+    bool        bValid  = false;    // false if too few bins with non-zero error
+};
+
+PolyFitResult StatFitPolynomial( const StatBins & h, Int_t degree, StatBinMask * pMask = nullptr );
+
+// TH1::Fit with "pol0"
+Chi2Result StatFitToConstant( const StatBins & h, Double_t & cValue, Double_t & cError, StatBinMask * pMask = nullptr );
+
+// Chi2 of a difference vector with a covariance matrix (n x n, row-major): chi2 = d^T V^-1 d
+// Solved with a Cholesky decomposition of cov, which is modified. Bins that are linearly
+// dependent on the preceding bins (zero pivot) are dropped; ndf = number of bins used.
+Chi2Result StatCovarianceChi2( const std::vector<Double_t> & diff, std::vector<Double_t> & cov );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // HIST_STATS_H
@@ -0,0 +1,261 @@
+//
+//  HistToys.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "HistToys.h"
+
+#include "common.h"
+#include "RootUtil.h"
+#include "HistStats.h"
+#include "Parallel.h"
+
+// Root includes
+#include <TH1.h>
+#include <TRandom3.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const size_t ToyBlockSize = 64;  // toys per random number stream
+
+////////////////////////////////////////////////////////////////////////////////
+static UInt_t ToyBlockSeed( UInt_t seed, UInt_t stream, size_t block )
+{
+    // the murmur3 finalizer applied after each input, so nearby seeds, streams and blocks are unrelated
+    auto Mix = []( UInt_t h ) -> UInt_t
+    {
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h;
+    };
+
+    UInt_t h = Mix( seed );
+    h = Mix( h ^ stream );
+    h = Mix( h ^ (UInt_t)block );
+
+    return h ? h : 1;   // 0 would be a random seed of TRandom3
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool MakeToyTemplates( const StatBins & h1, const StatBins & h2, ToyTemplate & t1, ToyTemplate & t2 )
+{
+    const Int_t nSize = h1.pHist->nSize;
+
+    std::vector<Double_t> c1( nSize, 0.0 ), e1( nSize, 0.0 );
+    std::vector<Double_t> c2( nSize, 0.0 ), e2( nSize, 0.0 );
+
+    Double_t sum1(0), sumErr1(0);
+    Double_t sum2(0), sumErr2(0);
+
+    for (Int_t bin = 1; bin < nSize - 1; ++bin)    // under/overflow are not tested
+    {
+        if (!h1.IsSelected( bin, nullptr ) || !h2.IsSelected( bin, nullptr ))
+            continue;
+
+        h1.GetBin( bin, c1[bin], e1[bin] );
+        h2.GetBin( bin, c2[bin], e2[bin] );
+
+        if ((c1[bin] < 0) || (c2[bin] < 0))
+            return false;
+
+        sum1 += c1[bin];    sumErr1 += e1[bin];
+        sum2 += c2[bin];    sumErr2 += e2[bin];
+    }
+
+    if ((sum1 <= 0) || (sum2 <= 0))
+        return false;
+
+    // mean event weight of a bin, or of the whole histogram for empty bins
+    const Double_t meanWeight1 = sumErr1 / sum1;
+    const Double_t meanWeight2 = sumErr2 / sum2;
+
+    t1.mean  .assign( nSize, 0.0 );
+    t1.weight.assign( nSize, meanWeight1 );
+    t2.mean  .assign( nSize, 0.0 );
+    t2.weight.assign( nSize, meanWeight2 );
+
+    for (Int_t bin = 1; bin < nSize - 1; ++bin)
+    {
+        Double_t shape = 0.5 * (c1[bin] / sum1 + c2[bin] / sum2);
+
+        t1.mean[bin] = shape * sum1;
+        t2.mean[bin] = shape * sum2;
+
+        if ((c1[bin] > 0) && (e1[bin] > 0)) t1.weight[bin] = e1[bin] / c1[bin];
+        if ((c2[bin] > 0) && (e2[bin] > 0)) t2.weight[bin] = e2[bin] / c2[bin];
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void FluctuateToy( const ToyTemplate & t, ToyFluctuation fluctuation, TRandom3 & random,
+                          std::vector<Double_t> & sumw, std::vector<Double_t> & sumw2 )
+{
+    const size_t nSize = t.mean.size();
+
+    for (size_t bin = 0; bin < nSize; ++bin)
+    {
+        const Double_t mean   = t.mean  [bin];
+        const Double_t weight = t.weight[bin];
+
+        if ((mean <= 0) || (weight <= 0))
+        {
+            sumw [bin] = 0;
+            sumw2[bin] = 0;
+            continue;
+        }
+
+        if (fluctuation == kToyPoisson)
+        {
+            Double_t n = random.Poisson( mean / weight );   // effective entries
+
+            sumw [bin] = n * weight;
+            sumw2[bin] = n * weight * weight;
+        }
+        else
+        {
+            Double_t errorSqr = mean * weight;
+
+            sumw [bin] = std::max( random.Gaus( mean, std::sqrt(errorSqr) ), 0.0 );
+            sumw2[bin] = (sumw[bin] > 0) ? errorSqr : 0;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ToyPValueRun::ToyPValueRun( const StatBins & h1, const StatBins & h2, const ToyConfig & config,
+                            Double_t ksProb, Double_t chi2Prob, UInt_t stream /*= 0*/ )
+  : config(config), stream(stream), ksProb(ksProb), chi2Prob(chi2Prob), pSelect1(h1.pSelect), pSelect2(h2.pSelect)
+{
+    if (config.nToys == 0)
+        return;
+
+    if (h1.pDenom || h2.pDenom || h1.pHist->pProfile || h2.pHist->pProfile)
+        return;
+
+    if (h1.pHist->nSize != h2.pHist->nSize)
+        ThrowError( "StatToyPValues: histogram size mismatch." );
+
+    if (!MakeToyTemplates( h1, h2, t1, t2 ))
+        return;
+
+    const size_t nBlocks = (config.nToys + ToyBlockSize - 1) / ToyBlockSize;
+
+    ksCount  .assign( nBlocks, 0 );
+    chi2Count.assign( nBlocks, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ToyPValueRun::RunBlock( size_t block )
+{
+    // seed each block independently of the thread it runs on
+    TRandom3 random( ToyBlockSeed( config.seed, stream, block ) );
+
+    const Int_t nSize = (Int_t)t1.mean.size();
+
+    std::vector<Double_t> sumw1( nSize ), sumw21( nSize );
+    std::vector<Double_t> sumw2( nSize ), sumw22( nSize );
+
+    const HistBinView v1( sumw1.data(), sumw21.data(), nSize );
+    const HistBinView v2( sumw2.data(), sumw22.data(), nSize );
+
+    StatBins toy1( v1 );
+    StatBins toy2( v2 );
+    toy1.Select( pSelect1 );
+    toy2.Select( pSelect2 );
+
+    const size_t toyEnd = std::min( (block + 1) * ToyBlockSize, config.nToys );
+
+    for (size_t toy = block * ToyBlockSize; toy < toyEnd; ++toy)
+    {
+        FluctuateToy( t1, config.fluctuation, random, sumw1, sumw21 );
+        FluctuateToy( t2, config.fluctuation, random, sumw2, sumw22 );
+
+        // same tests as KolmogorovTest_NonEmptyBins and Chi2Result::Chi2Test
+        if (StatKolmogorovTest( toy1, toy2, StatBinMaskNonEmpty ) <= ksProb)
+            ++ksCount[block];
+
+        if (StatChi2Test( toy1, toy2, kChi2TestWW, StatBinMaskNonEmpty ).prob <= chi2Prob)
+            ++chi2Count[block];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ToyPValues ToyPValueRun::Result() const
+{
+    ToyPValues result;
+
+    if (BlockCount() == 0)
+        return result;
+
+    size_t ksTotal(0), chi2Total(0);
+    for (size_t block = 0; block < BlockCount(); ++block)
+    {
+        ksTotal   += ksCount  [block];
+        chi2Total += chi2Count[block];
+    }
+
+    result.nToys    = config.nToys;
+    result.ksProb   = (1.0 + ksTotal)   / (1.0 + config.nToys);
+    result.chi2Prob = (1.0 + chi2Total) / (1.0 + config.nToys);
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ToyPValues StatToyPValues( const StatBins & h1, const StatBins & h2, const ToyConfig & config,
+                           Double_t ksProb, Double_t chi2Prob, UInt_t stream /*= 0*/ )
+{
+    ToyPValueRun run( h1, h2, config, ksProb, chi2Prob, stream );
+
+    ParallelFor( run.BlockCount(), [&]( size_t block )
+    {
+        run.RunBlock( block );
+    });
+
+    return run.Result();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ToyPValues HistToyPValues( const TH1D & h1, const TH1D & h2, const ToyConfig & config,
+                           Double_t ksProb, Double_t chi2Prob,
+                           const UChar_t * pSelect1 /*= nullptr*/, const UChar_t * pSelect2 /*= nullptr*/ )
+{
+    const HistBinView v1( h1 );
+    const HistBinView v2( h2 );
+
+    return StatToyPValues( StatBins(v1).Select(pSelect1), StatBins(v2).Select(pSelect2), config, ksProb, chi2Prob,
+                           ToyStream( h1.GetName(), h2.GetName() ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UInt_t ToyStream( const char * name1, const char * name2 )
+{
+    UInt_t hash = 2166136261u;
+
+    for (const char * pName : { name1, name2 })
+    {
+        for (const char * p = pName; p && *p; ++p)
+            hash = (hash ^ (UChar_t)*p) * 16777619u;
+
+        hash = (hash ^ 0xFFu) * 16777619u;     // separator, so ("ab", "c") differs from ("a", "bc")
+    }
+
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
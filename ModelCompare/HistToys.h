@@ -0,0 +1,115 @@
+//
+//  HistToys.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef HIST_TOYS_H
+#define HIST_TOYS_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "HistStats.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Toy Monte Carlo calibration of the p-values of KolmogorovTest_NonEmptyBins and
+// Chi2Result::Chi2Test.
+//
+// Under the null hypothesis both histograms have the same shape, estimated as the mean
+// of the two normalized histograms. Each toy fluctuates both histograms around this shape,
+// keeping their own normalization and mean event weight per bin, and re-runs the test on
+// the toy pair with the same bin selection. The empirical p-value is the fraction of toys
+// with a p-value at most the observed one:
+//      p = (1 + count) / (1 + nToys)
+//
+// The toys are generated in blocks, in parallel (see ParallelFor). Each block has its own
+// random number stream seeded from the seed and the block index, so the result is
+// reproducible and independent of the number of threads.
+
+enum ToyFluctuation
+{
+    kToyPoisson,    // effective entries are Poisson distributed
+    kToyWeight,     // content is Gaussian distributed with the bin error, truncated at zero
+};
+
+struct ToyConfig
+{
+    size_t          nToys       = 0;    // 0 = no toys
+    UInt_t          seed        = 4357;
+    ToyFluctuation  fluctuation = kToyPoisson;
+};
+
+struct ToyPValues
+{
+    size_t      nToys       = 0;    // 0 if not calculated
+    Double_t    ksProb      = -1;   // empirical p-value of StatKolmogorovTest
+    Double_t    chi2Prob    = -1;   // empirical p-value of StatChi2Test, "WW"
+};
+
+// Only TH1D bins are supported (no TProfile or ratio); otherwise no toys are made.
+// The toys are seeded from config.seed and the stream, an identity of the histogram pair (see ToyStream),
+// so different pairs compared with the same config have independent toys.
+ToyPValues StatToyPValues( const StatBins & h1, const StatBins & h2, const ToyConfig & config,
+                           Double_t ksProb, Double_t chi2Prob,     // observed p-values
+                           UInt_t stream = 0 );
+
+// same, for the histograms and selections of KolmogorovTest_NonEmptyBins and Chi2Result::Chi2Test,
+// with the stream of the histogram names
+ToyPValues HistToyPValues( const TH1D & h1, const TH1D & h2, const ToyConfig & config,
+                           Double_t ksProb, Double_t chi2Prob,
+                           const UChar_t * pSelect1 = nullptr, const UChar_t * pSelect2 = nullptr );
+
+// toy stream of a histogram pair, a 32-bit FNV-1a hash of their names
+UInt_t ToyStream( const char * name1, const char * name2 );
+
+// expected toy bins of one histogram under the null hypothesis
+struct ToyTemplate
+{
+    std::vector<Double_t>   mean;       // [bin] expected content
+    std::vector<Double_t>   weight;     // [bin] mean event weight, error^2 / content
+};
+
+// The toy blocks of StatToyPValues, run one at a time, so the blocks of several histogram pairs can
+// be distributed together over the worker threads (see ParallelFor). RunBlock may be called in
+// parallel for different blocks, and Result once all blocks have run. The bin selections must
+// outlive the run, the histograms need not. Each block is seeded from config.seed, the stream and
+// the block, so the toys do not depend on the thread that runs the block.
+struct ToyPValueRun
+{
+    ToyPValueRun( const StatBins & h1, const StatBins & h2, const ToyConfig & config,
+                  Double_t ksProb, Double_t chi2Prob,       // observed p-values
+                  UInt_t stream = 0 );                      // see ToyStream
+
+    size_t      BlockCount() const  { return ksCount.size(); }  // 0 if no toys are made
+    void        RunBlock( size_t block );
+    ToyPValues  Result() const;
+
+private:
+    ToyConfig               config;
+    UInt_t                  stream      = 0;
+    Double_t                ksProb      = 0;
+    Double_t                chi2Prob    = 0;
+    const UChar_t *         pSelect1    = nullptr;
+    const UChar_t *         pSelect2    = nullptr;
+    ToyTemplate             t1;
+    ToyTemplate             t2;
+    std::vector<size_t>     ksCount;    // [block] toys with p-value <= observed
+    std::vector<size_t>     chi2Count;  // [block]
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // HIST_TOYS_H
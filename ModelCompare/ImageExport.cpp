@@ -0,0 +1,173 @@
+//
+//  ImageExport.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "ImageExport.h"
+
+#include "common.h"
+#include "RootUtil.h"
+#include "Parallel.h"
+
+// Root includes
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TVirtualPad.h>
+
+// POSIX includes
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::vector<pid_t>   s_exportWorkers;        // running worker processes
+static size_t               s_exportFailures = 0;   // failed worker processes since BeginImageExport
+
+////////////////////////////////////////////////////////////////////////////////
+static void WaitExportWorker( pid_t pid )
+{
+    int status = 0;
+    while (waitpid( pid, &status, 0 ) < 0)
+    {
+        if (errno != EINTR)
+        {
+            ++s_exportFailures;
+            return;
+        }
+    }
+
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+        ++s_exportFailures;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool PrintPadImages( const TVirtualPad & pad, const char * name, const ImageExport & config )
+{
+    // SaveAs does not report errors, so check that each file was written
+    bool bSuccess = true;
+
+    for (const char * format : config.formats)
+    {
+        std::string fileName = config.directory + "/" + name + "." + format;
+
+        gSystem->Unlink( fileName.c_str() );    // so an old file is not taken as written
+        pad.SaveAs( fileName.c_str() );
+
+        FileStat_t stat;
+        if ((gSystem->GetPathInfo( fileName.c_str(), stat ) != 0) || (stat.fSize <= 0))
+        {
+            LogMsgError( "Failed to export image (%hs).", FMT_HS(fileName.c_str()) );
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BeginImageExport( const ImageExport & config )
+{
+    if (!config.IsEnabled())
+        return;
+
+    // render without a display
+    gROOT->SetBatch( kTRUE );
+
+    if (gSystem->AccessPathName( config.directory.c_str() ))    // true if path does not exist
+    {
+        if (gSystem->mkdir( config.directory.c_str(), kTRUE ) != 0)
+            ThrowError( "BeginImageExport: Failed to create directory " + config.directory );
+    }
+
+    s_exportFailures = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ExportPadImages( const TVirtualPad & pad, const char * name, const ImageExport & config )
+{
+    if (!config.IsEnabled())
+        return;
+
+    const size_t nProcesses = config.nProcesses ? config.nProcesses : GetParallelThreadCount();
+
+    if (nProcesses <= 1)
+    {
+        if (!PrintPadImages( pad, name, config ))
+            ++s_exportFailures;
+        return;
+    }
+
+    // wait for the oldest worker
+    while (s_exportWorkers.size() >= nProcesses)
+    {
+        pid_t pid = s_exportWorkers.front();
+        s_exportWorkers.erase( s_exportWorkers.begin() );
+        WaitExportWorker( pid );
+    }
+
+    // flush buffered output, so it is not written again by the worker
+    fflush( stdout );
+    fflush( stderr );
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        // cannot fork, render in this process instead
+        if (!PrintPadImages( pad, name, config ))
+            ++s_exportFailures;
+        return;
+    }
+
+    if (pid == 0)
+    {
+        // worker: render and exit immediately, without any cleanup of the parent's objects (e.g. open files)
+        int status = 0;
+        try
+        {
+            if (!PrintPadImages( pad, name, config ))
+                status = 1;
+        }
+        catch (...)
+        {
+            status = 1;
+        }
+
+        fflush( stdout );
+        fflush( stderr );
+        _exit( status );
+    }
+
+    s_exportWorkers.push_back( pid );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void EndImageExport()
+{
+    while (!s_exportWorkers.empty())
+    {
+        pid_t pid = s_exportWorkers.front();
+        s_exportWorkers.erase( s_exportWorkers.begin() );
+        WaitExportWorker( pid );
+    }
+
+    if (s_exportFailures)
+    {
+        size_t nFailures = s_exportFailures;
+        s_exportFailures = 0;
+
+        ThrowError( StringFormat( "EndImageExport: %u image exports failed.", FMT_U(nFailures) ) );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
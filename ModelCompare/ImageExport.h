@@ -0,0 +1,56 @@
+//
+//  ImageExport.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef IMAGE_EXPORT_H
+#define IMAGE_EXPORT_H
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <Rtypes.h>
+
+class TVirtualPad;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Export of canvases to image files (directory/<canvas name>.<format>), in batch mode.
+// Each canvas is rendered in a forked worker process, which gets a copy of the canvas
+// at the time of the fork, so the caller can continue with the next canvas at once.
+struct ImageExport
+{
+    std::string     directory;                      // output directory, empty = no export
+    CStringVector   formats     = { "pdf" };        // file extensions, e.g. "pdf", "png", "svg"
+    size_t          nProcesses  = 0;                // maximum concurrent worker processes, 0 = GetParallelThreadCount(), 1 = no fork
+
+    ImageExport() = default;
+    ImageExport( const std::string & d )                                : directory(d)              {}
+    ImageExport( const std::string & d, const CStringVector & f )       : directory(d), formats(f)  {}
+
+    bool IsEnabled() const { return !directory.empty() && !formats.empty(); }
+};
+
+// Create the directory and enable batch mode.
+void BeginImageExport( const ImageExport & config );
+
+// Render the pad to all formats. Blocks only while the maximum number of workers are running.
+void ExportPadImages( const TVirtualPad & pad, const char * name, const ImageExport & config );
+
+// Wait for all workers to finish. Throws if any export failed, i.e. an image file is missing or empty after rendering.
+void EndImageExport();
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // IMAGE_EXPORT_H
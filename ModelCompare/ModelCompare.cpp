@@ -10,18 +10,25 @@
 
 #include "common.h"
 #include "RootUtil.h"
+#include "HistStats.h"
+#include "HistBank.h"
+#include "ModelStore.h"
+#include "Parallel.h"
+#include "QuantileSketch.h"
+
+#include <sstream>
 
 // Root includes
-#include <TStyle.h>
 #include <TFile.h>
 #include <TH1.h>
 #include <TProfile.h>
-#include <TCanvas.h>
-#include <TLegend.h>
-#include <TPaveText.h>
-#include <TLine.h>
 #include <TF1.h>
+#include <TGraph.h>
+#include <TH2.h>
+#include <TNtupleD.h>
 #include <TMath.h>
+#include <TObjString.h>
+#include <TSystem.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -67,20 +74,100 @@ std::string Observable::BuildHistTitle( const char * titlePrefix /*= nullptr*/,
 ////////////////////////////////////////////////////////////////////////////////
 void Observable::FillHist( TH1D & hist, double weight, const HepMC::GenVertex & signal ) const
 {
+    double values[2] = { };
+
     if (hist.InheritsFrom(TProfile::Class()))
-    {
-        double values[2] = { };
         getFunction( signal, values, 2 );
+    else
+        getFunction( signal, values, 1 );
 
+    FillHist( hist, weight, values );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void Observable::FillHist( TH1D & hist, double weight, const double * values ) const
+{
+    if (hist.InheritsFrom(TProfile::Class()))
         static_cast<TProfile &>(hist).Fill( values[0], values[1], weight );
-    }
     else
+        hist.Fill( values[0], weight );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool IsFactory( const TH1DFactoryFunction & factoryFunction, TH1DFactoryFunctionType * pFactory )
+{
+    TH1DFactoryFunctionType * const * ppFunction = factoryFunction.target<TH1DFactoryFunctionType *>();
+
+    return ppFunction && (*ppFunction == pFactory);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static size_t GetValueCount( const Observable & obs, const TH1D * pHist = nullptr )
+{
+    // number of values per event of getFunction used by obs: 2 for a TProfile, otherwise nDim (1 or 2)
+
+    bool bProfile = pHist ? pHist->InheritsFrom(TProfile::Class()) : IsFactory( obs.factoryFunction, DefaultTProfileFactory );
+
+    return bProfile ? 2 : std::min( std::max( obs.nDim, size_t(1) ), size_t(2) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Observable Observable::Rebin( const char * name, Int_t nBins, Double_t xMin, Double_t xMax,
+                              const TH1DFactoryFunction & factoryFunction /*= nullptr*/ ) const
+{
+    Observable obs = *this;
+
+    obs.name        = name;
+    obs.nBins       = nBins;
+    obs.xMin        = xMin;
+    obs.xMax        = xMax;
+    obs.valueSource = valueSource ? valueSource : this->name;
+
+    if (factoryFunction)
+    {
+        obs.factoryFunction = factoryFunction;
+
+        // a copy uses only the values its histogram needs, which must be provided by this observable
+        if (IsFactory( factoryFunction, DefaultTProfileFactory ))
+            obs.nDim = 2;
+        else if (IsFactory( factoryFunction, DefaultTH1DFactory ))
+            obs.nDim = 1;
+
+        if (GetValueCount( obs ) > GetValueCount( *this ))
+            ThrowError( std::string("Observable::Rebin: ") + obs.name + " needs 2 values, but " + this->name + " provides 1." );
+    }
+
+    return obs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static std::vector<size_t> FindValueSources( const ObservableVector & observables )
+{
+    // source[obs] = index of the observable whose getFunction provides the values of obs
+
+    std::vector<size_t> source;
+
+    for (const Observable & obs : observables)
     {
-        double value(0);
-        getFunction( signal, &value, 1 );
+        if (!obs.valueSource)
+        {
+            source.push_back( source.size() );
+            continue;
+        }
 
-        hist.Fill( value, weight );
+        auto itr = std::find_if( observables.cbegin(), observables.cend(),
+                                 [&]( const Observable & o ) { return strcmp( o.name, obs.valueSource ) == 0; } );
+
+        if ((itr == observables.cend()) || itr->valueSource)
+            ThrowError( std::string("Value source not found for observable ") + obs.name );
+
+        if (GetValueCount( obs ) > GetValueCount( *itr ))
+            ThrowError( std::string("Value source ") + itr->name + " provides 1 value, but observable " + obs.name + " needs 2." );
+
+        source.push_back( (size_t)(itr - observables.cbegin()) );
     }
+
+    return source;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,71 +218,108 @@ void ScaleHistToLuminosity( double luminosity, const TH1DVector & hists, const M
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-GoodBadHists HistSplitGoodBadBins( const TH1D * pSource, const TH1D * pCompare /*= nullptr*/ )
+bool IsGoodStatBin( Double_t effEntries )
 {
     const Double_t GoodStatMinEvents = 10;
 
-    if (!pSource)
-        return { nullptr, nullptr };
+    return (effEntries >= GoodStatMinEvents * (1.0 - std::numeric_limits<Double_t>::epsilon()));
+}
 
-    if (!pCompare)
-        pCompare = pSource;
+////////////////////////////////////////////////////////////////////////////////
+bool IsGoodStatBinPair( Double_t effEntries1, Double_t effEntries2 )
+{
+    return IsGoodStatBin( effEntries1 ) && IsGoodStatBin( effEntries2 );
+}
 
-    const std::string sourceName( pSource->GetName() );
+////////////////////////////////////////////////////////////////////////////////
+GoodBadMask MakeGoodBadMask( const TH1D & source, const ConstTH1DVector & reference, std::vector<std::string> * pLog /*= nullptr*/ )
+{
+    GoodBadMask mask;
 
-    TH1D * pGood = (TH1D *)pSource->Clone( (sourceName + "_good").c_str() );    // polymorhic clone
-    pGood->SetDirectory( nullptr );                                             // ensure not owned by any directory
+    const HistBinView sourceView( source );
+    const Int_t nSize = sourceView.nSize;
 
-    TH1D * pBad  = (TH1D *)pSource->Clone( (sourceName + "_bad").c_str() );     // polymorphic clone
-    pBad->SetDirectory( nullptr );                                              // ensure not owned by any directory
+    mask.good.assign( nSize, 1 );
 
-    size_t nGood(0), nBad(0), nEmpty(0);
+    std::vector<Double_t> effEntries( nSize );
+    std::string           refNames;
 
-    const Int_t nSize = pCompare->GetSize();
-    for (Int_t bin = 0; bin < nSize; ++bin)  // include under/overflow bins
+    for (const TH1D * pRef : reference)
     {
-        Double_t compEffEntries = GetHistBinEffectiveEntries( *pCompare, bin );
+        if (pRef->GetSize() != nSize)
+            ThrowError( "MakeGoodBadMask: histogram size mismatch." );
+
+        HistEffectiveEntries( HistBinView( *pRef ), effEntries.data() );
 
-        bool bGood = (compEffEntries >= GoodStatMinEvents * (1.0 - std::numeric_limits<Double_t>::epsilon()));
+        for (Int_t bin = 0; bin < nSize; ++bin)  // include under/overflow bins
+            mask.good[bin] &= IsGoodStatBin( effEntries[bin] ) ? 1 : 0;
 
-        const TH1D * pKeep =  bGood ? pGood : pBad;
-        TH1D *       pZero = !bGood ? pGood : pBad;
+        refNames += (refNames.empty() ? "" : ", ") + std::string(pRef->GetName());
+    }
 
-        // if good zero bad and visa versa
-        ZeroHistBin( *pZero, bin );
+    std::vector<UChar_t> nonEmpty( nSize );
+    HistNonEmptyMask( sourceView, nonEmpty.data() );
 
-        Double_t     keepEffEntries = GetHistBinEffectiveEntries( *pKeep, bin );
-        const char * sType          = nullptr;
+    for (Int_t bin = 0; bin < nSize; ++bin)
+    {
+        const bool bGood = (mask.good[bin] != 0);
 
-        if (keepEffEntries == 0)
+        if (!nonEmpty[bin])
         {
-            ++nEmpty;
-            sType = "Empty";
+            ++mask.nEmpty;
         }
         else if (bGood)
         {
-            ++nGood;
-            sType = "Good";
+            ++mask.nGood;
         }
         else
         {
-            ++nBad;
-            sType = "Bad";
+            ++mask.nBad;
+            if ((bin > 0) && (bin < nSize - 1))
+                ++mask.nBadInRange;
         }
-
-        //LogMsgInfo( "%i Comp: %g (±%g)[%g]        %hs: %g (±%g)[%g]", FMT_I(bin),
-        //    FMT_F(pCompare->GetBinContent(bin)), FMT_F(pCompare->GetBinError(bin)), FMT_F(compEffEntries), FMT_HS(sType),
-        //    FMT_F(pKeep   ->GetBinContent(bin)), FMT_F(pKeep   ->GetBinError(bin)), FMT_F(keepEffEntries) );
     }
 
-    pGood->ResetStats();
-    pBad ->ResetStats();
+    std::string msg = StringFormat( "HistSplitGoodBadBins: %hs using %hs -> %u bins: %u good, %u bad, %u empty",
+                                    FMT_HS(source.GetName()), FMT_HS(refNames.c_str()),
+                                    FMT_I(nSize), FMT_U(mask.nGood), FMT_U(mask.nBad), FMT_U(mask.nEmpty) );
+    if (pLog)
+        pLog->push_back( msg );
+    else
+        LogMsgInfo( "%hs", FMT_HS(msg.c_str()) );
+
+    return mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1D * MakeGoodBadHist( const TH1D & source, const GoodBadMask & mask, bool bGood )
+{
+    const std::string name = std::string(source.GetName()) + (bGood ? "_good" : "_bad");
+
+    TH1D * pHist = (TH1D *)source.Clone( name.c_str() );    // polymorphic clone
+    pHist->SetDirectory( nullptr );                         // ensure not owned by any directory
+
+    // zero the bins of the other kind
+    ZeroHistBins( HistBinArrays( *pHist ), mask.good.data(), bGood ? 0 : 1 );
+
+    pHist->ResetStats();
+
+    return pHist;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GoodBadHists HistSplitGoodBadBins( const TH1D * pSource, const TH1D * pCompare /*= nullptr*/ )
+{
+    if (!pSource)
+        return { nullptr, nullptr };
+
+    if (!pCompare)
+        pCompare = pSource;
 
-    LogMsgInfo( "HistSplitGoodBadBins: %hs using %hs -> %u bins: %u good, %u bad, %u empty",
-                FMT_HS(pSource->GetName()), FMT_HS(pCompare->GetName()),
-                FMT_I(nSize), FMT_U(nGood), FMT_U(nBad), FMT_U(nEmpty) );
+    GoodBadMask mask = MakeGoodBadMask( *pSource, { pCompare } );
 
-    return { TH1DUniquePtr(pGood), TH1DUniquePtr(pBad) };
+    return { TH1DUniquePtr( MakeGoodBadHist( *pSource, mask, true  ) ),
+             TH1DUniquePtr( MakeGoodBadHist( *pSource, mask, false ) ) };
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -249,23 +373,17 @@ std::string GetChi2ResultString( const Chi2Result & res1, const Chi2Result & res
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-Chi2Result FitToHorzLineAtOne( const TH1D & hist )
+Chi2Result FitToHorzLineAtOne( const TH1D & hist, const UChar_t * pSelect = nullptr )
 {
-    TF1 horz1( "horz1", "1.0" );
+    HistBinView view( hist );
 
-    Chi2Result res;
-    res.chi2     = hist.Chisquare( &horz1 );    // skips bins with zero error
-    res.ndf      = (Int_t)HistErrorBinCount(hist);
-    res.prob     = (res.ndf > 0 ? TMath::Prob( res.chi2, res.ndf ) : 0.0);
-    res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
-
-    return res;
+    return StatChi2ToValue( StatBins(view).Select(pSelect), 1.0 );  // skips bins with zero error
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-std::string GetLabel_FitToHorzLineAtOne( const TH1D & hist )
+std::string GetLabel_FitToHorzLineAtOne( const TH1D & hist, const UChar_t * pSelect = nullptr )
 {
-    Chi2Result res = FitToHorzLineAtOne( hist );
+    Chi2Result res = FitToHorzLineAtOne( hist, pSelect );
 
     std::string label = "Fit to 1: " + GetChi2ResultString( res );
     return label;
@@ -282,37 +400,68 @@ std::string GetLabel_FitToHorzLineAtOne( const TH1D & hist1, const TH1D & hist2
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-Chi2Result FitToHorzLineAtConstant( const TH1D & hist, Double_t & cValue, Double_t & cError )
+Chi2Result FitToHorzLineAtConstant( const TH1D & hist, Double_t & cValue, Double_t & cError, const UChar_t * pSelect = nullptr )
+{
+    HistBinView view( hist );
+
+    return StatFitToConstant( StatBins(view).Select(pSelect), cValue, cError );  // skips bins with zero error
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Chi2Result FitToFormula( const TH1D & hist, const char * formula, std::vector<Double_t> & params, std::vector<Double_t> & errors )
 {
-    cValue = cError = 0;
+    params.clear();
+    errors.clear();
+
+    // polynomials up to pol2 are linear in the parameters, so use the closed form solution
+    for (Int_t degree = 0; degree <= PolyFitResult::MaxDegree; ++degree)
+    {
+        if (StringFormat( "pol%i", FMT_I(degree) ) != formula)
+            continue;
+
+        HistBinView view( hist );
+
+        PolyFitResult fit = StatFitPolynomial( StatBins(view), degree );   // skips bins with zero error
+        if (!fit.bValid)
+            return Chi2Result();
+
+        params.assign( fit.param, fit.param + degree + 1 );
+        errors.assign( fit.error, fit.error + degree + 1 );
+
+        return fit.chi2;
+    }
 
-    TF1 horz( "horz", "pol0" );
-    horz.SetParameter( 0, 1.0 );
+    // non-linear shapes use Minuit
+
+    TF1 func( "fitFormula", formula );
 
     TH1DUniquePtr pFitHist{ (TH1D *)hist.Clone() };     // clone hist as Fit is not const
 
-    int fitStatus = pFitHist->Fit( &horz, "NQM" );      // skips bins with zero error
+    int fitStatus = pFitHist->Fit( &func, "NQM" );      // skips bins with zero error
     if ((fitStatus < 0) || (fitStatus % 1000 != 0))     // ignore improve (M) errors
         return Chi2Result();
 
     Chi2Result res;
-    res.chi2     = horz.GetChisquare();
-    res.ndf      = horz.GetNDF();
-    res.prob     = horz.GetProb();
+    res.chi2     = func.GetChisquare();
+    res.ndf      = func.GetNDF();
+    res.prob     = func.GetProb();
     res.chi2_ndf = (res.ndf > 0 ? res.chi2 / res.ndf : 0.0);
 
-    cValue = horz.GetParameter(0);
-    cError = horz.GetParError(0);
+    for (Int_t i = 0; i < func.GetNpar(); ++i)
+    {
+        params.push_back( func.GetParameter(i) );
+        errors.push_back( func.GetParError(i) );
+    }
 
     return res;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-std::string GetLabel_FitToHorzLineAtConstant( const TH1D & hist )
+std::string GetLabel_FitToHorzLineAtConstant( const TH1D & hist, const UChar_t * pSelect = nullptr )
 {
     Double_t cValue(0), cError(0);
 
-    Chi2Result res = FitToHorzLineAtConstant( hist, cValue, cError );
+    Chi2Result res = FitToHorzLineAtConstant( hist, cValue, cError, pSelect );
 
     std::string label = StringFormat( "Fit to c = %.2g#pm%.2g: ",
                                       FMT_F(cValue), FMT_F(cError) );
@@ -342,289 +491,380 @@ std::string GetLabel_FitToHorzLineAtConstant( const TH1D & hist1, const TH1D & h
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void HistScaleTextTicks( TH1D & hist, Float_t vert, Float_t horz = 1 )
+Chi2Result CalculateCompareChi2( const TH1D & base, const TH1D & comp, double baseScale /*= 1.0*/, double compScale /*= 1.0*/ )
 {
-    TAxis * xAxis = hist.GetXaxis();
-    TAxis * yAxis = hist.GetYaxis();
-
-    if (vert <= 0) vert = 1;
-    if (horz <= 0) horz = 1;
+    // Same as Chi2Result::Chi2Test of the good bin histograms, see CalculateCompareStats.
 
-    if (vert != 1)
-    {
-        // titles, labels, and x-ticks are vertically-sized
+    if (base.GetSize() != comp.GetSize())
+        ThrowError( "CalculateCompareChi2: histogram size mismatch." );
 
-        xAxis->SetTitleSize(  xAxis->GetTitleSize()  * vert );
-        xAxis->SetLabelSize(  xAxis->GetLabelSize()  * vert );
-        xAxis->SetTickLength( xAxis->GetTickLength() * vert );
+    const HistBinView v1( base );
+    const HistBinView v2( comp );
 
-        yAxis->SetTitleSize(  yAxis->GetTitleSize()  * vert );
-        yAxis->SetLabelSize(  yAxis->GetLabelSize()  * vert );
+    const bool bProfile = (v1.pProfile != nullptr);
+    if (bProfile != (v2.pProfile != nullptr))
+        ThrowError( "CalculateCompareChi2: both histograms must be TH1D or TProfile" );
 
-        // drawn title offset scales with both title size and offset
-        // correct y-axis title-offset so title does not move even though it is larger
-        yAxis->SetTitleOffset( yAxis->GetTitleOffset() / vert );
-    }
+    const StatBins h1( v1, baseScale );
+    const StatBins h2( v2, compScale );
 
-    if (horz != 1)
-    {
-        // y-ticks are horizontally-sized
+    if (bProfile)
+        return StatPointChi2Test( h1, h2, IsGoodStatBinPair );
 
-        yAxis->SetTickLength( yAxis->GetTickLength() * horz );
-    }
+    return StatChi2Test( h1, h2, kChi2TestWW, IsGoodStatBinPair );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void HistScaleTextTicks( const TH1DVector & hists, Float_t vert, Float_t horz = 1 )
+Chi2Result CalculateCombinedChi2( const TH1DVector & base, const TH1DVector & comp,
+                                  const ObsCovariance & baseCov, const ObsCovariance & compCov,
+                                  double baseScale /*= 1.0*/, double compScale /*= 1.0*/ )
 {
-    for (TH1D * pHist : hists)
-    {
-        if (pHist)
-            HistScaleTextTicks( *pHist, vert, horz );
-    }
-}
+    // The covariance is a sum of weight^2, so it is scaled as the bin error^2.
+    // Bins are used only if good in both models (see IsGoodStatBinPair).
 
-////////////////////////////////////////////////////////////////////////////////
-void WriteCompareFigure( const char * name, const char * title, const ConstTH1DVector & data, const ConstTH1DVector & compare, const ColorVector & dataColors,
-                         const ConstTH1DVector & rawData )
-{
-    auto SetupCompareHists = []( const TH1DVector & hists ) -> void
-    {
-        for (TH1D * pHist : hists)
-        {
-            if (pHist)
-            {
-                //pHist->SetLineWidth(2);
-                pHist->GetXaxis()->CenterTitle();
-                pHist->GetYaxis()->CenterTitle();
-            }
-        }
-    };
+    if ((baseCov.obs != compCov.obs) || (baseCov.nBins != compCov.nBins))
+        ThrowError( "CalculateCombinedChi2: covariance mismatch." );
 
-    /////
+    const size_t nBins = (size_t)baseCov.nBins;
 
-    const Double_t LowerPadFraction = 1.0/2.0;
-    const Double_t UpperPadFraction = 1.0 - LowerPadFraction;
+    // select the good combined bins
 
-    TCanvas canvas( name, title );
+    std::vector<size_t>   used;     // used[i] = combined bin
+    std::vector<Double_t> diff;     // diff[i]
 
-    // divide the canvas into two pads
+    for (size_t i = 0; i < baseCov.obs.size(); ++i)
     {
-        canvas.SetMargin(0, 0, 0, 0);   // clear margins before division, so that entire canvas is "owned" by subpads
-        canvas.Divide(1,2,0,0);         // divide canvas into an upper and lower pad, with no space between pads
+        const size_t obsIndex = baseCov.obs[i];
+
+        const HistBinView v1( *base[obsIndex] );
+        const HistBinView v2( *comp[obsIndex] );
 
-        TVirtualPad * pPad = nullptr;
+        const Int_t nObsBins = v1.nSize - 2;
 
-        // setup upper pad
+        for (Int_t bin = 1; bin <= nObsBins; ++bin)
         {
-            pPad = canvas.GetPad(1);
+            if (!IsGoodStatBinPair( v1.EffectiveEntries( bin, baseScale ), v2.EffectiveEntries( bin, compScale ) ))
+                continue;
 
-            pPad->SetPad( 0, LowerPadFraction, 1, 1 );  // xlow, ylow, xup, yup
+            used.push_back( (size_t)(baseCov.obsOffset[i] + bin - 1) );
+            diff.push_back( v2.Content( bin, compScale ) - v1.Content( bin, baseScale ) );
+        }
+    }
 
-            pPad->UseCurrentStyle();    // restore margins to default after division
-            pPad->SetBottomMargin(0);   // remove bottom margin
+    const size_t nUsed = used.size();
 
-            pPad->SetTopMargin( Float_t(pPad->GetTopMargin() / UpperPadFraction) );         // increase top margin
-        }
+    std::vector<Double_t> cov( nUsed * nUsed );
+    for (size_t i = 0; i < nUsed; ++i)
+    {
+        const Double_t * pBaseRow = &baseCov.cov[ used[i] * nBins ];
+        const Double_t * pCompRow = &compCov.cov[ used[i] * nBins ];
 
-        // setup lower pad
-        {
-            pPad = canvas.GetPad(2);
+        for (size_t j = 0; j < nUsed; ++j)
+            cov[i * nUsed + j] = pBaseRow[ used[j] ] * baseScale + pCompRow[ used[j] ] * compScale;
+    }
 
-            pPad->SetPad( 0, 0, 1, LowerPadFraction );  // xlow, ylow, xup, yup
+    return StatCovarianceChi2( diff, cov );
+}
 
-            pPad->UseCurrentStyle();    // restore margins to default after division
-            pPad->SetTopMargin(0);      // remove top margin
+////////////////////////////////////////////////////////////////////////////////
+CompareStats CalculateCompareStats( const TH1D & base, const TH1D & comp, double baseScale /*= 1.0*/, double compScale /*= 1.0*/ )
+{
+    // Calculate the good bin statistics shown in WriteCompareFigure directly from the bin sums,
+    // as if both histograms had first been scaled with ScaleHistEntries (see "Luminosity scaling").
+    // A bin is used only if it is good (see IsGoodStatBin) in both histograms, which is the
+    // combined effect of HistSplitGoodBadBins followed by ZeroHistEmptyBins.
+    // No histograms are cloned, so this can be evaluated cheaply for many scales.
 
-            pPad->SetBottomMargin( Float_t(pPad->GetBottomMargin() / LowerPadFraction) );   // increase bottom margin
-        }
+    if (base.GetSize() != comp.GetSize())
+        ThrowError( "CalculateCompareStats: histogram size mismatch." );
 
-        //Double_t xlow, ylow, xup, yup;
-        //pPad->GetPadPar(xlow, ylow, xup, yup);
-        //LogMsgInfo( "Before: x:%f->%f y:%f->%f L:%f R:%f B:%f T:%f", FMT_F(xlow), FMT_F(xup), FMT_F(ylow), FMT_F(yup),
-        //            FMT_F(pPad->GetLeftMargin()), FMT_F(pPad->GetRightMargin()), FMT_F(pPad->GetBottomMargin()), FMT_F(pPad->GetTopMargin()) );
-    }
+    const HistBinView v1( base );
+    const HistBinView v2( comp );
 
-    // draw upper pad
-    {
-        LogMsgInfo( "\n--- %hs : pad 1 ---", FMT_HS(name) );
+    if ((v1.pProfile != nullptr) != (v2.pProfile != nullptr))
+        ThrowError( "CalculateCompareStats: both histograms must be TH1D or TProfile" );
 
-        canvas.cd(1);
+    CompareStats stats;
 
-        // draw the histograms
-        TH1DVector drawHists = DrawMultipleHist( title, data, dataColors );  // drawHists are owned by the current pad
+    // Kolmogorov test (same as KolmogorovTest_NonEmptyBins)
+    stats.ksProb = StatKolmogorovTest( StatBins( v1, baseScale ), StatBins( v2, compScale ), IsGoodStatBinPair );
 
-        SetupCompareHists( drawHists );
+    // chi2 test (same as Chi2Result::Chi2Test)
+    stats.chi2 = CalculateCompareChi2( base, comp, baseScale, compScale );
 
-        HistScaleTextTicks( drawHists, 1/UpperPadFraction );
+    // ratio comp/base (same as TH1::Divide)
+    const StatBins ratio( v2, compScale, v1, baseScale );
 
-        // determine good/bad histograms
-        std::list<GoodBadHists> goodBadData = HistSplitGoodBadBins( ToConstTH1DVector(drawHists), rawData );
+    // fit ratio to 1 (same as FitToHorzLineAtOne)
+    stats.fitOne = StatChi2ToValue( ratio, 1.0, IsGoodStatBinPair );
 
-        // draw bad hists
-        for (const auto & gb : goodBadData)
-        {
-            gb.bad->SetMarkerStyle( kOpenCircle );
+    // fit ratio to a constant (same as FitToHorzLineAtConstant)
+    stats.fitConst = StatFitToConstant( ratio, stats.fitValue, stats.fitError, IsGoodStatBinPair );
 
-            if (gb.bad->GetEffectiveEntries() != 0)
-                gb.bad->DrawCopy( "SAME" );     // draw copy so object persists after goodBadData goes out of scope
-        }
+    return stats;
+}
 
-        // add a customized legend, different than TPad::BuildLegend
-        {
-            TLegend * pLegend = new TLegend( 0.5, 0.60, 0.88, 0.88 );
-            pLegend->SetMargin( 0.1 );  // reduce width for entry symbol from 25% to 10%
+////////////////////////////////////////////////////////////////////////////////
+void MakeCompareFigureMasks( CompareFigureStats & stats, const ConstTH1DVector & data, const ConstTH1DVector & compare,
+                             const ConstTH1DVector & rawData )
+{
+    stats.goodBadData   .clear();
+    stats.goodBadCompare.clear();
 
-            auto gbitr = goodBadData.cbegin();
+    // upper pad: data, classify good/bad bins
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        const TH1D * pRef = (i < rawData.size()) ? rawData[i] : data[i];
+        stats.goodBadData.push_back( MakeGoodBadMask( *data[i], { pRef } ) );
+    }
 
-            const TH1D * pBaseAll  = drawHists[0];
-            const TH1D * pBaseGood = gbitr->good.get();
+    // lower pad: comparisons, good only if good in both the base and the compared data
+    for (size_t i = 0; i < compare.size(); ++i)
+        stats.goodBadCompare.push_back( MakeGoodBadMask( *compare[i], { rawData[0], rawData[i + 1] } ) );
+}
 
-            for (size_t i = 0; i < drawHists.size(); ++i, ++gbitr)
-            {
-                const TH1D * pDrawHist = drawHists[i];
+////////////////////////////////////////////////////////////////////////////////
+CompareFigureStatsTasks::CompareFigureStatsTasks( const ConstTH1DVector & data, const ConstTH1DVector & compare,
+                                                  const ConstTH1DVector & rawData, const ToyConfig & toys )
+  : data(data), compare(compare), rawData(rawData), toys(toys)
+{
+    const size_t nDataPairs = data.empty() ? 0 : data.size() - 1;
+    const size_t nPairs     = std::max( nDataPairs, compare.size() );
 
-                pLegend->AddEntry( pDrawHist, pDrawHist->GetTitle() );
+    stats.goodBadData   .resize( data.size() );
+    stats.goodBadCompare.resize( compare.size() );
 
-                if (i != 0)
-                {
-                    const TH1D * pCompAll  = pDrawHist;
-                    const TH1D * pCompGood = gbitr->good.get();
+    stats.dataLabels.resize( data.size() );
+    stats.dataToys  .resize( data.size(), 0 );
 
-                    // add Kolmogorov probability
-                    {
-                        Double_t probAll  = KolmogorovTest_NonEmptyBins( *pBaseAll,  *pCompAll  );
-                        Double_t probGood = KolmogorovTest_NonEmptyBins( *pBaseGood, *pCompGood );
+    stats.pairStats    .resize( compare.size() );
+    stats.pairToys     .resize( compare.size() );
+    stats.compareLabels.resize( compare.size() );
 
-                        //std::string label = StringFormat( "Kolmogorov = %.3g[%.3g]", FMT_F(probGood), FMT_F(probAll) );
-                        std::string label = StringFormat( "Kolmogorov = %.3g", FMT_F(probGood) );
-                        LogMsgInfo( label );
-                        pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
-                    }
+    maskLog   .resize( MaskCount() );
+    pairLog   .resize( nPairs );
+    pairKs    .resize( nPairs, 0 );
+    pairChi2  .resize( nPairs );
+    pairToyRun.resize( nPairs );
+}
 
-                    // add Chi2Test probability
-                    {
-                        Chi2Result chi2All;
-                        chi2All.Chi2Test( *pBaseAll, *pCompAll );       // supports both TH1D and TProfile
+////////////////////////////////////////////////////////////////////////////////
+void CompareFigureStatsTasks::CalculateMask( size_t mask )
+{
+    // same as MakeCompareFigureMasks
 
-                        Chi2Result chi2Good;
-                        chi2Good.Chi2Test( *pBaseGood, *pCompGood );    // supports both TH1D and TProfile
+    if (mask < data.size())
+    {
+        // upper pad: data, classify good/bad bins
+        const TH1D * pRef = (mask < rawData.size()) ? rawData[mask] : data[mask];
+        stats.goodBadData[mask] = MakeGoodBadMask( *data[mask], { pRef }, &maskLog[mask] );
+    }
+    else
+    {
+        // lower pad: comparisons, good only if good in both the base and the compared data
+        const size_t i = mask - data.size();
+        stats.goodBadCompare[i] = MakeGoodBadMask( *compare[i], { rawData[0], rawData[i + 1] }, &maskLog[mask] );
+    }
+}
 
-                        //std::string label = GetChi2ResultString( chi2Good, chi2All );
-                        std::string label = GetChi2ResultString( chi2Good );
-                        LogMsgInfo( label );
-                        pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
-                    }
-                }
-            }
+////////////////////////////////////////////////////////////////////////////////
+void CompareFigureStatsTasks::CalculatePair( size_t pair )
+{
+    const size_t i = pair + 1;
 
-            pLegend->SetBit( kCanDelete );  // inform pad that it can delete this object
-            pLegend->Draw();                // add legend to current pad's list of primatives
-        }
+    if (i < data.size())
+    {
+        const TH1D *    pBaseAll  = data[0];
+        const UChar_t * pBaseGood = stats.goodBadData[0].good.data();
+
+        const TH1D *    pCompAll  = data[i];
+        const UChar_t * pCompGood = stats.goodBadData[i].good.data();
+
+        pairKs[pair] = KolmogorovTest_NonEmptyBins( *pBaseAll, *pCompAll, pBaseGood, pCompGood );
+
+        pairChi2[pair].Chi2Test( *pBaseAll, *pCompAll, pBaseGood, pCompGood, &pairLog[pair] );    // supports both TH1D and TProfile
+
+        // empirical p-values of the same tests, if enabled (see HistToyPValues)
+        const HistBinView v1( *pBaseAll );
+        const HistBinView v2( *pCompAll );
+
+        pairToyRun[pair].reset( new ToyPValueRun( StatBins(v1).Select(pBaseGood), StatBins(v2).Select(pCompGood), toys,
+                                                  pairKs[pair], pairChi2[pair].prob,
+                                                  ToyStream( pBaseAll->GetName(), pCompAll->GetName() ) ) );
     }
 
-    // draw lower pad
+    if (pair < compare.size())
     {
-        LogMsgInfo( "\n--- %hs : pad 2 ---", FMT_HS(name) );
+        // lower pad: fits of the comparisons
 
-        canvas.cd(2);
+        const TH1D *    pCompAll  = compare[pair];
+        const UChar_t * pCompGood = stats.goodBadCompare[pair].good.data();
 
-        // draw the histograms
-        TH1DVector drawHists = DrawMultipleHist( "", compare );
+        CompareStats & stat = stats.pairStats[pair];
 
-        SetupCompareHists( drawHists );
+        // fit to a horizontal line at y=1.0 (same label as GetLabel_FitToHorzLineAtOne)
+        stat.fitOne = FitToHorzLineAtOne( *pCompAll, pCompGood );
+        stats.compareLabels[pair].push_back( "Fit to 1: " + GetChi2ResultString( stat.fitOne ) );
 
-        HistScaleTextTicks( drawHists, 1/LowerPadFraction );
+        // fit to a horizontal line at a y=c (same label as GetLabel_FitToHorzLineAtConstant)
+        stat.fitConst = FitToHorzLineAtConstant( *pCompAll, stat.fitValue, stat.fitError, pCompGood );
+        stats.compareLabels[pair].push_back( StringFormat( "Fit to c = %.2g#pm%.2g: ", FMT_F(stat.fitValue), FMT_F(stat.fitError) )
+                                             + GetChi2ResultString( stat.fitConst ) );
+    }
+}
 
-        // determine good/bad histograms
-        std::list<GoodBadHists> goodBadCompare;
-        {
-            size_t i = 1;
-            for (const TH1D * pHist : drawHists)
-            {
-                GoodBadHists goodBad1 = HistSplitGoodBadBins( pHist,               rawData[0]   );
-                GoodBadHists goodBad2 = HistSplitGoodBadBins( goodBad1.good.get(), rawData[i++] );
+////////////////////////////////////////////////////////////////////////////////
+size_t CompareFigureStatsTasks::ToyBlockCount( size_t pair ) const
+{
+    return pairToyRun[pair] ? pairToyRun[pair]->BlockCount() : 0;
+}
 
-                goodBad2.bad->Add( goodBad1.bad.get() );  // add the two bad hists together
+////////////////////////////////////////////////////////////////////////////////
+void CompareFigureStatsTasks::CalculateToyBlock( size_t pair, size_t block )
+{
+    pairToyRun[pair]->RunBlock( block );
+}
 
-                goodBadCompare.push_back( std::move(goodBad2) );
-            }
+////////////////////////////////////////////////////////////////////////////////
+CompareFigureStats CompareFigureStatsTasks::Finish()
+{
+    for (size_t i = 1; i < data.size(); ++i)
+    {
+        const size_t       pair     = i - 1;
+        const Double_t     probGood = pairKs[pair];
+        const Chi2Result & chi2Good = pairChi2[pair];
+        const ToyPValues   toyProb  = pairToyRun[pair]->Result();
+
+        // Kolmogorov probability
+        {
+            //std::string label = StringFormat( "Kolmogorov = %.3g[%.3g]", FMT_F(probGood), FMT_F(probAll) );
+            std::string label = StringFormat( "Kolmogorov = %.3g", FMT_F(probGood) );
+            if (toyProb.nToys)
+                label += StringFormat( "  toys = %.3g", FMT_F(toyProb.ksProb) );
+            stats.dataLabels[i].push_back( label );
         }
 
-        // draw bad hists
-        for (const auto & gb : goodBadCompare)
+        // Chi2Test probability
         {
-            gb.bad->SetMarkerStyle( kOpenCircle );
+            //std::string label = GetChi2ResultString( chi2Good, chi2All );
+            std::string label = GetChi2ResultString( chi2Good );
+            if (toyProb.nToys)
+                label += StringFormat( "  toys = %.3g", FMT_F(toyProb.chi2Prob) );
+            stats.dataLabels[i].push_back( label );
+        }
 
-            if (gb.bad->GetEffectiveEntries() != 0)
-                gb.bad->DrawCopy( "SAME" );     // draw copy so object persists after goodBadData goes out of scope
+        stats.dataToys[i] = toyProb.nToys;
+
+        if (pair < compare.size())
+        {
+            stats.pairStats[pair].ksProb = probGood;
+            stats.pairStats[pair].chi2   = chi2Good;
+            stats.pairToys [pair]        = toyProb;
         }
+    }
 
-        // add ticks to top and right
-        canvas.GetPad(2)->SetTickx();
-        canvas.GetPad(2)->SetTicky();
+    for (const std::vector<std::string> & log : maskLog)
+        stats.logLines.insert( stats.logLines.end(), log.cbegin(), log.cend() );
 
-        // TODO: possibly resize vertical min/max to exclude error bars
+    for (const std::vector<std::string> & log : pairLog)
+        stats.logLines.insert( stats.logLines.end(), log.cbegin(), log.cend() );
 
-        // draw black horizontal line at 1
-        {
-            TLine * pLine = new TLine( compare[0]->GetXaxis()->GetXmin(), 1.0, compare[0]->GetXaxis()->GetXmax(), 1.0 );
-            pLine->SetLineColor(kBlack);
-            pLine->SetLineWidth(1);
+    return std::move(stats);
+}
 
-            pLine->SetBit(kCanDelete);  // inform pad that it can delete this object
-            pLine->Draw( "" );          // add line to current pad's list of primatives
-        }
+////////////////////////////////////////////////////////////////////////////////
+CompareFigureStats CalculateCompareFigureStats( const ConstTH1DVector & data, const ConstTH1DVector & compare,
+                                                const ConstTH1DVector & rawData,
+                                                const ToyConfig & toys /*= ToyConfig()*/ )
+{
+    CompareFigureStatsTasks tasks( data, compare, rawData, toys );
 
-        // add a customized legend, different than TPad::BuildLegend
-        {
-            TLegend * pLegend = new TLegend( 0.12, 0.74, 0.65, 0.88 );
-            pLegend->SetMargin( 0.01 ); // remove object column
+    ParallelFor( tasks.MaskCount(), [&]( size_t mask )
+    {
+        tasks.CalculateMask( mask );
+    });
 
-            //TLegend legendStyle( 0.12, 0.67, 0.5, 0.88 );
+    ParallelFor( tasks.PairCount(), [&]( size_t pair )
+    {
+        tasks.CalculatePair( pair );
+    });
 
-            //TPaveText * pTextBox = new TPaveText;
-            //*static_cast<TAttText *>( pTextBox ) = legendStyle;
-            //*static_cast<TPave *>(    pTextBox ) = legendStyle;
-            //pTextBox->SetMargin( 0.01 );
+    std::vector< std::pair<size_t, size_t> > blocks;    // (pair, block)
+    for (size_t pair = 0; pair < tasks.PairCount(); ++pair)
+    {
+        for (size_t block = 0; block < tasks.ToyBlockCount( pair ); ++block)
+            blocks.push_back( { pair, block } );
+    }
 
-            auto gbitr = goodBadCompare.cbegin();
+    ParallelFor( blocks.size(), [&]( size_t index )
+    {
+        tasks.CalculateToyBlock( blocks[index].first, blocks[index].second );
+    });
 
-            for (size_t i = 0; i < compare.size(); ++i, ++gbitr)
-            {
-                const TH1D * pDrawHist = drawHists[i];
+    return tasks.Finish();
+}
 
-                const TH1D * pCompAll  = pDrawHist;
-                const TH1D * pCompGood = gbitr->good.get();
+////////////////////////////////////////////////////////////////////////////////
+void LogCompareFigureStats( const CompareFigureStats & stats )
+{
+    for (const std::string & line : stats.logLines)
+        LogMsgInfo( "%hs", FMT_HS(line.c_str()) );
+}
 
-                // add a fit to a horizontal line at y=1.0
-                {
-                    //std::string label = GetLabel_FitToHorzLineAtOne( *pCompGood, *pCompAll );
-                    std::string label = GetLabel_FitToHorzLineAtOne( *pCompGood );
-                    LogMsgInfo( label );
-                    pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
-                    //pTextBox->AddText( label.c_str() );
-                }
+////////////////////////////////////////////////////////////////////////////////
+TObjString * MakeCompareFigureDescriptor( const char * title,
+                                         const ConstTH1DVector & data, const std::vector<double> & dataScales,
+                                         const ConstTH1DVector & compare, const ColorVector & dataColors,
+                                         const CompareFigureStats & stats, bool bEntryScaling /*= false*/ )
+{
+    // One line per entry, with tab separated fields:
+    //   title      <figure title>
+    //   scaling    entries                     (data scales applied as ScaleHistEntries, TH1::Scale if absent)
+    //   data       <hist key> <scale> <color>
+    //   label      <data index> <legend label>
+    //   toys       <data index> <number of toys>
+    //   compare    <hist key>
+    //   fit        <compare index> <legend label>
 
-                // add a fit to a horizontal line at a y=c
-                {
-                    //std::string label = GetLabel_FitToHorzLineAtConstant( *pCompGood, *pCompAll );
-                    std::string label = GetLabel_FitToHorzLineAtConstant( *pCompGood );
-                    LogMsgInfo( label );
-                    pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
-                    //pTextBox->AddText( label.c_str() );
-                }
-            }
+    std::string text = StringFormat( "title\t%hs\n", FMT_HS(title) );
 
-            pLegend->SetBit( kCanDelete );  // inform pad that it can delete this object
-            pLegend->Draw();                // add legend to current pad's list of primatives
-            //pTextBox->SetBit( kCanDelete );  // inform pad that it can delete this object
-            //pTextBox->Draw();                // add legend to current pad's list of primatives
-        }
+    if (bEntryScaling)
+        text += "scaling\tentries\n";
+
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        double  scale = (i < dataScales.size()) ? dataScales[i] : 1.0;
+        Color_t color = (i < dataColors.size()) ? dataColors[i] : Color_t(-1);
+
+        text += StringFormat( "data\t%hs\t%.17g\t%i\n", FMT_HS(data[i]->GetName()), FMT_F(scale), FMT_I(color) );
+
+        for (const std::string & label : stats.dataLabels[i])
+            text += StringFormat( "label\t%u\t%hs\n", FMT_U(i), FMT_HS(label.c_str()) );
+
+        if (stats.dataToys[i])
+            text += StringFormat( "toys\t%u\t%u\n", FMT_U(i), FMT_U(stats.dataToys[i]) );
+    }
+
+    for (size_t i = 0; i < compare.size(); ++i)
+    {
+        text += StringFormat( "compare\t%hs\n", FMT_HS(compare[i]->GetName()) );
+
+        for (const std::string & label : stats.compareLabels[i])
+            text += StringFormat( "fit\t%u\t%hs\n", FMT_U(i), FMT_HS(label.c_str()) );
     }
 
-    // write canvas
-    canvas.Write();
+    return new TObjString( text.c_str() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void WriteCompareFigureDescriptor( const char * name, const char * title,
+                                   const ConstTH1DVector & data, const std::vector<double> & dataScales,
+                                   const ConstTH1DVector & compare, const ColorVector & dataColors,
+                                   const CompareFigureStats & stats, bool bEntryScaling /*= false*/ )
+{
+    std::unique_ptr<TObjString> pDescriptor( MakeCompareFigureDescriptor( title, data, dataScales, compare, dataColors, stats, bEntryScaling ) );
+
+    pDescriptor->Write( (std::string(name) + FigureDescriptorSuffix).c_str() );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -665,124 +905,1102 @@ bool LoadCacheHist( const char * cacheFileName, TH1D * & pHist )
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void LoadHistData( const ModelFileVector & models, const ObservableVector & observables, std::vector<TH1DVector> & hists, const char * cacheFileName /*= nullptr*/ )
+ObsCovariance::ObsCovariance( const ObservableVector & observables, const std::vector<size_t> & covObs )
 {
-    hists.clear();
-
-    for (const ModelFile & model : models)
+    for (size_t obsIndex : covObs)
     {
-        bool bLoadEvents = false;
+        if (obsIndex >= observables.size())
+            ThrowError( "ObsCovariance: invalid observable index." );
 
-        TH1DVector data;
-        TH1DVector load;
+        obs      .push_back( obsIndex );
+        obsOffset.push_back( nBins );
 
-        for (const Observable & obs : observables)
-        {
-            TH1D * pHist = obs.MakeHist( model.modelName, model.modelTitle );
+        nBins += observables[obsIndex].nBins;
+    }
 
-            if (LoadCacheHist( cacheFileName, pHist ))
-            {
-                LogMsgInfo( "Loaded %hs from cache", FMT_HS(pHist->GetName()) );
-                load.push_back( nullptr );  // skip this histogram
-            }
-            else
-            {
-                load.push_back( pHist );
-                bLoadEvents = true;
-            }
+    cov.assign( (size_t)nBins * nBins, 0.0 );
+}
 
-            data.push_back( pHist );
-        }
+////////////////////////////////////////////////////////////////////////////////
 
-        auto FillFunc = [&](const HepMC::GenVertex & signal)
-        {
-            size_t obsIndex = 0;
-            for (const Observable & obs : observables)
-            {
-                TH1D * pHist = load[obsIndex++];
-                if (pHist)
-                    obs.FillHist( *pHist, 1.0, signal );
-            }
-        };
+// Values of an auto-range observable for one model, pre-binned before the range is known, and their
+// quantile sketch.
+//
+// The first nFine values are kept as they are. Then a window of nFine fine bins is set from the sketch,
+// to cover the quantile range [AutoRangeQuantile, 1 - AutoRangeQuantile] of the model with a margin of
+// its span on each side. Fine bin k holds the values in [k, k + 1) * width, where width is the smallest
+// power of 2 that fits the window, so less than 6 / nFine of the quantile span. The values in the window
+// are counted in the fine bins, the values outside are kept. Whenever the kept values double, the window
+// is set again from the sketch, widening it if needed by doubling the width and merging the fine bins.
+// When the range is known, the kept values are filled as they are, and each fine bin is filled into the
+// histogram bin of its centre: a value within width / 2 of a histogram bin edge may be filled into the
+// neighbouring bin, i.e. within 3 / nFine of the quantile span of the model (1 % of a bin of a histogram
+// of 100 bins over that span).
+// Non-finite values go to the underflow (-inf) or overflow (+inf, NaN), as in TH1::Fill.
+// With 2 values (TProfile), the sums of the second value and its square are also kept.
+//
+// The memory is the fine bins (3 arrays with 2 values) and the kept values, which are few as the window
+// has a margin around the quantile range. It is independent of the number of events, but held for each
+// model and auto-range observable until all the models are loaded.
 
-        if (bLoadEvents)
-        {
-            LoadEvents( model.fileName, FillFunc, model.maxLoadEvents );
+class AutoRangeBins
+{
+public:
+    explicit AutoRangeBins( size_t nValues ) : nValues(nValues) { }
+
+    void Add( const double * pValue );
+
+    const QuantileSketch & Sketch() const { return sketch; }  // of the finite values
+
+    void Fill( TH1D & hist ) const;    // into the empty hist, the entries are set to the number of values
+
+private:
+    static const Long64_t nFine = 1 << 15;
+
+    void SetWindow();   // from the sketch, then move the kept values in the window to the fine bins
+    void AddFine( Long64_t k, Double_t y );
+
+    size_t                  nValues     = 1;
+    QuantileSketch          sketch;
+    Double_t                width       = 0;        // 0 before the window is set
+    Long64_t                first       = 0;        // fine bin of the first element of the arrays, the window
+    std::vector<Double_t>   count;                  // [k - first]
+    std::vector<Double_t>   sumY;                   // [k - first], 2 values only
+    std::vector<Double_t>   sumY2;                  // [k - first], 2 values only
+    std::vector<Double_t>   keptX;                  // values outside the window
+    std::vector<Double_t>   keptY;                  // second value of keptX, 2 values only
+    size_t                  keptLimit   = nFine;    // set the window when the kept values reach this
+    Double_t                lowSum[3]   = { };      // count, sumY, sumY2 of -inf
+    Double_t                highSum[3]  = { };      // count, sumY, sumY2 of +inf or NaN
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void AutoRangeBins::Add( const double * pValue )
+{
+    const Double_t x = pValue[0];
+    const Double_t y = (nValues > 1) ? pValue[1] : 0;
+
+    if (!std::isfinite( x ))
+    {
+        Double_t * pSum = (x < 0) ? lowSum : highSum;
+        pSum[0] += 1;
+        pSum[1] += y;
+        pSum[2] += y * y;
+        return;
+    }
+
+    sketch.Add( x );
+
+    if (width != 0)
+    {
+        const Double_t bin = std::floor( x / width );
+        if ((bin >= (Double_t)first) && (bin < (Double_t)(first + nFine)))
+        {
+            AddFine( (Long64_t)bin, y );
+            return;
+        }
+    }
+
+    keptX.push_back( x );
+    if (nValues > 1)
+        keptY.push_back( y );
+
+    if (keptX.size() >= keptLimit)
+        SetWindow();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void AutoRangeBins::AddFine( Long64_t k, Double_t y )
+{
+    count[k - first] += 1;
+    if (nValues > 1)
+    {
+        sumY [k - first] += y;
+        sumY2[k - first] += y * y;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void AutoRangeBins::SetWindow()
+{
+    const Double_t qLo = sketch.Quantile( AutoRangeQuantile );
+    const Double_t qHi = sketch.Quantile( 1 - AutoRangeQuantile );
+
+    Double_t span = qHi - qLo;
+    if (span <= 0)
+        span = std::max( std::abs( qLo ), 1.0 );   // all values equal
+
+    Double_t xLo = qLo - span;
+    Double_t xHi = qHi + span;
+
+    if (width != 0)
+    {
+        // keep the fine bins
+        xLo = std::min( xLo, first * width );
+        xHi = std::max( xHi, (first + nFine) * width );
+    }
+
+    // smallest power of 2 with [xLo, xHi] in nFine - 2 fine bins, so in the window after rounding down xLo
+    int exponent = 0;
+    std::frexp( (xHi - xLo) / (nFine - 2), &exponent );
+
+    const Double_t newWidth = std::max( std::ldexp( 1.0, std::max( exponent, -1000 ) ), width );
+    const Long64_t newFirst = (Long64_t)std::floor( xLo / newWidth );
+
+    if (width == 0)
+    {
+        count.assign( nFine, 0.0 );
+        if (nValues > 1)
+        {
+            sumY .assign( nFine, 0.0 );
+            sumY2.assign( nFine, 0.0 );
+        }
+    }
+    else if ((newWidth != width) || (newFirst != first))
+    {
+        // the new width is width * 2^m, so each fine bin is within one new fine bin
+
+        std::vector<Double_t> newCount( nFine, 0.0 );
+        std::vector<Double_t> newSumY(  sumY .empty() ? 0 : nFine, 0.0 );
+        std::vector<Double_t> newSumY2( sumY2.empty() ? 0 : nFine, 0.0 );
+
+        for (Long64_t i = 0; i < nFine; ++i)
+        {
+            if (count[i] == 0)
+                continue;
+
+            const Long64_t to = (Long64_t)std::floor( (first + i + 0.5) * width / newWidth ) - newFirst;
+
+            newCount[to] += count[i];
+            if (!sumY.empty())
+            {
+                newSumY [to] += sumY [i];
+                newSumY2[to] += sumY2[i];
+            }
+        }
+
+        count.swap( newCount );
+        sumY .swap( newSumY );
+        sumY2.swap( newSumY2 );
+    }
+
+    width = newWidth;
+    first = newFirst;
+
+    // move the kept values in the window to the fine bins
+
+    size_t nKept = 0;
+    for (size_t i = 0; i < keptX.size(); ++i)
+    {
+        const Double_t x   = keptX[i];
+        const Double_t y   = keptY.empty() ? 0 : keptY[i];
+        const Double_t bin = std::floor( x / width );
+
+        if ((bin >= (Double_t)first) && (bin < (Double_t)(first + nFine)))
+        {
+            AddFine( (Long64_t)bin, y );
+        }
+        else
+        {
+            keptX[nKept] = x;
+            if (!keptY.empty())
+                keptY[nKept] = y;
+            ++nKept;
+        }
+    }
+
+    keptX.resize( nKept );
+    if (!keptY.empty())
+        keptY.resize( nKept );
+
+    keptLimit = std::max( (size_t)nFine, 2 * nKept );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void AutoRangeBins::Fill( TH1D & hist ) const
+{
+    HistBinArrays arrays( hist );
+
+    if (arrays.bProfile && (nValues != 2))
+        ThrowError( "LoadHistData: auto-range TProfile observable requires nDim = 2." );
+
+    // as Fill with weight 1 of each value
+    auto FillBin = [&]( Int_t bin, Double_t n, Double_t sy, Double_t sy2 )
+    {
+        if (arrays.bProfile)
+        {
+            arrays.pSumw[bin] += sy;
+            if (arrays.pSumw2)
+                arrays.pSumw2[bin] += sy2;
+            arrays.pBinEntries[bin] += n;
+            if (arrays.pBinSumw2)
+                arrays.pBinSumw2[bin] += n;
+        }
+        else
+        {
+            arrays.pSumw[bin] += n;
+            if (arrays.pSumw2)
+                arrays.pSumw2[bin] += n;
+        }
+    };
+
+    Double_t entries = lowSum[0] + highSum[0];
+
+    FillBin( 0,                 lowSum [0], lowSum [1], lowSum [2] );
+    FillBin( arrays.nSize - 1,  highSum[0], highSum[1], highSum[2] );
+
+    const TAxis * pAxis = hist.GetXaxis();
+
+    for (Long64_t i = 0; i < (Long64_t)count.size(); ++i)
+    {
+        if (count[i] == 0)
+            continue;
+
+        Int_t bin = pAxis->FindFixBin( (first + i + 0.5) * width );
+
+        FillBin( bin, count[i], sumY.empty() ? 0 : sumY[i], sumY2.empty() ? 0 : sumY2[i] );
+
+        entries += count[i];
+    }
+
+    for (size_t i = 0; i < keptX.size(); ++i)
+    {
+        const Double_t y = keptY.empty() ? 0 : keptY[i];
+
+        FillBin( pAxis->FindFixBin( keptX[i] ), 1, y, y * y );
+    }
+
+    entries += keptX.size();
+
+    hist.ResetStats();
+    hist.SetEntries( entries );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The range of an auto-range observable is saved in the cache file as a TObjString with the key name
+// of the observable + AutoRangeKeySuffix: the range, then the names of the models it was set from.
+static const char * const AutoRangeKeySuffix = "_auto_range";
+
+////////////////////////////////////////////////////////////////////////////////
+static std::string FormatAutoRange( Double_t xMin, Double_t xMax, const std::string & modelNames )
+{
+    std::ostringstream text;
+    text.precision( 17 );
+    text << xMin << "\t" << xMax << "\n" << modelNames;
+
+    return text.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool LoadAutoRange( const char * cacheFileName, const char * obsName, const std::string & modelNames,
+                           Double_t & xMin, Double_t & xMax )
+{
+    if (!cacheFileName || !cacheFileName[0] || gSystem->AccessPathName( cacheFileName ))
+        return false;
+
+    struct Cleanup
+    {
+        TDirectory * oldDir = gDirectory;
+
+        ~Cleanup()
+        {
+            if (oldDir)
+                oldDir->cd();
+        }
+
+    } cleanup;
+
+    TFile file( cacheFileName, "READ" );
+    if (file.IsZombie() || !file.IsOpen())
+        return false;
+
+    TObjString * pText = nullptr;
+    file.GetObject( (std::string(obsName) + AutoRangeKeySuffix).c_str(), pText );
+    if (!pText)
+        return false;
+
+    std::unique_ptr<TObjString> upText( pText );
+
+    std::istringstream text( pText->GetString().Data() );
+
+    Double_t    min = 0;
+    Double_t    max = 0;
+    std::string line;
+    if (!(text >> min >> max) || !std::getline( text, line ))
+        return false;
+
+    std::string names;
+    while (std::getline( text, line ))
+        names += line + "\n";
+
+    if ((names != modelNames) || (max <= min))
+        return false;       // set from other models
+
+    xMin = min;
+    xMax = max;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void SaveAutoRange( const char * cacheFileName, const char * obsName, const std::string & modelNames,
+                           Double_t xMin, Double_t xMax )
+{
+    struct Cleanup
+    {
+        TDirectory * oldDir = gDirectory;
+
+        ~Cleanup()
+        {
+            if (oldDir)
+                oldDir->cd();
+        }
+
+    } cleanup;
+
+    TFile file( cacheFileName, "UPDATE" );
+    if (file.IsZombie() || !file.IsOpen())
+    {
+        LogMsgError( "Failed to create file (%hs).", FMT_HS(cacheFileName) );
+        ThrowError( std::invalid_argument( cacheFileName ) );
+    }
+
+    TObjString text( FormatAutoRange( xMin, xMax, modelNames ).c_str() );
+    text.Write( (std::string(obsName) + AutoRangeKeySuffix).c_str(), TObject::kOverwrite );
+
+    file.Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LoadHistData( const ModelFileVector & models, const ObservableVector & loadObservables, std::vector<TH1DVector> & hists,
+                   const char * cacheFileName /*= nullptr*/,
+                   const std::vector<size_t> & covObs /*= {}*/, std::vector<ObsCovariance> * pCovariance /*= nullptr*/,
+                   const ObsSelection * pSelect /*= nullptr*/ )
+{
+    hists.clear();
+
+    const bool bCovariance = (pCovariance != nullptr) && !covObs.empty();
+    if (pCovariance)
+        pCovariance->clear();
+
+    if (pSelect && (pSelect->size() != models.size()))
+        ThrowError( "LoadHistData: selection count mismatch." );
+
+    // a model and observable pair is loaded if selected, or if needed for the covariance
+    auto IsSelected = [&]( size_t modelIndex, size_t obsIndex )
+    {
+        if (!pSelect || (*pSelect)[modelIndex][obsIndex])
+            return true;
+
+        return bCovariance && (std::find( covObs.cbegin(), covObs.cend(), obsIndex ) != covObs.cend());
+    };
+
+    if (pSelect)
+    {
+        size_t nSelected = 0;
+        for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+        {
+            for (size_t obsIndex = 0; obsIndex < loadObservables.size(); ++obsIndex)
+                nSelected += IsSelected( modelIndex, obsIndex ) ? 1 : 0;
+        }
+
+        LogMsgInfo( "Loading %u of %u model observables", FMT_U(nSelected), FMT_U(models.size() * loadObservables.size()) );
+    }
+
+    // Auto-range observables are made after all the models are loaded. Their values are pre-binned
+    // during the event pass (see AutoRangeBins), and the range is set from the merged quantile sketches
+    // of all models. The range is cached with the models it was set from (see AutoRangeKeySuffix);
+    // when the same models load the observable again, it has that range, and is loaded like any other.
+
+    ObservableVector observables( loadObservables );    // with the cached auto ranges set
+
+    auto AutoRangeModels = [&]( size_t obsIndex )   // names of the models loading the observable, one per line
+    {
+        std::string names;
+        for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+        {
+            if (IsSelected( modelIndex, obsIndex ))
+                names += std::string(models[modelIndex].modelName) + "\n";
+        }
+        return names;
+    };
+
+    std::vector<size_t> autoObs;    // autoObs[auto] = observable index
+    for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+    {
+        Observable & obs = observables[obsIndex];
+        if (!obs.IsAutoRange())
+            continue;
+
+        if (LoadAutoRange( cacheFileName, obs.name, AutoRangeModels( obsIndex ), obs.xMin, obs.xMax ))
+            LogMsgInfo( "Loaded auto range %hs from cache: %g to %g", FMT_HS(obs.name), FMT_F(obs.xMin), FMT_F(obs.xMax) );
+        else
+            autoObs.push_back( obsIndex );
+    }
+
+    for (size_t obsIndex : covObs)
+    {
+        if (bCovariance && observables[obsIndex].IsAutoRange())
+            ThrowError( "LoadHistData: covariance is not supported for auto-range observables." );
+    }
+
+    // observables with the same value source share one evaluation of getFunction per event
+    const std::vector<size_t> source = FindValueSources( observables );    // source[obs]
+
+    std::vector< std::vector<AutoRangeBins> >   autoBins;       // autoBins[model][auto], with the sketches
+    std::vector< std::vector<bool> >            autoSelect;     // autoSelect[model][auto]
+
+    for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+    {
+        const ModelFile & model = models[modelIndex];
+
+        autoSelect.push_back( std::vector<bool>( autoObs.size() ) );
+        for (size_t i = 0; i < autoObs.size(); ++i)
+            autoSelect.back()[i] = IsSelected( modelIndex, autoObs[i] );
+
+        const std::vector<bool> & modelAuto = autoSelect.back();
+
+        bool bLoadEvents = bCovariance || (std::find( modelAuto.cbegin(), modelAuto.cend(), true ) != modelAuto.cend());
+
+        TH1DVector data;
+        TH1DVector load;
+
+        autoBins.push_back( std::vector<AutoRangeBins>() );
+
+        for (size_t obsIndex : autoObs)
+            autoBins.back().emplace_back( GetValueCount( observables[obsIndex] ) );
+
+        std::vector<AutoRangeBins> & modelBins = autoBins.back();
+
+        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+        {
+            const Observable & obs = observables[obsIndex];
+
+            if (obs.IsAutoRange() || !IsSelected( modelIndex, obsIndex ))
+            {
+                load.push_back( nullptr );
+                data.push_back( nullptr );  // auto-range is made once the range is known
+                continue;
+            }
+
+            TH1D * pHist = obs.MakeHist( model.modelName, model.modelTitle );
+
+            if (LoadCacheHist( cacheFileName, pHist ))
+            {
+                LogMsgInfo( "Loaded %hs from cache", FMT_HS(pHist->GetName()) );
+                load.push_back( nullptr );  // skip this histogram
+            }
+            else
+            {
+                load.push_back( pHist );
+                bLoadEvents = true;
+            }
+
+            data.push_back( pHist );
+        }
+
+        ObsCovariance covariance;
+        if (bCovariance)
+        {
+            covariance = ObsCovariance( observables, covObs );
+
+            for (size_t obsIndex : covObs)
+            {
+                if (data[obsIndex]->InheritsFrom(TProfile::Class()))
+                    ThrowError( "LoadHistData: covariance is not supported for TProfile observables." );
+            }
+        }
+
+        std::vector<Int_t> covBins( covObs.size() );    // combined bin of each covariance observable, -1 if none
+
+        // determine the value sources to evaluate, and the number of values of each:
+        // 2 only if a loaded observable of the source needs 2 (see GetValueCount), otherwise 1
+        std::vector<size_t> evalCount( observables.size(), 0 );    // evalCount[source], 0 = not evaluated
+
+        auto NeedValues = [&]( size_t obsIndex )
+        {
+            const size_t srcIndex = source[obsIndex];
+            const size_t count    = GetValueCount( observables[obsIndex], data[obsIndex] );
+
+            if (count > GetValueCount( observables[srcIndex], data[srcIndex] ))
+            {
+                ThrowError( std::string("LoadHistData: value source ") + observables[srcIndex].name +
+                            " provides 1 value, but observable " + observables[obsIndex].name + " needs 2." );
+            }
+
+            evalCount[srcIndex] = std::max( evalCount[srcIndex], count );
+        };
+
+        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+        {
+            if (load[obsIndex])
+                NeedValues( obsIndex );
+        }
+
+        for (size_t i = 0; i < autoObs.size(); ++i)
+        {
+            if (modelAuto[i])
+                NeedValues( autoObs[i] );
+        }
+
+        if (bCovariance)
+        {
+            for (size_t obsIndex : covObs)
+                NeedValues( obsIndex );
+        }
+
+        std::vector<size_t> evalSources;
+        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+        {
+            if (evalCount[obsIndex] != 0)
+                evalSources.push_back( obsIndex );
+        }
+
+        std::vector<double> values( 2 * observables.size(), 0.0 );    // values[2 * source + i]
+
+        auto FillFunc = [&](const HepMC::GenVertex & signal)
+        {
+            for (size_t obsIndex : evalSources)
+                observables[obsIndex].getFunction( signal, &values[2 * obsIndex], evalCount[obsIndex] );
+
+            for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+            {
+                TH1D * pHist = load[obsIndex];
+                if (pHist)
+                    observables[obsIndex].FillHist( *pHist, 1.0, &values[2 * source[obsIndex]] );
+            }
+
+            for (size_t i = 0; i < autoObs.size(); ++i)
+            {
+                if (!modelAuto[i])
+                    continue;
+
+                modelBins[i].Add( &values[2 * source[autoObs[i]]] );
+            }
+
+            if (bCovariance)
+            {
+                const double weight = 1.0;
+
+                for (size_t i = 0; i < covObs.size(); ++i)
+                {
+                    const size_t obsIndex = covObs[i];
+
+                    double value = values[2 * source[obsIndex]];
+
+                    const TAxis * pAxis = data[obsIndex]->GetXaxis();
+                    Int_t bin = pAxis->FindFixBin( value );
+
+                    covBins[i] = ((bin >= 1) && (bin <= pAxis->GetNbins())) ? covariance.obsOffset[i] + bin - 1 : -1;
+                }
+
+                for (Int_t a : covBins)
+                {
+                    if (a < 0)
+                        continue;
+
+                    Double_t * pRow = &covariance.cov[ (size_t)a * covariance.nBins ];
+
+                    for (Int_t b : covBins)
+                    {
+                        if (b >= 0)
+                            pRow[b] += weight * weight;
+                    }
+                }
+            }
+        };
+
+        if (bLoadEvents)
+        {
+            LoadEvents( model.fileName, FillFunc, model.maxLoadEvents );
 
             if (cacheFileName && cacheFileName[0])
                 SaveHists( cacheFileName, ToConstTH1DVector(data) );
         }
         
         hists.push_back( data );
+
+        if (bCovariance)
+            pCovariance->push_back( std::move(covariance) );
+    }
+
+    // set the range of the auto-range observables and fill their histograms
+
+    for (size_t i = 0; i < autoObs.size(); ++i)
+    {
+        const size_t obsIndex = autoObs[i];
+
+        bool bSelected = false;
+        for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+            bSelected = bSelected || autoSelect[modelIndex][i];
+
+        if (!bSelected)
+            continue;
+
+        QuantileSketch sketch;
+        for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+            sketch.Merge( autoBins[modelIndex][i].Sketch() );
+
+        Observable obs = observables[obsIndex];
+
+        if (sketch.Count() != 0)
+        {
+            obs.xMin = sketch.Quantile( AutoRangeQuantile );
+            obs.xMax = sketch.Quantile( 1 - AutoRangeQuantile );
+        }
+
+        if (obs.xMax <= obs.xMin)
+            obs.xMax = obs.xMin + 1;    // all values equal
+
+        LogMsgInfo( "Auto range %hs: %g to %g", FMT_HS(obs.name), FMT_F(obs.xMin), FMT_F(obs.xMax) );
+
+        ConstTH1DVector autoHists;
+
+        for (size_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+        {
+            if (!autoSelect[modelIndex][i])
+                continue;
+
+            const ModelFile & model = models[modelIndex];
+
+            TH1D * pHist = obs.MakeHist( model.modelName, model.modelTitle );
+
+            autoBins[modelIndex][i].Fill( *pHist );
+            autoBins[modelIndex][i] = AutoRangeBins( 1 );     // release the bins
+
+            hists[modelIndex][obsIndex] = pHist;
+            autoHists.push_back( pHist );
+        }
+
+        if (cacheFileName && cacheFileName[0])
+        {
+            SaveHists( cacheFileName, autoHists );
+            SaveAutoRange( cacheFileName, obs.name, AutoRangeModels( obsIndex ), obs.xMin, obs.xMax );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LoadEventData( const ModelFileVector & models, const ObservableVector & observables,
+                    std::vector< std::vector<EventSample> > & samples,
+                    const char * cacheFileName /*= nullptr*/ )
+{
+    samples.clear();
+
+    const size_t nObs = observables.size();
+
+    // tuple variables are the observable names
+    std::string varList;
+    for (const Observable & obs : observables)
+        varList += (varList.empty() ? "" : ":") + std::string(obs.name);
+
+    // observables with the same value source share one evaluation of getFunction per event
+    const std::vector<size_t> source = FindValueSources( observables );    // source[obs]
+
+    std::vector<size_t> evalCount( nObs, 0 );  // evalCount[source], 0 = not evaluated
+    for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+    {
+        size_t count = GetValueCount( observables[obsIndex] );
+        evalCount[ source[obsIndex] ] = std::max( evalCount[ source[obsIndex] ], count );
+    }
+
+    for (const ModelFile & model : models)
+    {
+        std::vector<EventSample> modelSamples( nObs );  // modelSamples[observable]
+
+        std::string tupleName = std::string(model.modelName) + "_events";
+
+        TNtupleD * pTuple = new TNtupleD( tupleName.c_str(), model.modelTitle, varList.c_str() );
+        pTuple->SetDirectory( nullptr );
+
+        if (LoadCacheTuple( cacheFileName, pTuple ))
+        {
+            LogMsgInfo( "Loaded %hs from cache", FMT_HS(pTuple->GetName()) );
+
+            Long64_t nEntries = pTuple->GetEntries();
+            for (EventSample & sample : modelSamples)
+                sample.reserve( (size_t)nEntries );
+
+            for (Long64_t entry = 0; entry < nEntries; ++entry)
+            {
+                pTuple->GetEntry( entry );
+                const Double_t * pArgs = pTuple->GetArgs();
+
+                for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+                    modelSamples[obsIndex].push_back( pArgs[obsIndex] );
+            }
+        }
+        else
+        {
+            const bool bCache = (cacheFileName && cacheFileName[0]);
+
+            std::vector<double> values( 2 * nObs );   // values[2 * source + i]
+            std::vector<double> row( nObs );
+
+            auto FillFunc = [&](const HepMC::GenVertex & signal)
+            {
+                for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+                {
+                    if (evalCount[obsIndex] != 0)
+                        observables[obsIndex].getFunction( signal, &values[2 * obsIndex], evalCount[obsIndex] );
+                }
+
+                for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+                {
+                    double value = values[2 * source[obsIndex]];
+
+                    row[obsIndex] = value;
+                    modelSamples[obsIndex].push_back( value );
+                }
+
+                if (bCache)
+                    pTuple->Fill( row.data() );
+            };
+
+            LoadEvents( model.fileName, FillFunc, model.maxLoadEvents );
+
+            if (bCache)
+                SaveTuples( cacheFileName, { pTuple } );
+        }
+
+        delete pTuple;
+
+        samples.push_back( std::move(modelSamples) );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CalculateCompareHists( const Observable & obs, size_t obsIndex, const HistBank & figRatio, TH1DVector & comp,
+                            const ModelFileVector & models, const ColorVector & dataColors )
+{
+    comp.clear();
+
+    // make comparison histograms from the ratios to the first model
+
+    std::string nameSuffix  = "_vs_" + std::string(models[0].modelName)  + "_"   + std::string(obs.name);
+    std::string titleSuffix = " vs " + std::string(models[0].modelTitle) + " - " + obs.title;
+
+    for ( size_t i = 1; i < figRatio.nModels; ++i)
+    {
+        std::string name  = std::string(models[i].modelName)  + nameSuffix;
+        std::string title = std::string(models[i].modelTitle) + titleSuffix;
+
+        TH1D * pHist = figRatio.MakeHist( obsIndex, i, name.c_str(), title.c_str() );
+
+        comp.push_back(pHist);
+
+        Color_t color = dataColors[i];
+        pHist->SetLineColor(   color );
+        pHist->SetMarkerColor( color );
+
+        pHist->GetYaxis()->SetTitle( "Ratio" );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelFileVector SelectLoadModels( const ModelFileVector & models, const FigureSetupVector & figures )
+{
+    ModelFileVector loadModels;
+
+    std::set<std::string> loadNames;
+    for ( const FigureSetup & figSetup : figures )
+        loadNames.insert( figSetup.modelNames.cbegin(), figSetup.modelNames.cend() );
+
+    for ( const std::string & name : loadNames )
+    {
+        auto MatchModelName = [&name](const ModelFile & elem) -> bool { return strcmp(elem.modelName, name.c_str()) == 0; };
+
+        auto itr = std::find_if( models.cbegin(), models.cend(), MatchModelName );
+        if (itr == models.cend())
+            ThrowError( std::invalid_argument("Model " + name + " not found.") );
+
+        loadModels.push_back( *itr );
+    }
+
+    return loadModels;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<size_t> FindFigureModels( const FigureSetup & figSetup, const ModelFileVector & loadModels )
+{
+    std::vector<size_t> result;
+
+    for ( const char * modelName : figSetup.modelNames )
+    {
+        size_t modelIndex = 0;
+        for ( ; modelIndex < loadModels.size(); ++modelIndex )
+        {
+            if (strcmp( modelName, loadModels[modelIndex].modelName ) == 0)
+                break;
+        }
+        if (modelIndex == loadModels.size())
+            ThrowError( std::logic_error("Internal Error: Required model not loaded.") );
+
+        result.push_back( modelIndex );
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<size_t> FindFigureObservables( const FigureSetup & figSetup, const ObservableVector & observables )
+{
+    std::vector<size_t> result;
+
+    if (figSetup.observableNames.empty())
+    {
+        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+            result.push_back( obsIndex );
+
+        return result;
+    }
+
+    for ( const char * obsName : figSetup.observableNames )
+    {
+        size_t obsIndex = 0;
+        for ( ; obsIndex < observables.size(); ++obsIndex )
+        {
+            if (strcmp( obsName, observables[obsIndex].name ) == 0)
+                break;
+        }
+        if (obsIndex == observables.size())
+            ThrowError( "FindFigureObservables: Unknown observable " + std::string(obsName) );
+
+        result.push_back( obsIndex );
     }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ObsSelection SelectLoadObservables( const ModelFileVector & loadModels, const ObservableVector & observables,
+                                    const FigureSetupVector & figures )
+{
+    ObsSelection select( loadModels.size(), std::vector<bool>( observables.size(), false ) );
+
+    for ( const FigureSetup & figSetup : figures )
+    {
+        std::vector<size_t> figObs = FindFigureObservables( figSetup, observables );
+
+        for ( size_t modelIndex : FindFigureModels( figSetup, loadModels ) )
+        {
+            for ( size_t obsIndex : figObs )
+                select[modelIndex][obsIndex] = true;
+        }
+    }
+
+    return select;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double GetLuminosityScale( double luminosity, const ModelFile & model, const TH1DVector & data )
+{
+    // the histograms not loaded are null (see ObsSelection)
+    auto itrFirst = std::find_if( data.cbegin(), data.cend(), []( const TH1D * pHist ) { return pHist != nullptr; } );
+    if (itrFirst == data.cend())
+        ThrowError( "GetLuminosityScale: No histograms loaded for " + std::string(model.modelName) );
+
+    double crossSection = model.crossSection * 1000; // fb
+    double nEntries     = (*itrFirst)->GetEntries();
+    size_t nEvents      = (size_t)nEntries;
+
+    if (((double)nEvents != nEntries) || !nEvents)
+        ThrowError( "Non-integral number of entries: " + std::to_string(nEntries) );
+
+    for ( const TH1D * pHist : data )
+    {
+        if (pHist && (pHist->GetEntries() != nEntries))
+            ThrowError( "Inconsistent number of entries: " + std::to_string(pHist->GetEntries()) + " expected: " + std::to_string(nEntries) );
+    }
+
+    return luminosity * crossSection / nEvents;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<double> GetUnitLuminosityScales( const ModelFileVector & loadModels, const std::vector<TH1DVector> & modelData )
+{
+    // luminosity scale is linear in luminosity, so determine the scale for 1 fb^-1
+
+    std::vector<double> unitScale;
+
+    for (size_t modelIndex = 0; modelIndex < loadModels.size(); ++modelIndex)
+        unitScale.push_back( GetLuminosityScale( 1.0, loadModels[modelIndex], modelData[modelIndex] ) );
+
+    return unitScale;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string GetComparePairName( const ModelFile & base, const ModelFile & comp, const Observable & obs )
+{
+    // same naming as the comparison histograms of CalculateCompareHists
+    return std::string(comp.modelName) + "_vs_" + std::string(base.modelName) + "_" + obs.name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string GetComparePairTitle( const ModelFile & base, const ModelFile & comp, const Observable & obs )
+{
+    return std::string(comp.modelTitle) + " vs " + std::string(base.modelTitle) + " - " + obs.title;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void FillHistCache( const ModelFileVector & models, const ObservableVector & observables,
+                    const FigureSetupVector & figures, const char * cacheFileName )
+{
+    // Fill the histograms of ModelCompare into the cache file, without drawing or writing any figure.
+
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    if (!cacheFileName || !cacheFileName[0])
+        ThrowError( "FillHistCache: no cache file." );
+
+    // determine which model files are to be loaded
+    ModelFileVector loadModels = SelectLoadModels( models, figures );   // loadModels[model]
+
+    std::vector<TH1DVector> modelData;  // modelData[model][observable]
+
+    // load the model data for each model and observable used by a figure, filling the cache
+    ObsSelection loadSelect = SelectLoadObservables( loadModels, observables, figures );
+
+    LoadHistData( loadModels, observables, modelData, cacheFileName, {}, nullptr, &loadSelect );
+
+    std::vector< TH1DUniquePtr > ownHists;  // histograms are not written, so delete them on exit
+    for ( const TH1DVector & data : modelData )
+        for ( TH1D * pHist : data )
+            ownHists.push_back( TH1DUniquePtr(pHist) );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void CalculateCompareHists( const Observable & obs, const ConstTH1DVector & data, TH1DVector & comp, const ModelFileVector & models, const ColorVector & dataColors )
+
+////////////////////////////////////////////////////////////////////////////////
+std::string GetCompareStatsString( const CompareStats & stats )
 {
-    comp.clear();
+    return StringFormat( "Kolmogorov = %.4g  chi2 = %.4g/%i p = %.4g  fit1 p = %.4g  fitc = %.4g#pm%.4g p = %.4g",
+                         FMT_F(stats.ksProb),
+                         FMT_F(stats.chi2.chi2), FMT_I(stats.chi2.ndf), FMT_F(stats.chi2.prob),
+                         FMT_F(stats.fitOne.prob),
+                         FMT_F(stats.fitValue), FMT_F(stats.fitError), FMT_F(stats.fitConst.prob) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool IsSameCompareStats( const CompareStats & stats1, const CompareStats & stats2, double relTolerance )
+{
+    auto IsSame = [relTolerance]( Double_t x, Double_t y ) -> bool
+    {
+        return std::abs( x - y ) <= relTolerance * std::max( std::abs(x), std::abs(y) );
+    };
 
-    // calculate comparison histograms
+    auto IsSameChi2 = [&]( const Chi2Result & x, const Chi2Result & y ) -> bool
+    {
+        return (x.ndf == y.ndf) && IsSame( x.chi2, y.chi2 ) && IsSame( x.prob, y.prob );
+    };
 
-    std::unique_ptr<const TH1D> upBase( ConvertTProfileToTH1D( data.front(), false ) );
+    return IsSame( stats1.ksProb, stats2.ksProb )           &&
+           IsSameChi2( stats1.chi2,     stats2.chi2 )       &&
+           IsSameChi2( stats1.fitOne,   stats2.fitOne )     &&
+           IsSameChi2( stats1.fitConst, stats2.fitConst )   &&
+           IsSame( stats1.fitValue, stats2.fitValue );
+}
 
-    std::string nameSuffix  = "_vs_" + std::string(models[0].modelName)  + "_"   + std::string(obs.name);
-    std::string titleSuffix = " vs " + std::string(models[0].modelTitle) + " - " + obs.title;
+////////////////////////////////////////////////////////////////////////////////
+CompareStatsGraphs::CompareStatsGraphs( const std::string & name, const std::string & title, size_t nPoints, const char * xAxisTitle )
+{
+    struct GraphSetup
+    {
+        std::unique_ptr<TGraph> & upGraph;
+        const char *              suffix;
+        const char *              label;
+    };
 
-    for ( size_t i = 1; i < data.size(); ++i)
+    GraphSetup graphs[] =
     {
-        TH1D * pHist = ConvertTProfileToTH1D( data[i], false );
+        { ks,       "ks",   "Kolmogorov"    },
+        { chi2,     "chi2", "#chi^{2} test" },
+        { fitOne,   "fit1", "Fit to 1"      },
+        { fitConst, "fitc", "Fit to c"      },
+    };
 
-        pHist->Divide( upBase.get() );
+    for (GraphSetup & graph : graphs)
+    {
+        std::string graphName  = name  + "_" + graph.suffix;
+        std::string graphTitle = title + " - " + graph.label;
+
+        graph.upGraph.reset( new TGraph( (Int_t)nPoints ) );
+        graph.upGraph->SetName(  graphName .c_str() );
+        graph.upGraph->SetTitle( graphTitle.c_str() );
+        graph.upGraph->GetXaxis()->SetTitle( xAxisTitle );
+        graph.upGraph->GetYaxis()->SetTitle( "p-value" );
+    }
+}
 
-        comp.push_back(pHist);
+////////////////////////////////////////////////////////////////////////////////
+CompareStatsGraphs::CompareStatsGraphs( CompareStatsGraphs && ) = default;
 
-        /* add if comparing to oneself - to correct the error for being increased by sqrt(2)
-        if (i == 0)
-        {
-            Int_t nbins = pHist->GetNbinsX();
-            for (Int_t bin = 0; bin <= nbins + 1; ++bin)
-            {
-                Double_t error = pHist->GetBinError(bin);
-                error /= std::sqrt(2);
-                pHist->SetBinError( bin, error );
-                pHist->SetBinContent( bin, 1.0 );
-            }
-        }
-        */
+CompareStatsGraphs::~CompareStatsGraphs() = default;    // TGraph is incomplete in the header
 
-        std::string name  = std::string(models[i].modelName)  + nameSuffix;
-        std::string title = std::string(models[i].modelTitle) + titleSuffix;
+////////////////////////////////////////////////////////////////////////////////
+void CompareStatsGraphs::SetPoint( size_t index, double x, const CompareStats & stats )
+{
+    ks      ->SetPoint( (Int_t)index, x, stats.ksProb        );
+    chi2    ->SetPoint( (Int_t)index, x, stats.chi2.prob     );
+    fitOne  ->SetPoint( (Int_t)index, x, stats.fitOne.prob   );
+    fitConst->SetPoint( (Int_t)index, x, stats.fitConst.prob );
+}
 
-        pHist->SetName(  name .c_str() );
-        pHist->SetTitle( title.c_str() );
+////////////////////////////////////////////////////////////////////////////////
+void CompareStatsGraphs::Write( TFile * pFile ) const
+{
+    for (const TGraph * pGraph : { ks.get(), chi2.get(), fitOne.get(), fitConst.get() })
+        pFile->WriteTObject( pGraph );
+}
 
-        Color_t color = dataColors[i];
-        pHist->SetLineColor(   color );
-        pHist->SetMarkerColor( color );
+////////////////////////////////////////////////////////////////////////////////
+LuminosityVector MakeLuminosityRange( double lumiMin, double lumiMax, size_t nPoints, bool bLogSpacing /*= true*/ )
+{
+    if ((lumiMin <= 0) || (lumiMax < lumiMin) || (nPoints == 0))
+        ThrowError( "MakeLuminosityRange: invalid range." );
 
-        pHist->GetYaxis()->SetTitle( "Ratio" );
+    LuminosityVector result;
+
+    if (nPoints == 1)
+    {
+        result.push_back( lumiMin );
+        return result;
+    }
+
+    for (size_t i = 0; i < nPoints; ++i)
+    {
+        double frac = double(i) / (nPoints - 1);
+
+        double lumi = bLogSpacing ? lumiMin * std::pow( lumiMax / lumiMin, frac )
+                                  : lumiMin + (lumiMax - lumiMin) * frac;
+
+        result.push_back( lumi );
     }
+
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void ModelCompare( const char * outputFileName,
-                   const ModelFileVector & models, const ObservableVector & observables,
-                   const FigureSetupVector & figures,
-                   const char * cacheFileName /*= nullptr*/ )
+void LuminositySweep( const char * outputFileName,
+                      const ModelFileVector & models, const ObservableVector & observables,
+                      const FigureSetupVector & figures, const LuminosityVector & luminosities,
+                      const char * cacheFileName /*= nullptr*/ )
 {
+    // For each figure, observable, and base vs. compare model pair, calculate the
+    // statistics of WriteCompareFigure at each luminosity, and write the p-values as
+    // graphs of p-value vs. luminosity. The luminosity of each FigureSetup is ignored.
+    // The loaded histograms are never modified or cloned; see CalculateCompareStats.
+
     // disable automatic histogram addition to current directory
     TH1::AddDirectory(kFALSE);
     // enable automatic sumw2 for every histogram
     TH1::SetDefaultSumw2(kTRUE);
 
-    // modify the global style
-    gStyle->SetPaperSize( TStyle::kA4 );
-    gStyle->SetTitleOffset( 1.3, "xyz" ); // increase title offsets a little more
-    gStyle->SetPadTopMargin(   0.03 );
-    gStyle->SetPadRightMargin( 0.03 );
-    gStyle->SetPadLeftMargin(  0.09 );
-    gStyle->SetOptTitle( kFALSE );
+    if (luminosities.empty())
+        ThrowError( "LuminositySweep: no luminosities." );
 
     LogMsgInfo( "Output file: %hs", FMT_HS(outputFileName) );
     std::unique_ptr<TFile> upOutputFile( new TFile( outputFileName, "RECREATE" ) );
@@ -792,126 +2010,547 @@ void ModelCompare( const char * outputFileName,
         ThrowError( std::invalid_argument( outputFileName ) );
     }
 
-    std::vector< TH1DUniquePtr > tempHists;
-
     // determine which model files are to be loaded
+    ModelFileVector loadModels = SelectLoadModels( models, figures );   // loadModels[model]
+
+    std::vector<TH1DVector> modelData;  // modelData[model][observable]
 
-    ModelFileVector loadModels;     // loadModels[model]
+    // load the model data for each model and observable used by a figure
+    ObsSelection loadSelect = SelectLoadObservables( loadModels, observables, figures );
+
+    LoadHistData( loadModels, observables, modelData, cacheFileName, {}, nullptr, &loadSelect );
+
+    std::vector< TH1DUniquePtr > ownHists;  // histograms are not written, so delete them on exit
+    for ( const TH1DVector & data : modelData )
+        for ( TH1D * pHist : data )
+            ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    std::vector<double> unitScale = GetUnitLuminosityScales( loadModels, modelData );  // unitScale[model]
+
+    const size_t nLumi = luminosities.size();
+
+    for ( const FigureSetup & figSetup : figures )
     {
-        std::set<std::string> loadNames;
-        for ( const FigureSetup & figSetup : figures )
-            loadNames.insert( figSetup.modelNames.cbegin(), figSetup.modelNames.cend() );
+        std::vector<size_t> figIndex = FindFigureModels( figSetup, loadModels );
+        std::vector<size_t> figObs   = FindFigureObservables( figSetup, observables );
+
+        const size_t     baseIndex = figIndex[0];
+        const ModelFile & baseModel = loadModels[baseIndex];
 
-        for ( const std::string & name : loadNames )
+        for (size_t figModel = 1; figModel < figIndex.size(); ++figModel)
         {
-            auto MatchModelName = [&name](const ModelFile & elem) -> bool { return strcmp(elem.modelName, name.c_str()) == 0; };
-            
-            auto itr = std::find_if( models.cbegin(), models.cend(), MatchModelName );
-            if (itr == models.cend())
-                ThrowError( std::invalid_argument("Model " + name + " not found.") );
+            const size_t      compIndex = figIndex[figModel];
+            const ModelFile & compModel = loadModels[compIndex];
 
-            loadModels.push_back( *itr );
+            for (size_t obsIndex : figObs)
+            {
+                const Observable & obs = observables[obsIndex];
+
+                const TH1D & base = *modelData[baseIndex][obsIndex];
+                const TH1D & comp = *modelData[compIndex][obsIndex];
+
+                std::string name  = "sweep_" + GetComparePairName( baseModel, compModel, obs );
+                std::string title = GetComparePairTitle( baseModel, compModel, obs );
+
+                LogMsgInfo( "\n--- %hs ---", FMT_HS(name.c_str()) );
+
+                CompareStatsGraphs graphs( name, title, nLumi, "Luminosity [fb^{-1}]" );
+
+                for (size_t lumiIndex = 0; lumiIndex < nLumi; ++lumiIndex)
+                {
+                    double luminosity = luminosities[lumiIndex];
+
+                    CompareStats stats = CalculateCompareStats( base, comp, luminosity * unitScale[baseIndex], luminosity * unitScale[compIndex] );
+
+                    graphs.SetPoint( lumiIndex, luminosity, stats );
+
+                    LogMsgInfo( "L = %g fb^-1: %hs", FMT_F(luminosity), FMT_HS(GetCompareStatsString(stats).c_str()) );
+                }
+
+                graphs.Write( upOutputFile.get() );
+            }
         }
     }
 
+    upOutputFile->Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double FindMinimumLuminosity( const TH1D & base, const TH1D & comp, double baseUnitScale, double compUnitScale,
+                              double pValue /*= 0.05*/, double lumiMin /*= 1E-3*/, double lumiMax /*= 1E6*/,
+                              double relTolerance /*= 1E-3*/ )
+{
+    // Find the smallest luminosity at which the chi2 test of the good bins (see CalculateCompareChi2)
+    // has a p-value below pValue. Returns 0 if the models cannot be distinguished below lumiMax.
+    //
+    // The luminosity is first bracketed by doubling, then bisected in log(luminosity).
+    // The p-value generally decreases with luminosity, but more bins become good as
+    // the luminosity increases, so it is not strictly monotonic. Doubling from lumiMin
+    // ensures the lowest crossing on the doubling grid is found.
+
+    if ((lumiMin <= 0) || (lumiMax < lumiMin) || (relTolerance <= 0))
+        ThrowError( "FindMinimumLuminosity: invalid range." );
+
+    auto IsDistinguishable = [&]( double luminosity ) -> bool
+    {
+        Chi2Result res = CalculateCompareChi2( base, comp, luminosity * baseUnitScale, luminosity * compUnitScale );
+        return (res.ndf > 0) && (res.prob < pValue);
+    };
+
+    // bracket the crossing
+
+    double lumiHi = lumiMin;
+    if (IsDistinguishable( lumiHi ))
+        return lumiHi;
+
+    double lumiLo = lumiHi;
+    while (true)
+    {
+        if (lumiHi >= lumiMax)
+            return 0;
+
+        lumiLo = lumiHi;
+        lumiHi = std::min( lumiHi * 2, lumiMax );
+
+        if (IsDistinguishable( lumiHi ))
+            break;
+    }
+
+    // bisect the crossing
+
+    while (lumiHi > lumiLo * (1 + relTolerance))
+    {
+        double lumiMid = std::sqrt( lumiLo * lumiHi );
+
+        if (IsDistinguishable( lumiMid ))
+            lumiHi = lumiMid;
+        else
+            lumiLo = lumiMid;
+    }
+
+    return lumiHi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<MinLuminosityResult> MinimumLuminositySearch( const ModelFileVector & models, const ObservableVector & observables,
+                                                          const FigureSetupVector & figures, double pValue /*= 0.05*/,
+                                                          const char * cacheFileName /*= nullptr*/ )
+{
+    // For each figure, observable, and base vs. compare model pair, find the minimum luminosity
+    // at which the compare model is distinguishable from the base model (see FindMinimumLuminosity).
+    // The luminosity of each FigureSetup is ignored.
+
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    // determine which model files are to be loaded
+    ModelFileVector loadModels = SelectLoadModels( models, figures );   // loadModels[model]
+
     std::vector<TH1DVector> modelData;  // modelData[model][observable]
 
-    // load the model data for each model and observable
-    LoadHistData( loadModels, observables, modelData, cacheFileName );
+    // load the model data for each model and observable used by a figure
+    ObsSelection loadSelect = SelectLoadObservables( loadModels, observables, figures );
 
-    // write observables histograms
+    LoadHistData( loadModels, observables, modelData, cacheFileName, {}, nullptr, &loadSelect );
+
+    std::vector< TH1DUniquePtr > ownHists;  // histograms are not written, so delete them on exit
     for ( const TH1DVector & data : modelData )
+        for ( TH1D * pHist : data )
+            ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    std::vector<double> unitScale = GetUnitLuminosityScales( loadModels, modelData );  // unitScale[model]
+
+    std::vector<MinLuminosityResult> results;
+
+    for ( const FigureSetup & figSetup : figures )
+    {
+        std::vector<size_t> figIndex = FindFigureModels( figSetup, loadModels );
+        std::vector<size_t> figObs   = FindFigureObservables( figSetup, observables );
+
+        const size_t      baseIndex = figIndex[0];
+        const ModelFile & baseModel = loadModels[baseIndex];
+
+        for (size_t figModel = 1; figModel < figIndex.size(); ++figModel)
+        {
+            const size_t      compIndex = figIndex[figModel];
+            const ModelFile & compModel = loadModels[compIndex];
+
+            for (size_t obsIndex : figObs)
+            {
+                const TH1D & base = *modelData[baseIndex][obsIndex];
+                const TH1D & comp = *modelData[compIndex][obsIndex];
+
+                MinLuminosityResult result;
+                result.name       = GetComparePairName( baseModel, compModel, observables[obsIndex] );
+                result.luminosity = FindMinimumLuminosity( base, comp, unitScale[baseIndex], unitScale[compIndex], pValue );
+
+                if (result.luminosity > 0)
+                    result.chi2 = CalculateCompareChi2( base, comp, result.luminosity * unitScale[baseIndex], result.luminosity * unitScale[compIndex] );
+
+                results.push_back( result );
+            }
+        }
+    }
+
+    // log the results
+
+    LogMsgInfo( "\n--- Minimum luminosity for p-value < %g ---", FMT_F(pValue) );
+
+    for ( const MinLuminosityResult & result : results )
     {
-        LogMsgHistUnderOverflow( ToConstTH1DVector(data) );
-        WriteHists( upOutputFile.get(), data );  // output file takes ownership of histograms
+        if (result.luminosity > 0)
+            LogMsgInfo( "%hs: %.4g fb^-1  (%hs)", FMT_HS(result.name.c_str()), FMT_F(result.luminosity), FMT_HS(GetChi2ResultString(result.chi2).c_str()) );
+        else
+            LogMsgInfo( "%hs: not distinguishable", FMT_HS(result.name.c_str()) );
     }
 
-    // for each figure
+    return results;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<CombinedChi2Result> CombinedCompare( const ModelFileVector & models, const ObservableVector & observables,
+                                                 const FigureSetupVector & figures, const std::vector<size_t> & covObs,
+                                                 const char * cacheFileName /*= nullptr*/ )
+{
+    // For each figure, and base vs. compare model pair, calculate the chi2 of all the observables
+    // covObs combined, including their correlation (see CalculateCombinedChi2).
+    // The models are scaled to the luminosity of the FigureSetup, if set.
+
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    if (covObs.empty())
+        ThrowError( "CombinedCompare: no observables." );
+
+    // determine which model files are to be loaded
+    ModelFileVector loadModels = SelectLoadModels( models, figures );   // loadModels[model]
+
+    std::vector<TH1DVector>    modelData;   // modelData[model][observable]
+    std::vector<ObsCovariance> modelCov;    // modelCov[model]
+
+    // load the model data and covariance for each model in a single pass of the events,
+    // only the covariance observables are used (these are always loaded)
+    ObsSelection loadSelect( loadModels.size(), std::vector<bool>( observables.size(), false ) );
+
+    LoadHistData( loadModels, observables, modelData, cacheFileName, covObs, &modelCov, &loadSelect );
+
+    std::vector< TH1DUniquePtr > ownHists;  // histograms are not written, so delete them on exit
+    for ( const TH1DVector & data : modelData )
+        for ( TH1D * pHist : data )
+            ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    std::string obsNames;
+    for (size_t obsIndex : covObs)
+        obsNames += (obsNames.empty() ? "" : "_") + std::string(observables[obsIndex].name);
+
+    std::vector<CombinedChi2Result> results;
 
     for ( const FigureSetup & figSetup : figures )
     {
-        // select figure models and data
+        std::vector<size_t> figIndex = FindFigureModels( figSetup, loadModels );
 
-        ModelFileVector         figModels;  // figModels[model]
-        std::vector<TH1DVector> figData;    // figData[model][observable]
+        const size_t baseIndex = figIndex[0];
 
-        for ( const char * modelName : figSetup.modelNames )
+        for (size_t figModel = 1; figModel < figIndex.size(); ++figModel)
         {
-            size_t modelIndex = 0;
-            for ( ; modelIndex < loadModels.size(); ++modelIndex )
+            const size_t compIndex = figIndex[figModel];
+
+            double baseScale(1), compScale(1);
+            if (figSetup.luminosity > 0)
             {
-                if (strcmp( modelName, loadModels[modelIndex].modelName ) == 0)
-                    break;
+                baseScale = GetLuminosityScale( figSetup.luminosity, loadModels[baseIndex], modelData[baseIndex] );
+                compScale = GetLuminosityScale( figSetup.luminosity, loadModels[compIndex], modelData[compIndex] );
             }
-            if (modelIndex == loadModels.size())
-                ThrowError( std::logic_error("Internal Error: Required model not loaded.") );
 
-            figModels.push_back( loadModels[ modelIndex ] );
-            figData  .push_back( modelData[  modelIndex ] );
+            CombinedChi2Result result;
+            result.name = std::string(loadModels[compIndex].modelName) + "_vs_" + std::string(loadModels[baseIndex].modelName) + "_" + obsNames;
+            result.chi2 = CalculateCombinedChi2( modelData[baseIndex], modelData[compIndex], modelCov[baseIndex], modelCov[compIndex], baseScale, compScale );
+
+            LogMsgInfo( "%hs: %hs", FMT_HS(result.name.c_str()), FMT_HS(GetChi2ResultString(result.chi2).c_str()) );
+
+            results.push_back( result );
         }
+    }
 
-        // adjust for luminosity
-        if (figSetup.luminosity > 0)
-        {
-            double luminosity = figSetup.luminosity;  // fb^-1
+    return results;
+}
 
-            for (size_t modelIndex = 0; modelIndex < figModels.size(); ++modelIndex)
-            {
-                double crossSection = figModels[modelIndex].crossSection * 1000; // fb
-                double nEntries     = figData[modelIndex][0]->GetEntries();
-                size_t nEvents      = (size_t)nEntries;
+////////////////////////////////////////////////////////////////////////////////
+std::vector<UnbinnedCompareResult> UnbinnedCompare( const ModelFileVector & models, const ObservableVector & observables,
+                                                    const FigureSetupVector & figures, size_t nPermutations /*= 0*/,
+                                                    const char * cacheFileName /*= nullptr*/ )
+{
+    // For each figure, observable, and base vs. compare model pair, calculate the unbinned
+    // Kolmogorov-Smirnov, Anderson-Darling and energy distance tests of the per-event values.
+    // The results are independent of the binning and of the luminosity of each FigureSetup.
+    //
+    // Each model and observable sample is sorted once, in parallel, and reused by all
+    // pairs containing the model. The pairs are then tested in parallel.
+
+    // determine which model files are to be loaded
+    ModelFileVector loadModels = SelectLoadModels( models, figures );   // loadModels[model]
 
-                if (((double)nEvents != nEntries) || !nEvents)
-                    ThrowError( "Non-integral number of entries: " + std::to_string(nEntries) );
+    std::vector< std::vector<EventSample> > samples;    // samples[model][observable]
 
-                double scale = luminosity * crossSection / nEvents;
+    // load the per-event values for each model and observable
+    LoadEventData( loadModels, observables, samples, cacheFileName );
 
-                TH1DVector & obsData = figData[modelIndex];
-                for ( TH1D * & pHist : obsData )
-                {
-                    if (pHist->GetEntries() != nEntries)
-                        ThrowError( "Inconsistent number of entries: " + std::to_string(pHist->GetEntries()) + " expected: " + std::to_string(nEntries) );
+    // sort all samples
+    {
+        std::vector<EventSample *> sortSamples;
+        for (std::vector<EventSample> & modelSamples : samples)
+            for (EventSample & sample : modelSamples)
+                sortSamples.push_back( &sample );
+
+        SortEventSamples( sortSamples );
+    }
 
-                    TH1D * pClone = dynamic_cast<TH1D *>( pHist->Clone() );
+    // enumerate the comparisons
 
-                    pClone->Scale( scale );
-                    pClone->SetDirectory( nullptr );    // ensure not owned by any directory
+    struct Comparison
+    {
+        size_t  base;
+        size_t  comp;
+        size_t  obs;
+    };
 
-                    pHist = pClone;  // replace histogram in obsData
+    std::vector<Comparison>            comparisons;
+    std::vector<UnbinnedCompareResult> results;
 
-                    tempHists.push_back( TH1DUniquePtr(pClone) );
-                }
+    for ( const FigureSetup & figSetup : figures )
+    {
+        std::vector<size_t> figIndex = FindFigureModels( figSetup, loadModels );
+        std::vector<size_t> figObs   = FindFigureObservables( figSetup, observables );
+
+        for (size_t figModel = 1; figModel < figIndex.size(); ++figModel)
+        {
+            for (size_t obsIndex : figObs)
+            {
+                comparisons.push_back( { figIndex[0], figIndex[figModel], obsIndex } );
+
+                UnbinnedCompareResult result;
+                result.name = GetComparePairName( loadModels[figIndex[0]], loadModels[figIndex[figModel]], observables[obsIndex] );
+                results.push_back( result );
             }
         }
+    }
 
-        // for each observable
+    // calculate the tests in parallel
 
-        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+    ParallelFor( comparisons.size(), [&]( size_t index )
+    {
+        const Comparison & c = comparisons[index];
+
+        const EventSample & base = samples[c.base][c.obs];
+        const EventSample & comp = samples[c.comp][c.obs];
+
+        UnbinnedCompareResult & result = results[index];
+
+        result.ks     = UnbinnedKolmogorovTest(      base, comp );
+        result.ad     = UnbinnedAndersonDarlingTest( base, comp );
+        result.energy = UnbinnedEnergyTest(          base, comp, nPermutations );
+    });
+
+    // log the results
+
+    LogMsgInfo( "\n--- Unbinned tests ---" );
+
+    for ( const UnbinnedCompareResult & result : results )
+    {
+        LogMsgInfo( "%hs: Kolmogorov D = %.4g p = %.4g  Anderson-Darling T = %.4g p = %.4g  energy = %.4g p = %.4g",
+                    FMT_HS(result.name.c_str()),
+                    FMT_F(result.ks.statistic),     FMT_F(result.ks.prob),
+                    FMT_F(result.ad.statistic),     FMT_F(result.ad.prob),
+                    FMT_F(result.energy.statistic), FMT_F(result.energy.prob) );
+    }
+
+    return results;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CompareMatrix( const char * outputFileName,
+                    const ModelFileVector & models, const ObservableVector & observables,
+                    double luminosity /*= 0*/,
+                    const char * cacheFileName /*= nullptr*/ )
+{
+    // For each observable, calculate the statistics of WriteCompareFigure for all pairs of models,
+    // without drawing any figures. The pairs are calculated in parallel (see ParallelFor), directly
+    // from the loaded histograms (see CalculateCompareStats).
+    // The lower-indexed model of each pair is the base model.
+    //
+    // Writes a table (TNtupleD "matrix") with one row per observable and pair, and for each
+    // observable and statistic a model x model heat map of the p-values.
+    // If luminosity > 0 the models are scaled to luminosity, otherwise they are unscaled.
+    // With a memory budget (see SetModelMemoryBudget) only the models of one pair at a time need be in memory.
+
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    const size_t nModels = models.size();
+    const size_t nObs    = observables.size();
+
+    if (nModels < 2)
+        ThrowError( "CompareMatrix: at least two models are required." );
+
+    LogMsgInfo( "Output file: %hs", FMT_HS(outputFileName) );
+    std::unique_ptr<TFile> upOutputFile( new TFile( outputFileName, "RECREATE" ) );
+    if (upOutputFile->IsZombie() || !upOutputFile->IsOpen())    // IsZombie is true if constructor failed
+    {
+        LogMsgError( "Failed to create output file (%hs).", FMT_HS(outputFileName) );
+        ThrowError( std::invalid_argument( outputFileName ) );
+    }
+
+    // load the model data for each model and observable (see ModelStore, for the memory budget);
+    // the histograms are not written, and are deleted by the store
+    ObsSelection loadSelect( nModels, std::vector<bool>( nObs, true ) );
+    ModelStore   store( models, observables, loadSelect, cacheFileName, GetModelMemoryBudget() );
+
+    store.Load( []( const TH1DVector & ) { } );
+
+    std::vector<double> scale( nModels, 1.0 );  // scale[model]
+    if (luminosity > 0)
+    {
+        for (size_t model = 0; model < nModels; ++model)
+            scale[model] = luminosity * store.unitScale[model];
+    }
+
+    // enumerate the pairs
+
+    std::vector< std::pair<size_t,size_t> > pairs;  // pairs[pair] = (base, comp)
+    for (size_t base = 0; base < nModels; ++base)
+        for (size_t comp = base + 1; comp < nModels; ++comp)
+            pairs.push_back( { base, comp } );
+
+    const size_t nPairs = pairs.size();
+
+    LogMsgInfo( "Comparing %u pairs of models for %u observables", FMT_U(nPairs), FMT_U(nObs) );
+
+    // calculate the statistics in parallel
+
+    std::vector<CompareStats> stats( nObs * nPairs );   // stats[obs * nPairs + pair]
+
+    auto CalculatePair = [&]( size_t index )
+    {
+        const size_t obsIndex = index / nPairs;
+        const size_t base     = pairs[ index % nPairs ].first;
+        const size_t comp     = pairs[ index % nPairs ].second;
+
+        const std::vector<TH1DVector> & modelData = store.modelData;
+
+        stats[index] = CalculateCompareStats( *modelData[base][obsIndex], *modelData[comp][obsIndex], scale[base], scale[comp] );
+    };
+
+    if (!store.IsBounded())
+    {
+        ParallelFor( stats.size(), CalculatePair );
+    }
+    else
+    {
+        // one pair at a time in memory, in base model order, so the base model is kept while its pairs are calculated
+        for (size_t pair = 0; pair < nPairs; ++pair)
         {
-            const Observable & obs = observables[obsIndex];
+            store.Require( { pairs[pair].first, pairs[pair].second } );
+
+            ParallelFor( nObs, [&]( size_t obsIndex ) { CalculatePair( obsIndex * nPairs + pair ); } );
+        }
+    }
+
+    LogMsgInfo( "Model histograms: %u bytes peak in memory", FMT_U(store.PeakSize()) );
+
+    // write the table
+
+    {
+        std::unique_ptr<TNtupleD> upTable( new TNtupleD( "matrix", "Model comparison matrix",
+                                                         "obs:base:comp:ks:chi2:ndf:chi2prob:fit1prob:fitc:fitcerr:fitcprob" ) );
+        upTable->SetDirectory( nullptr );
+
+        for (size_t index = 0; index < stats.size(); ++index)
+        {
+            const size_t         obsIndex = index / nPairs;
+            const auto &         pair     = pairs[ index % nPairs ];
+            const CompareStats & st       = stats[index];
+
+            const Double_t row[] =
+            {
+                (Double_t)obsIndex, (Double_t)pair.first, (Double_t)pair.second,
+                st.ksProb,
+                st.chi2.chi2, (Double_t)st.chi2.ndf, st.chi2.prob,
+                st.fitOne.prob,
+                st.fitValue, st.fitError, st.fitConst.prob,
+            };
+
+            upTable->Fill( row );
+
+            LogMsgInfo( "%hs: %hs", FMT_HS(GetComparePairName( models[pair.first], models[pair.second], observables[obsIndex] ).c_str()),
+                        FMT_HS(GetCompareStatsString(st).c_str()) );
+        }
+
+        upOutputFile->WriteTObject( upTable.get() );
+    }
+
+    // write the heat maps
+
+    struct MatrixSetup
+    {
+        const char *                        suffix;
+        const char *                        label;
+        std::function<Double_t(const CompareStats &)> pValue;
+    };
+
+    const MatrixSetup matrices[] =
+    {
+        { "ks",   "Kolmogorov",    []( const CompareStats & st ) { return st.ksProb;        } },
+        { "chi2", "#chi^{2} test", []( const CompareStats & st ) { return st.chi2.prob;     } },
+        { "fit1", "Fit to 1",      []( const CompareStats & st ) { return st.fitOne.prob;   } },
+        { "fitc", "Fit to c",      []( const CompareStats & st ) { return st.fitConst.prob; } },
+    };
 
-            ConstTH1DVector obsData;  // obsData[model]
-            TH1DVector      obsComp;
+    for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+    {
+        const Observable & obs = observables[obsIndex];
 
-            for (size_t modelIndex = 0; modelIndex < figModels.size(); ++modelIndex)
-                obsData.push_back( figData[modelIndex][obsIndex] );
+        for (const MatrixSetup & matrix : matrices)
+        {
+            std::string name  = std::string("matrix_") + matrix.suffix + "_" + obs.name;
+            std::string title = std::string(obs.title) + " - " + matrix.label;
 
-            // calculate the comparisons
-            CalculateCompareHists( obs, obsData, obsComp, figModels, figSetup.colors );
+            std::unique_ptr<TH2D> upHist( new TH2D( name.c_str(), title.c_str(),
+                                                    (Int_t)nModels, 0, (Double_t)nModels,
+                                                    (Int_t)nModels, 0, (Double_t)nModels ) );
+            upHist->SetDirectory( nullptr );
 
-            // write the comparison hist
-            WriteHists( upOutputFile.get(), obsComp );  // output file takes ownership of histograms
+            for (size_t model = 0; model < nModels; ++model)
+            {
+                upHist->GetXaxis()->SetBinLabel( (Int_t)model + 1, models[model].modelName );
+                upHist->GetYaxis()->SetBinLabel( (Int_t)model + 1, models[model].modelName );
+            }
 
+            for (size_t pair = 0; pair < nPairs; ++pair)
             {
-                std::string figName  = "fig_" + std::string(obsComp[0]->GetName());
-                std::string figTitle = obsComp[0]->GetTitle();
+                const Int_t    bin1 = (Int_t)pairs[pair].first  + 1;
+                const Int_t    bin2 = (Int_t)pairs[pair].second + 1;
+                const Double_t prob = matrix.pValue( stats[obsIndex * nPairs + pair] );
 
-                WriteCompareFigure( figName.c_str(), figTitle.c_str(), obsData, ToConstTH1DVector(obsComp), figSetup.colors, obsData );
+                upHist->SetBinContent( bin1, bin2, prob );  // symmetric
+                upHist->SetBinContent( bin2, bin1, prob );
             }
+
+            upHist->GetZaxis()->SetTitle( "p-value" );
+            upHist->SetMinimum( 0 );
+            upHist->SetMaximum( 1 );
+            upHist->SetStats( kFALSE );
+            upHist->SetOption( "COLZ TEXT" );
+
+            upOutputFile->WriteTObject( upHist.get() );
         }
     }
 
-    //upOutputFile->Write( 0, TFile::kOverwrite );
     upOutputFile->Close();
 }
 
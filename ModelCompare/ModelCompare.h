@@ -11,6 +11,8 @@
 
 #include "common.h"
 #include "RootUtil.h"
+#include "HistToys.h"
+#include "EventStats.h"
 
 // Root includes
 #include <Rtypes.h>
@@ -19,6 +21,9 @@
 // forward declarations
 
 class TH1D;
+class TFile;
+class TGraph;
+class TObjString;
 
 namespace HepMC
 {
@@ -31,6 +36,7 @@ namespace ModelCompare
 {
 
 struct Observable;
+struct HistBank;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -53,6 +59,17 @@ void GetObs( const HepMC::GenVertex & signal, double * values, size_t count,
     values[0] = RetObsFunc( signal, args ... );
 }
 
+// storage of observable bin contents in HistBank, can be combined
+// The storage applies only once the histograms are filled: filling is always in double precision,
+// and the bins are rounded when moved to the bank. A TProfile observable keeps the bins of its source
+// histogram as well as the bank (see HistBank), so the storage does not reduce its memory.
+enum HistStorage : UInt_t
+{
+    kHistStorageDense   = 0,        // all bins, double precision
+    kHistStorageSparse  = 1 << 0,   // only bins that are non-empty in any model
+    kHistStorageFloat   = 1 << 1,   // single precision, calculations are done in double precision
+};
+
 typedef TH1D * TH1DFactoryFunctionType( const Observable & obs, const char * name, const char * title );
 typedef std::function< TH1DFactoryFunctionType > TH1DFactoryFunction;
 
@@ -71,6 +88,8 @@ struct Observable
     GetObsFunction          getFunction;
     size_t                  nDim            = 1;
     TH1DFactoryFunction     factoryFunction = nullptr;
+    UInt_t                  storage         = kHistStorageDense;
+    const char *            valueSource     = nullptr;  // observable whose per-event values are used, see Rebin
 
     // force required fields to be filled on construction
     Observable( const char * name, const char * title, Int_t nBins, Double_t xMin, Double_t xMax,
@@ -104,6 +123,19 @@ struct Observable
     {
     }
 
+    Observable( const char * name, const char * title, Int_t nBins, Double_t xMin, Double_t xMax,
+                const char * xAxisTitle, const char * yAxisTitle,
+                const GetObsFunction & getFunction,
+                size_t nDim,
+                const TH1DFactoryFunction & factoryFunction,
+                UInt_t storage )
+      : name(name), title(title), nBins(nBins), xMin(xMin), xMax(xMax),
+        xAxisTitle(xAxisTitle), yAxisTitle(yAxisTitle),
+        getFunction(getFunction), nDim(nDim),
+        factoryFunction(factoryFunction), storage(storage)
+    {
+    }
+
     TH1D * MakeHist( const char * namePrefix = nullptr, const char * titlePrefix = nullptr,
                      const char * nameSuffix = nullptr, const char * titleSuffix = nullptr ) const
     {
@@ -121,8 +153,22 @@ struct Observable
 
 
     void FillHist( TH1D & hist, double weight, const HepMC::GenVertex & signal ) const;
+    void FillHist( TH1D & hist, double weight, const double * values ) const;  // values from getFunction
+
+    // Copy with another name and binning, or factory (e.g. DefaultTProfileFactory, which needs 2 values),
+    // that shares the per-event values of this observable in LoadHistData, so getFunction is
+    // evaluated once per event for all the copies. Throws if the copy needs 2 values and this
+    // observable provides only 1 (nDim = 1 and not a TProfile).
+    Observable Rebin( const char * name, Int_t nBins, Double_t xMin, Double_t xMax,
+                      const TH1DFactoryFunction & factoryFunction = nullptr ) const;
+
+    bool IsAutoRange() const { return xMax <= xMin; }  // see AutoRangeQuantile
 };
 
+// Observables with xMax <= xMin (e.g. 0, 0) have their range set by LoadHistData
+// from the data quantiles [AutoRangeQuantile, 1 - AutoRangeQuantile] of all loaded models.
+const Double_t AutoRangeQuantile = 1E-3;
+
 typedef std::vector<Observable> ObservableVector;
 
 // useful macro when defining tables of Observables
@@ -170,17 +216,27 @@ struct FigureSetup
     RootUtil::CStringVector     modelNames;
     double                      luminosity  = 0.0;     // in fb^-1
     RootUtil::ColorVector       colors      = DefaultColors;
+    RootUtil::ToyConfig         toys;                   // toy p-values in the figure legend, none by default
+    RootUtil::CStringVector     observableNames;        // Observable::name of the observables compared, all if empty
+    bool                        entryScaling = false;   // scale to the luminosity as ScaleHistEntries, not TH1::Scale (see "Luminosity scaling")
 
     FigureSetup() = default;
     FigureSetup( const RootUtil::CStringVector & n )                                            : modelNames(n)                             {}
     FigureSetup( const RootUtil::CStringVector & n, double l )                                  : modelNames(n), luminosity(l)              {}
     FigureSetup( const RootUtil::CStringVector & n, double l, const RootUtil::ColorVector & c ) : modelNames(n), luminosity(l), colors(c)   {}
+    FigureSetup( const RootUtil::CStringVector & n, double l, const RootUtil::ColorVector & c, const RootUtil::CStringVector & o )
+      : modelNames(n), luminosity(l), colors(c), observableNames(o)
+    {
+    }
 
     static const RootUtil::ColorVector DefaultColors;
 };
 
 typedef std::vector<FigureSetup> FigureSetupVector;
 
+// The model and observable pairs to load, select[model][observable] (see SelectLoadObservables).
+typedef std::vector< std::vector<bool> > ObsSelection;
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct GoodBadHists
@@ -189,30 +245,286 @@ struct GoodBadHists
     RootUtil::TH1DUniquePtr     bad;
 };
 
+// Per-bin good/bad classification of a histogram (see IsGoodStatBin), made in a single pass.
+// A bin is good if it is good in all of the reference histograms.
+struct GoodBadMask
+{
+    std::vector<UChar_t>    good;               // [bin] 1 = good, 0 = bad, including under/overflow (see StatBins::pSelect)
+    size_t                  nGood       = 0;    // non-empty good bins
+    size_t                  nBad        = 0;    // non-empty bad bins
+    size_t                  nEmpty      = 0;    // empty bins
+    size_t                  nBadInRange = 0;    // non-empty bad bins, excluding under/overflow
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// statistics of a base vs. compare histogram pair, as shown in WriteCompareFigure (good bins only)
+struct CompareStats
+{
+    Double_t                ksProb      = 0;    // Kolmogorov probability
+    RootUtil::Chi2Result    chi2;               // Chi2Test
+    RootUtil::Chi2Result    fitOne;             // fit of ratio to 1
+    RootUtil::Chi2Result    fitConst;           // fit of ratio to a constant
+    Double_t                fitValue    = 0;    // constant from fitConst
+    Double_t                fitError    = 0;
+};
+
+// good/bad bins, statistics and legend labels of a comparison figure (see WriteCompareFigure), calculated without drawing
+struct CompareFigureStats
+{
+    std::vector<GoodBadMask>                goodBadData;    // [data]
+    std::vector<GoodBadMask>                goodBadCompare; // [compare]
+    std::vector< std::vector<std::string> > dataLabels;     // [data][label] legend entries after each data entry
+    std::vector< std::vector<std::string> > compareLabels;  // [compare][label]
+    std::vector<size_t>                     dataToys;       // [data] number of toys of the toy p-values, 0 if none
+    std::vector<CompareStats>               pairStats;      // [compare] statistics of data[0] vs. data[compare + 1]
+    std::vector<RootUtil::ToyPValues>       pairToys;       // [compare]
+    std::vector<std::string>                logLines;       // log messages of the calculation, in order (see LogCompareFigureStats)
+};
+
+// graphs of the CompareStats p-values vs. a scanned variable
+struct CompareStatsGraphs
+{
+    std::unique_ptr<TGraph>     ks;
+    std::unique_ptr<TGraph>     chi2;
+    std::unique_ptr<TGraph>     fitOne;
+    std::unique_ptr<TGraph>     fitConst;
+
+    CompareStatsGraphs( const std::string & name, const std::string & title, size_t nPoints, const char * xAxisTitle );
+    CompareStatsGraphs( CompareStatsGraphs && );
+    ~CompareStatsGraphs();
+
+    void SetPoint( size_t index, double x, const CompareStats & stats );
+    void Write( TFile * pFile ) const;
+};
+
+typedef std::vector<double> LuminosityVector;   // in fb^-1
+
+struct MinLuminosityResult
+{
+    std::string             name;               // same as the comparison histogram name
+    double                  luminosity  = 0;    // in fb^-1, 0 if not distinguishable
+    RootUtil::Chi2Result    chi2;               // Chi2Test at luminosity
+};
+
+// Covariance of the bin contents of several observables of one model, accumulated in the
+// event pass of LoadHistData. The combined bins are the bins 1..nBins of each observable in turn.
+// Each event adds weight^2 to every pair of combined bins it falls in, so the diagonal is the
+// bin sumw2 and the off-diagonal blocks are the co-occurrence of bins of different observables.
+struct ObsCovariance
+{
+    std::vector<size_t>     obs;            // obs[i]       = observable index
+    std::vector<Int_t>      obsOffset;      // obsOffset[i] = first combined bin of obs[i]
+    Int_t                   nBins   = 0;    // number of combined bins
+    std::vector<Double_t>   cov;            // [a * nBins + b]
+
+    ObsCovariance() = default;
+    ObsCovariance( const ObservableVector & observables, const std::vector<size_t> & covObs );
+};
+
+struct CombinedChi2Result
+{
+    std::string             name;           // base and compare model names
+    RootUtil::Chi2Result    chi2;
+};
+
+struct UnbinnedCompareResult
+{
+    std::string                     name;       // same as the comparison histogram name
+    RootUtil::UnbinnedTestResult    ks;         // Kolmogorov-Smirnov
+    RootUtil::UnbinnedTestResult    ad;         // Anderson-Darling
+    RootUtil::UnbinnedTestResult    energy;     // energy distance
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 
+// Luminosity scaling
+//
+// The luminosity scans scale the histograms as a change of luminosity (see RootUtil::ScaleHistEntries):
+// the entries of every bin, and so the effective entries and the good bins (see IsGoodStatBin), grow
+// with the luminosity. This is used by the scale arguments of CalculateCompareStats and CalculateCombinedChi2,
+// LuminositySweep, FindMinimumLuminosity, CompareMatrix and CoefficientScan, so all report the same
+// statistics for the same luminosity.
+// The figures of ModelCompare scale the histograms as TH1::Scale, which leaves the effective entries
+// unchanged, so their p-values do not depend on the luminosity. With FigureSetup::entryScaling they
+// scale as the luminosity scans instead (see HistBank::Scale).
+
 void ScaleHistToLuminosity( double luminosity, const RootUtil::TH1DVector & hists, const ModelFile & eventFile, bool bApplyCrossSectionError = false );
 
+bool IsGoodStatBin( Double_t effEntries );
+bool IsGoodStatBinPair( Double_t effEntries1, Double_t effEntries2 );   // a RootUtil::StatBinMask
+
+// the log message is appended to *pLog instead, if given
+GoodBadMask MakeGoodBadMask( const TH1D & source, const RootUtil::ConstTH1DVector & reference, std::vector<std::string> * pLog = nullptr );
+TH1D *      MakeGoodBadHist( const TH1D & source, const GoodBadMask & mask, bool bGood );   // caller takes ownership
+
 GoodBadHists HistSplitGoodBadBins( const TH1D * pSource, const TH1D * pCompare = nullptr );
 std::list<GoodBadHists> HistSplitGoodBadBins( const RootUtil::ConstTH1DVector & hists, const RootUtil::ConstTH1DVector & compare );
 
-void WriteCompareFigure( const char * name, const char * title,
-                         const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
-                         const RootUtil::ColorVector & dataColors,
-                         const RootUtil::ConstTH1DVector & rawData );
+// Fit to a TF1 formula. "pol0", "pol1" and "pol2" are solved in closed form, other formulas use Minuit.
+RootUtil::Chi2Result FitToFormula( const TH1D & hist, const char * formula, std::vector<Double_t> & params, std::vector<Double_t> & errors );
+
+// chi2 of the difference comp - base over the good bins of all covariance observables, with the
+// luminosity scales applied to the histograms and covariances; hists are [observable]
+RootUtil::Chi2Result CalculateCombinedChi2( const RootUtil::TH1DVector & base, const RootUtil::TH1DVector & comp,
+                                            const ObsCovariance & baseCov, const ObsCovariance & compCov,
+                                            double baseScale = 1.0, double compScale = 1.0 );
+
+RootUtil::Chi2Result CalculateCompareChi2( const TH1D & base, const TH1D & comp, double baseScale = 1.0, double compScale = 1.0 );
+
+CompareStats CalculateCompareStats( const TH1D & base, const TH1D & comp, double baseScale = 1.0, double compScale = 1.0 );
+
+std::string GetCompareStatsString( const CompareStats & stats );
+
+// Are the statistics equal within relTolerance (used to check the figure statistics against CalculateCompareStats)
+bool IsSameCompareStats( const CompareStats & stats1, const CompareStats & stats2, double relTolerance );
+
+// The statistics of a figure do not modify any ROOT object, so may be calculated in parallel (see ParallelFor).
+// The log messages are not logged, but returned in stats.logLines.
+CompareFigureStats CalculateCompareFigureStats( const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                                                const RootUtil::ConstTH1DVector & rawData,
+                                                const RootUtil::ToyConfig & toys = RootUtil::ToyConfig() );
+
+void LogCompareFigureStats( const CompareFigureStats & stats );    // log stats.logLines
+
+// CalculateCompareFigureStats as separate tasks, so the tasks of several figures can be distributed
+// together over the worker threads (see ParallelFor). The stages run in order: all the masks, then
+// all the pairs, then all the toy blocks, then Finish. The tasks of a stage may run in parallel.
+// The histograms must outlive the tasks.
+struct CompareFigureStatsTasks
+{
+    CompareFigureStatsTasks( const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                             const RootUtil::ConstTH1DVector & rawData, const RootUtil::ToyConfig & toys );
+
+    size_t MaskCount() const    { return data.size() + compare.size(); }
+    void   CalculateMask( size_t mask );    // the data masks, then the compare masks
+
+    size_t PairCount() const    { return pairLog.size(); }
+    void   CalculatePair( size_t pair );    // tests of data[0] vs. data[pair + 1], and fits of compare[pair]
+
+    size_t ToyBlockCount( size_t pair ) const;
+    void   CalculateToyBlock( size_t pair, size_t block );
+
+    // the labels, and the log messages in the order of a serial calculation
+    CompareFigureStats Finish();
+
+private:
+    RootUtil::ConstTH1DVector                               data;
+    RootUtil::ConstTH1DVector                               compare;
+    RootUtil::ConstTH1DVector                               rawData;
+    RootUtil::ToyConfig                                     toys;
+
+    CompareFigureStats                                      stats;
+    std::vector< std::vector<std::string> >                 maskLog;    // [mask]
+    std::vector< std::vector<std::string> >                 pairLog;    // [pair]
+    std::vector<Double_t>                                   pairKs;     // [pair] Kolmogorov probability of the data pair
+    std::vector<RootUtil::Chi2Result>                       pairChi2;   // [pair] Chi2Test of the data pair
+    std::vector< std::unique_ptr<RootUtil::ToyPValueRun> >  pairToyRun; // [pair], null without a data pair
+};
+
+// Classify the good and bad bins of the data and compare histograms of a figure (stats.goodBadData, goodBadCompare).
+void MakeCompareFigureMasks( CompareFigureStats & stats, const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                             const RootUtil::ConstTH1DVector & rawData );
+
+// How a figure is stored in the output file (bit flags).
+enum FigureOutput
+{
+    kFigureOutputCanvas     = 1 << 0,   // the drawn TCanvas
+    kFigureOutputDescriptor = 1 << 1,   // a small descriptor referring to the stored histograms, see LoadCompareFigure
+
+    // Keep the figures of an existing output file whose inputs are unchanged (see FigureHashesKey),
+    // instead of recalculating and redrawing them.
+    kFigureOutputIncremental = 1 << 2,
+};
+
+const char * const FigureHashesKey = "figure_hashes";  // TObjString, one line per figure: name <tab> hash of its inputs
+
+const char * const FigureDescriptorSuffix = "_desc";   // key name of the descriptor is the figure name + suffix
+
+// Make a figure descriptor, written with the key name of the figure + FigureDescriptorSuffix. Caller takes ownership.
+// The data scales are applied as TH1::Scale, or as ScaleHistEntries with bEntryScaling (see HistBank::Scale).
+TObjString * MakeCompareFigureDescriptor( const char * title,
+                                         const RootUtil::ConstTH1DVector & data, const std::vector<double> & dataScales,
+                                         const RootUtil::ConstTH1DVector & compare, const RootUtil::ColorVector & dataColors,
+                                         const CompareFigureStats & stats, bool bEntryScaling = false );
+
+// Write a figure descriptor (TObjString) to the current directory: the keys of the data histograms
+// with their scales and colors, the keys of the compare histograms, and the legend statistics.
+// The histograms must be written to the same file.
+void WriteCompareFigureDescriptor( const char * name, const char * title,
+                                   const RootUtil::ConstTH1DVector & data, const std::vector<double> & dataScales,
+                                   const RootUtil::ConstTH1DVector & compare, const RootUtil::ColorVector & dataColors,
+                                   const CompareFigureStats & stats, bool bEntryScaling = false );
 
 bool LoadCacheHist( const char * cacheFileName, TH1D * & pHist );
 
+// Optionally accumulate the covariance between the observables covObs, covariance[model].
+// This always reads the events; cached histograms are not refilled.
+// Optionally load only the selected model and observable pairs (the covariance observables are always loaded),
+// the histograms not loaded are null. An auto-range observable has its range set from the models that load it,
+// and is cached with that range, for the same models only.
 void LoadHistData( const ModelFileVector & models, const ObservableVector & observables, std::vector<RootUtil::TH1DVector> & hists,
-                   const char * cacheFileName = nullptr );
-
-void CalculateCompareHists( const Observable & obs, const RootUtil::ConstTH1DVector & data, RootUtil::TH1DVector & comp,
+                   const char * cacheFileName = nullptr,
+                   const std::vector<size_t> & covObs = {}, std::vector<ObsCovariance> * pCovariance = nullptr,
+                   const ObsSelection * pSelect = nullptr );
+
+// Load the unweighted per-event values of each model and observable, samples[model][observable].
+// For an observable with more than one value per event (e.g. a TProfile), the first value is used.
+// The values are cached as one TNtupleD per model.
+void LoadEventData( const ModelFileVector & models, const ObservableVector & observables,
+                    std::vector< std::vector<RootUtil::EventSample> > & samples,
+                    const char * cacheFileName = nullptr );
+
+void CalculateCompareHists( const Observable & obs, size_t obsIndex, const HistBank & figRatio, RootUtil::TH1DVector & comp,
                             const ModelFileVector & models, const RootUtil::ColorVector & dataColors );
 
-void ModelCompare( const char * outputFileName,
-                   const ModelFileVector & models, const ObservableVector & observables,
-                   const FigureSetupVector & figures,
-                   const char * cacheFileName = nullptr );
+ModelFileVector     SelectLoadModels( const ModelFileVector & models, const FigureSetupVector & figures );
+std::vector<size_t> FindFigureModels( const FigureSetup & figSetup, const ModelFileVector & loadModels );
+std::vector<size_t> FindFigureObservables( const FigureSetup & figSetup, const ObservableVector & observables );
+
+// Select the model and observable pairs used by any of the figures, select[loadModel][observable].
+ObsSelection SelectLoadObservables( const ModelFileVector & loadModels, const ObservableVector & observables,
+                                    const FigureSetupVector & figures );
+
+double GetLuminosityScale( double luminosity, const ModelFile & model, const RootUtil::TH1DVector & data );
+std::vector<double> GetUnitLuminosityScales( const ModelFileVector & loadModels, const std::vector<RootUtil::TH1DVector> & modelData );
+
+std::string GetComparePairName(  const ModelFile & base, const ModelFile & comp, const Observable & obs );
+std::string GetComparePairTitle( const ModelFile & base, const ModelFile & comp, const Observable & obs );
+
+// Fill the histograms of all models and observables used by the figures into the cache file (see LoadHistData).
+// Uses only the compute code, so runs in the headless ModelCompareFill executable.
+void FillHistCache( const ModelFileVector & models, const ObservableVector & observables,
+                    const FigureSetupVector & figures, const char * cacheFileName );
+
+LuminosityVector MakeLuminosityRange( double lumiMin, double lumiMax, size_t nPoints, bool bLogSpacing = true );
+
+// The luminosity sweep and minimum luminosity scale all bin sums with the luminosity (see "Luminosity scaling"),
+// as the figures only with FigureSetup::entryScaling.
+void LuminositySweep( const char * outputFileName,
+                      const ModelFileVector & models, const ObservableVector & observables,
+                      const FigureSetupVector & figures, const LuminosityVector & luminosities,
+                      const char * cacheFileName = nullptr );
+
+double FindMinimumLuminosity( const TH1D & base, const TH1D & comp, double baseUnitScale, double compUnitScale,
+                              double pValue = 0.05, double lumiMin = 1E-3, double lumiMax = 1E6, double relTolerance = 1E-3 );
+
+std::vector<MinLuminosityResult> MinimumLuminositySearch( const ModelFileVector & models, const ObservableVector & observables,
+                                                          const FigureSetupVector & figures, double pValue = 0.05,
+                                                          const char * cacheFileName = nullptr );
+
+std::vector<CombinedChi2Result> CombinedCompare( const ModelFileVector & models, const ObservableVector & observables,
+                                                 const FigureSetupVector & figures, const std::vector<size_t> & covObs,
+                                                 const char * cacheFileName = nullptr );
+
+std::vector<UnbinnedCompareResult> UnbinnedCompare( const ModelFileVector & models, const ObservableVector & observables,
+                                                    const FigureSetupVector & figures, size_t nPermutations = 0,
+                                                    const char * cacheFileName = nullptr );
+
+void CompareMatrix( const char * outputFileName,
+                    const ModelFileVector & models, const ObservableVector & observables,
+                    double luminosity = 0,
+                    const char * cacheFileName = nullptr );
 
 ////////////////////////////////////////////////////////////////////////////////
 
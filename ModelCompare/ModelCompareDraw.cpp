@@ -0,0 +1,951 @@
+//
+//  ModelCompareDraw.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "ModelCompareDraw.h"
+
+#include "common.h"
+#include "RootUtil.h"
+#include "RootDraw.h"
+#include "ModelCompare.h"
+#include "HistBank.h"
+#include "Parallel.h"
+#include "OutputWriter.h"
+#include "CompareSummary.h"
+#include "ModelStore.h"
+
+#include <sstream>
+
+// Root includes
+#include <TStyle.h>
+#include <TSystem.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TProfile.h>
+#include <TCanvas.h>
+#include <TLegend.h>
+#include <TPaveText.h>
+#include <TLine.h>
+#include <TObjString.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace RootUtil;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool s_figureStatsCheck = false;
+
+////////////////////////////////////////////////////////////////////////////////
+bool GetFigureStatsCheck()
+{
+    return s_figureStatsCheck;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SetFigureStatsCheck( bool bCheck )
+{
+    s_figureStatsCheck = bCheck;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistScaleTextTicks( TH1D & hist, Float_t vert, Float_t horz = 1 )
+{
+    TAxis * xAxis = hist.GetXaxis();
+    TAxis * yAxis = hist.GetYaxis();
+
+    if (vert <= 0) vert = 1;
+    if (horz <= 0) horz = 1;
+
+    if (vert != 1)
+    {
+        // titles, labels, and x-ticks are vertically-sized
+
+        xAxis->SetTitleSize(  xAxis->GetTitleSize()  * vert );
+        xAxis->SetLabelSize(  xAxis->GetLabelSize()  * vert );
+        xAxis->SetTickLength( xAxis->GetTickLength() * vert );
+
+        yAxis->SetTitleSize(  yAxis->GetTitleSize()  * vert );
+        yAxis->SetLabelSize(  yAxis->GetLabelSize()  * vert );
+
+        // drawn title offset scales with both title size and offset
+        // correct y-axis title-offset so title does not move even though it is larger
+        yAxis->SetTitleOffset( yAxis->GetTitleOffset() / vert );
+    }
+
+    if (horz != 1)
+    {
+        // y-ticks are horizontally-sized
+
+        yAxis->SetTickLength( yAxis->GetTickLength() * horz );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistScaleTextTicks( const TH1DVector & hists, Float_t vert, Float_t horz = 1 )
+{
+    for (TH1D * pHist : hists)
+    {
+        if (pHist)
+            HistScaleTextTicks( *pHist, vert, horz );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void WriteCompareFigure( const char * name, const char * title, const ConstTH1DVector & data, const ConstTH1DVector & compare, const ColorVector & dataColors,
+                         const ConstTH1DVector & rawData,
+                         const ToyConfig & toys /*= ToyConfig()*/ )
+{
+    CompareFigureStats stats = CalculateCompareFigureStats( data, compare, rawData, toys );
+    LogCompareFigureStats( stats );
+
+    WriteCompareFigure( name, title, data, compare, dataColors, stats );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void WriteCompareFigure( const char * name, const char * title, const ConstTH1DVector & data, const ConstTH1DVector & compare, const ColorVector & dataColors,
+                         const CompareFigureStats & stats,
+                         const ImageExport & imageExport /*= ImageExport()*/,
+                         UInt_t figureOutput /*= kFigureOutputCanvas*/ )
+{
+    if (!(figureOutput & kFigureOutputCanvas) && !imageExport.IsEnabled())
+        return;
+
+    std::unique_ptr<TCanvas> pCanvas( MakeCompareFigure( name, title, data, compare, dataColors, stats ) );
+
+    // export images, the worker renders its own copy of the canvas
+    ExportPadImages( *pCanvas, name, imageExport );
+
+    // write canvas
+    if (figureOutput & kFigureOutputCanvas)
+        pCanvas->Write();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TCanvas * MakeCompareFigure( const char * name, const char * title, const ConstTH1DVector & data, const ConstTH1DVector & compare, const ColorVector & dataColors,
+                             const CompareFigureStats & stats )
+{
+    auto SetupCompareHists = []( const TH1DVector & hists ) -> void
+    {
+        for (TH1D * pHist : hists)
+        {
+            if (pHist)
+            {
+                //pHist->SetLineWidth(2);
+                pHist->GetXaxis()->CenterTitle();
+                pHist->GetYaxis()->CenterTitle();
+            }
+        }
+    };
+
+    /////
+
+    const Double_t LowerPadFraction = 1.0/2.0;
+    const Double_t UpperPadFraction = 1.0 - LowerPadFraction;
+
+    std::unique_ptr<TCanvas> pCanvas( new TCanvas( name, title ) );
+    TCanvas & canvas = *pCanvas;
+
+    // divide the canvas into two pads
+    {
+        canvas.SetMargin(0, 0, 0, 0);   // clear margins before division, so that entire canvas is "owned" by subpads
+        canvas.Divide(1,2,0,0);         // divide canvas into an upper and lower pad, with no space between pads
+
+        TVirtualPad * pPad = nullptr;
+
+        // setup upper pad
+        {
+            pPad = canvas.GetPad(1);
+
+            pPad->SetPad( 0, LowerPadFraction, 1, 1 );  // xlow, ylow, xup, yup
+
+            pPad->UseCurrentStyle();    // restore margins to default after division
+            pPad->SetBottomMargin(0);   // remove bottom margin
+
+            pPad->SetTopMargin( Float_t(pPad->GetTopMargin() / UpperPadFraction) );         // increase top margin
+        }
+
+        // setup lower pad
+        {
+            pPad = canvas.GetPad(2);
+
+            pPad->SetPad( 0, 0, 1, LowerPadFraction );  // xlow, ylow, xup, yup
+
+            pPad->UseCurrentStyle();    // restore margins to default after division
+            pPad->SetTopMargin(0);      // remove top margin
+
+            pPad->SetBottomMargin( Float_t(pPad->GetBottomMargin() / LowerPadFraction) );   // increase bottom margin
+        }
+
+        //Double_t xlow, ylow, xup, yup;
+        //pPad->GetPadPar(xlow, ylow, xup, yup);
+        //LogMsgInfo( "Before: x:%f->%f y:%f->%f L:%f R:%f B:%f T:%f", FMT_F(xlow), FMT_F(xup), FMT_F(ylow), FMT_F(yup),
+        //            FMT_F(pPad->GetLeftMargin()), FMT_F(pPad->GetRightMargin()), FMT_F(pPad->GetBottomMargin()), FMT_F(pPad->GetTopMargin()) );
+    }
+
+    // draw upper pad
+    {
+        LogMsgInfo( "\n--- %hs : pad 1 ---", FMT_HS(name) );
+
+        canvas.cd(1);
+
+        // draw the histograms
+        TH1DVector drawHists = DrawMultipleHist( title, data, dataColors );  // drawHists are owned by the current pad
+
+        SetupCompareHists( drawHists );
+
+        HistScaleTextTicks( drawHists, 1/UpperPadFraction );
+
+        const std::vector<GoodBadMask> & goodBadData = stats.goodBadData;
+
+        // draw bad hists
+        for (size_t i = 0; i < drawHists.size(); ++i)
+        {
+            if (goodBadData[i].nBadInRange == 0)
+                continue;
+
+            TH1DUniquePtr pBad( MakeGoodBadHist( *drawHists[i], goodBadData[i], false ) );
+            pBad->SetMarkerStyle( kOpenCircle );
+            pBad->DrawCopy( "SAME" );   // draw copy so object persists after pBad goes out of scope
+        }
+
+        // add a customized legend, different than TPad::BuildLegend
+        {
+            TLegend * pLegend = new TLegend( 0.5, 0.60, 0.88, 0.88 );
+            pLegend->SetMargin( 0.1 );  // reduce width for entry symbol from 25% to 10%
+
+            for (size_t i = 0; i < drawHists.size(); ++i)
+            {
+                const TH1D * pDrawHist = drawHists[i];
+
+                pLegend->AddEntry( pDrawHist, pDrawHist->GetTitle() );
+
+                // add Kolmogorov and Chi2Test probabilities
+                for (const std::string & label : stats.dataLabels[i])
+                {
+                    LogMsgInfo( label );
+                    pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
+                }
+
+                if (stats.dataToys[i])
+                    LogMsgInfo( "Toy p-values from %u toys", FMT_U(stats.dataToys[i]) );
+            }
+
+            pLegend->SetBit( kCanDelete );  // inform pad that it can delete this object
+            pLegend->Draw();                // add legend to current pad's list of primatives
+        }
+    }
+
+    // draw lower pad
+    {
+        LogMsgInfo( "\n--- %hs : pad 2 ---", FMT_HS(name) );
+
+        canvas.cd(2);
+
+        // draw the histograms
+        TH1DVector drawHists = DrawMultipleHist( "", compare );
+
+        SetupCompareHists( drawHists );
+
+        HistScaleTextTicks( drawHists, 1/LowerPadFraction );
+
+        const std::vector<GoodBadMask> & goodBadCompare = stats.goodBadCompare;
+
+        // draw bad hists
+        for (size_t i = 0; i < drawHists.size(); ++i)
+        {
+            if (goodBadCompare[i].nBadInRange == 0)
+                continue;
+
+            TH1DUniquePtr pBad( MakeGoodBadHist( *drawHists[i], goodBadCompare[i], false ) );
+            pBad->SetMarkerStyle( kOpenCircle );
+            pBad->DrawCopy( "SAME" );   // draw copy so object persists after pBad goes out of scope
+        }
+
+        // add ticks to top and right
+        canvas.GetPad(2)->SetTickx();
+        canvas.GetPad(2)->SetTicky();
+
+        // TODO: possibly resize vertical min/max to exclude error bars
+
+        // draw black horizontal line at 1
+        {
+            TLine * pLine = new TLine( compare[0]->GetXaxis()->GetXmin(), 1.0, compare[0]->GetXaxis()->GetXmax(), 1.0 );
+            pLine->SetLineColor(kBlack);
+            pLine->SetLineWidth(1);
+
+            pLine->SetBit(kCanDelete);  // inform pad that it can delete this object
+            pLine->Draw( "" );          // add line to current pad's list of primatives
+        }
+
+        // add a customized legend, different than TPad::BuildLegend
+        {
+            TLegend * pLegend = new TLegend( 0.12, 0.74, 0.65, 0.88 );
+            pLegend->SetMargin( 0.01 ); // remove object column
+
+            //TLegend legendStyle( 0.12, 0.67, 0.5, 0.88 );
+
+            //TPaveText * pTextBox = new TPaveText;
+            //*static_cast<TAttText *>( pTextBox ) = legendStyle;
+            //*static_cast<TPave *>(    pTextBox ) = legendStyle;
+            //pTextBox->SetMargin( 0.01 );
+
+            // add the fits to a horizontal line at y=1.0 and at y=c
+            for (size_t i = 0; i < compare.size(); ++i)
+            {
+                for (const std::string & label : stats.compareLabels[i])
+                {
+                    LogMsgInfo( label );
+                    pLegend->AddEntry( (TObject *)nullptr, label.c_str(), "" );
+                    //pTextBox->AddText( label.c_str() );
+                }
+            }
+
+            pLegend->SetBit( kCanDelete );  // inform pad that it can delete this object
+            pLegend->Draw();                // add legend to current pad's list of primatives
+            //pTextBox->SetBit( kCanDelete );  // inform pad that it can delete this object
+            //pTextBox->Draw();                // add legend to current pad's list of primatives
+        }
+    }
+
+    return pCanvas.release();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static TH1D * GetFileHist( TFile & file, const char * histName )
+{
+    // try TProfile first, as for LoadHist
+    {
+        TProfile * pHist = nullptr;
+        file.GetObject( histName, pHist );
+        if (pHist)
+        {
+            pHist->SetDirectory( nullptr );
+            return pHist;
+        }
+    }
+
+    TH1D * pHist = nullptr;
+    file.GetObject( histName, pHist );
+    if (!pHist)
+        ThrowError( std::string("LoadCompareFigure: Histogram not found: ") + histName );
+
+    pHist->SetDirectory( nullptr );
+    return pHist;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TCanvas * LoadCompareFigure( const char * fileName, const char * name )
+{
+    TDirectory * oldDir = gDirectory;
+
+    TFile file( fileName, "READ" );
+    if (file.IsZombie() || !file.IsOpen())    // IsZombie is true if constructor failed
+        ThrowError( std::invalid_argument( fileName ) );
+
+    TObjString * pDescriptor = nullptr;
+    file.GetObject( (std::string(name) + FigureDescriptorSuffix).c_str(), pDescriptor );
+    if (!pDescriptor)
+        ThrowError( std::string("LoadCompareFigure: Figure descriptor not found: ") + name );
+
+    std::unique_ptr<TObjString> upDescriptor( pDescriptor );
+
+    std::string                 title;
+    std::vector<TH1DUniquePtr>  data;
+    std::vector<TH1DUniquePtr>  compare;
+    ColorVector                 colors;
+    CompareFigureStats          stats;
+    bool                        bEntryScaling = false;
+
+    std::istringstream lines( pDescriptor->GetString().Data() );
+    std::string        line;
+    while (std::getline( lines, line ))
+    {
+        std::vector<std::string> fields;
+        {
+            std::istringstream fieldStream( line );
+            std::string        field;
+            while (std::getline( fieldStream, field, '\t' ))
+                fields.push_back( field );
+        }
+
+        if (fields.size() < 2)
+            continue;
+
+        const std::string & type = fields[0];
+
+        if (type == "title")
+        {
+            title = fields[1];
+        }
+        else if (type == "scaling")
+        {
+            bEntryScaling = (fields[1] == "entries");
+        }
+        else if ((type == "data") && (fields.size() >= 4))
+        {
+            TH1D * pHist = GetFileHist( file, fields[1].c_str() );
+            data.emplace_back( pHist );
+
+            double scale = std::stod( fields[2] );
+            if (scale != 1.0)
+            {
+                if (bEntryScaling)
+                    ScaleHistEntries( *pHist, scale );
+                else
+                    pHist->Scale( scale );
+            }
+
+            colors.push_back( (Color_t)std::stoi( fields[3] ) );
+
+            stats.dataLabels.resize( data.size() );
+            stats.dataToys  .resize( data.size(), 0 );
+        }
+        else if ((type == "label") && (fields.size() >= 3))
+        {
+            size_t i = std::stoul( fields[1] );
+            if (i < stats.dataLabels.size())
+                stats.dataLabels[i].push_back( fields[2] );
+        }
+        else if ((type == "toys") && (fields.size() >= 3))
+        {
+            size_t i = std::stoul( fields[1] );
+            if (i < stats.dataToys.size())
+                stats.dataToys[i] = std::stoul( fields[2] );
+        }
+        else if (type == "compare")
+        {
+            compare.emplace_back( GetFileHist( file, fields[1].c_str() ) );
+
+            stats.compareLabels.resize( compare.size() );
+        }
+        else if ((type == "fit") && (fields.size() >= 3))
+        {
+            size_t i = std::stoul( fields[1] );
+            if (i < stats.compareLabels.size())
+                stats.compareLabels[i].push_back( fields[2] );
+        }
+    }
+
+    file.Close();
+    if (oldDir)
+        oldDir->cd();
+
+    if (data.empty() || (compare.size() + 1 != data.size()))
+        ThrowError( std::string("LoadCompareFigure: Invalid figure descriptor: ") + name );
+
+    ConstTH1DVector constData;
+    for (const TH1DUniquePtr & pHist : data)
+        constData.push_back( pHist.get() );
+
+    ConstTH1DVector constCompare;
+    for (const TH1DUniquePtr & pHist : compare)
+        constCompare.push_back( pHist.get() );
+
+    // the good/bad bins are recalculated, as they are cheap and only needed for drawing
+    MakeCompareFigureMasks( stats, constData, constCompare, constData );
+
+    return MakeCompareFigure( name, title.c_str(), constData, constCompare, colors, stats );  // draws copies of the histograms
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 64-bit FNV-1a hash of the inputs of a figure
+struct FigureHash
+{
+    ULong64_t value = 14695981039346656037ULL;
+
+    void AddBytes( const void * pData, size_t size )
+    {
+        const UChar_t * pByte = static_cast<const UChar_t *>(pData);
+        for (size_t i = 0; i < size; ++i)
+        {
+            value ^= pByte[i];
+            value *= 1099511628211ULL;
+        }
+    }
+
+    void Add( const std::string & text )    { AddBytes( text.c_str(), text.size() + 1 ); }  // including terminator
+    void Add( const char * text )           { Add( std::string( text ? text : "" ) ); }
+    void Add( Double_t x )                  { AddBytes( &x, sizeof(x) ); }
+    void Add( Long64_t x )                  { AddBytes( &x, sizeof(x) ); }
+
+    void Add( const Double_t * pArray, Int_t n )
+    {
+        Add( Long64_t(pArray ? n : -1) );
+        if (pArray)
+            AddBytes( pArray, n * sizeof(Double_t) );
+    }
+
+    std::string ToString() const
+    {
+        std::ostringstream text;
+        text << std::hex << value;
+        return text.str();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static std::string GetFigureHash( const std::string & figName, const std::string & figTitle, const TH1DVector & data,
+                                  const FigureSetup & figSetup, const ImageExport & imageExport, UInt_t figureOutput )
+{
+    FigureHash hash;
+
+    hash.Add( "ModelCompare figure 1" );    // change if the figure calculation or drawing changes
+
+    hash.Add( figName );
+    hash.Add( figTitle );
+
+    // data histograms, after luminosity scaling
+    for (const TH1D * pHist : data)
+    {
+        hash.Add( pHist->GetName() );
+        hash.Add( pHist->GetTitle() );
+        hash.Add( pHist->GetXaxis()->GetTitle() );
+        hash.Add( pHist->GetYaxis()->GetTitle() );
+        hash.Add( pHist->GetXaxis()->GetXmin() );
+        hash.Add( pHist->GetXaxis()->GetXmax() );
+        hash.Add( pHist->GetEntries() );
+
+        HistBinView view( *pHist );
+        hash.Add( view.pSumw,       view.nSize );
+        hash.Add( view.pSumw2,      view.nSize );
+        hash.Add( view.pBinEntries, view.nSize );
+        hash.Add( view.pBinSumw2,   view.nSize );
+    }
+
+    for (Color_t color : figSetup.colors)
+        hash.Add( Long64_t(color) );
+
+    hash.Add( figSetup.luminosity );
+    hash.Add( Long64_t(figSetup.entryScaling) );
+
+    hash.Add( Long64_t(figSetup.toys.nToys) );
+    hash.Add( Long64_t(figSetup.toys.seed) );
+    hash.Add( Long64_t(figSetup.toys.fluctuation) );
+
+    hash.Add( Long64_t(figureOutput & ~UInt_t(kFigureOutputIncremental)) );
+
+    hash.Add( imageExport.IsEnabled() ? imageExport.directory : std::string() );
+    for (const char * format : imageExport.formats)
+        hash.Add( format );
+
+    return hash.ToString();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static std::map<std::string, std::string> LoadFigureHashes( TFile & file )
+{
+    std::map<std::string, std::string> hashes;     // [figure name] hash
+
+    TObjString * pText = nullptr;
+    file.GetObject( FigureHashesKey, pText );
+    if (!pText)
+        return hashes;
+
+    std::unique_ptr<TObjString> upText( pText );
+
+    std::istringstream lines( pText->GetString().Data() );
+    std::string        line;
+    while (std::getline( lines, line ))
+    {
+        size_t tab = line.find( '\t' );
+        if (tab != std::string::npos)
+            hashes[ line.substr( 0, tab ) ] = line.substr( tab + 1 );
+    }
+
+    return hashes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelCompare( const char * outputFileName,
+                   const ModelFileVector & models, const ObservableVector & observables,
+                   const FigureSetupVector & figures,
+                   const char * cacheFileName /*= nullptr*/,
+                   const ImageExport & imageExport /*= ImageExport()*/,
+                   UInt_t figureOutput /*= kFigureOutputCanvas*/,
+                   const char * summaryFileName /*= nullptr*/ )
+{
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    // modify the global style
+    gStyle->SetPaperSize( TStyle::kA4 );
+    gStyle->SetTitleOffset( 1.3, "xyz" ); // increase title offsets a little more
+    gStyle->SetPadTopMargin(   0.03 );
+    gStyle->SetPadRightMargin( 0.03 );
+    gStyle->SetPadLeftMargin(  0.09 );
+    gStyle->SetOptTitle( kFALSE );
+
+    // incremental: move the previous output aside, to copy the unchanged figures from
+    std::string                         prevFileName;
+    std::unique_ptr<TFile>              upPrevFile;
+    std::map<std::string, std::string>  prevHashes;     // [figure name] hash
+
+    if ((figureOutput & kFigureOutputIncremental) && !gSystem->AccessPathName( outputFileName ))   // false if file exists
+    {
+        prevFileName = std::string(outputFileName) + ".prev";
+
+        if (gSystem->Rename( outputFileName, prevFileName.c_str() ) != 0)
+            ThrowError( "ModelCompare: Failed to rename previous output file " + std::string(outputFileName) );
+
+        TDirectory * oldDir = gDirectory;
+
+        upPrevFile.reset( new TFile( prevFileName.c_str(), "READ" ) );
+        if (upPrevFile->IsZombie() || !upPrevFile->IsOpen())    // IsZombie is true if constructor failed
+            upPrevFile.reset();
+        else
+            prevHashes = LoadFigureHashes( *upPrevFile );
+
+        if (oldDir)
+            oldDir->cd();
+
+        LogMsgInfo( "Previous output: %u figures", FMT_U(prevHashes.size()) );
+    }
+
+    std::string figureHashes;   // text of FigureHashesKey
+    size_t      nFigReused = 0;
+    size_t      nFigUpdated = 0;
+
+    // one summary record per figure and compared model, appended as each figure is done
+    std::unique_ptr<CompareSummaryWriter> upSummary;
+    if (summaryFileName && summaryFileName[0])
+        upSummary.reset( new CompareSummaryWriter( summaryFileName ) );
+
+    // determine which model files are to be loaded, and the observables used by their figures
+    ModelFileVector loadModels = SelectLoadModels( models, figures );                         // loadModels[model]
+    ObsSelection    loadSelect = SelectLoadObservables( loadModels, observables, figures );  // loadSelect[model][observable]
+
+    std::vector<UInt_t> obsStorage;
+    for (const Observable & obs : observables)
+        obsStorage.push_back( obs.storage );
+
+    // the observable histograms, deleted after the writer (see below);
+    // the bin contents are kept in a bank per model, with the storage of each observable
+    ModelStore store( loadModels, observables, loadSelect, cacheFileName, GetModelMemoryBudget(), &obsStorage );
+
+    // objects are written in order on the writer's helper thread
+    OutputWriter writer( outputFileName );
+
+    // With a memory budget, the working set of each figure is reserved in the budget (see ModelStore::Require),
+    // and the output queue is limited to the working set of the largest figure, which is also reserved.
+    std::vector<size_t> figBytes( figures.size(), 0 );     // figBytes[figure]
+    size_t              maxFigBytes = 0;
+    if (store.IsBounded())
+    {
+        for (size_t figIndex = 0; figIndex < figures.size(); ++figIndex)
+        {
+            figBytes[figIndex] = EstimateFigureMemorySize( FindFigureObservables( figures[figIndex], observables ),
+                                                           FindFigureModels( figures[figIndex], loadModels ).size(), observables );
+            maxFigBytes = std::max( maxFigBytes, figBytes[figIndex] );
+        }
+
+        writer.SetQueueLimit( maxFigBytes );
+    }
+
+    BeginImageExport( imageExport );
+
+    // load the model data for each model and observable used by a figure, and write the observables histograms
+    // (not owned by the writer, as they are the sources of the figure banks)
+    store.Load( [&]( const TH1DVector & data )
+    {
+        LogMsgHistUnderOverflow( ToConstTH1DVector(data) );
+        writer.Write( data, false );   // streamed on return, so the store may release or delete them
+    });
+
+    // with a memory budget, order the figures to reuse the models in memory
+    std::vector<size_t> figOrder;
+    if (store.IsBounded())
+        figOrder = ScheduleFigures( figures, loadModels );
+    else
+    {
+        for (size_t figIndex = 0; figIndex < figures.size(); ++figIndex)
+            figOrder.push_back( figIndex );
+    }
+
+    // for each figure
+
+    for ( size_t figIndex : figOrder )
+    {
+        const FigureSetup & figSetup = figures[figIndex];
+
+        // select figure models and data
+
+        std::vector<size_t> figModelIndex = FindFigureModels( figSetup, loadModels );
+        std::vector<size_t> figObs        = FindFigureObservables( figSetup, observables );
+
+        ModelFileVector figModels;  // figModels[model]
+        for ( size_t modelIndex : figModelIndex )
+            figModels.push_back( loadModels[ modelIndex ] );
+
+        store.Require( figModelIndex, figBytes[figIndex] + maxFigBytes );
+
+        // copy the bin contents of the figure models into the bank
+        std::vector<const HistBank *> figData;  // figData[model]
+        for ( size_t modelIndex : figModelIndex )
+            figData.push_back( &store.modelBank[ modelIndex ] );
+
+        HistBank figBank = HistBank::Join( figData );
+
+        // adjust for luminosity
+        if (figSetup.luminosity > 0)
+        {
+            double luminosity = figSetup.luminosity;  // fb^-1
+
+            std::vector<double> scales;
+            for ( size_t modelIndex : figModelIndex )
+                scales.push_back( luminosity * store.unitScale[modelIndex] );
+
+            figBank.Scale( scales, figSetup.entryScaling );
+        }
+
+        // calculate the comparisons for all observables
+        HistBank figRatio = figBank.Ratio( 0 );
+
+        // Make the histograms of the figure observables, calculate the figure statistics in parallel,
+        // then draw and write the figures in observable order.
+        // Only the statistics are parallel, as ROOT object creation, drawing and I/O are not thread-safe.
+
+        const size_t nObs = observables.size();
+
+        std::vector<TH1DVector>             obsData( nObs );    // obsData[obs][model], only needed for drawing
+        std::vector<TH1DVector>             obsComp( nObs );    // obsComp[obs][model - 1]
+        std::vector< TH1DUniquePtr >        tempHists;
+
+        for (size_t obsIndex : figObs)
+        {
+            obsData[obsIndex] = figBank.MakeHists( obsIndex );
+            for (TH1D * pHist : obsData[obsIndex])
+                tempHists.emplace_back( pHist );
+
+            CalculateCompareHists( observables[obsIndex], obsIndex, figRatio, obsComp[obsIndex], figModels, figSetup.colors );
+        }
+
+        // determine which figures are unchanged since the previous output, and can be copied from it
+
+        std::vector<std::string>    figNames( nObs );   // figNames[obs]
+        std::vector<bool>           figReuse( nObs );   // figReuse[obs]
+        std::vector<size_t>         figUpdate;          // observables of the figures to draw
+        std::vector<size_t>         figCalc;            // observables of the figure statistics, also reused with a summary
+
+        for (size_t obsIndex : figObs)
+        {
+            const TH1DVector & comp = obsComp[obsIndex];
+
+            std::string figName  = "fig_" + std::string(comp[0]->GetName());
+            std::string figTitle = comp[0]->GetTitle();
+
+            std::string hash = GetFigureHash( figName, figTitle, obsData[obsIndex], figSetup, imageExport, figureOutput );
+            figureHashes += figName + "\t" + hash + "\n";
+
+            auto itr = prevHashes.find( figName );
+
+            bool bReuse = upPrevFile && (itr != prevHashes.end()) && (itr->second == hash);
+            if (bReuse && (figureOutput & kFigureOutputCanvas))
+                bReuse = (upPrevFile->FindKey( figName.c_str() ) != nullptr);
+            if (bReuse && (figureOutput & kFigureOutputDescriptor))
+                bReuse = (upPrevFile->FindKey( (figName + FigureDescriptorSuffix).c_str() ) != nullptr);
+
+            figNames[obsIndex] = figName;
+            figReuse[obsIndex] = bReuse;
+
+            if (!bReuse)
+                figUpdate.push_back( obsIndex );
+            if (!bReuse || upSummary)
+                figCalc.push_back( obsIndex );
+        }
+
+        nFigReused  += figObs.size() - figUpdate.size();
+        nFigUpdated += figUpdate.size();
+
+        // The statistics of all updated figures, and with a summary of the reused figures too, are calculated together,
+        // in the stages of CompareFigureStatsTasks, each distributed over all its tasks: (observable, mask),
+        // (observable, pair), (observable, pair, toy block).
+
+        std::vector<CompareFigureStats> obsStats( nObs );   // obsStats[obs], only of figCalc
+        {
+            std::vector< std::unique_ptr<CompareFigureStatsTasks> > obsTasks( nObs );
+
+            std::vector< std::pair<size_t, size_t> > masks;     // (obs, mask)
+            std::vector< std::pair<size_t, size_t> > pairs;     // (obs, pair)
+
+            for (size_t obsIndex : figCalc)
+            {
+                ConstTH1DVector constData = ToConstTH1DVector(obsData[obsIndex]);
+
+                obsTasks[obsIndex].reset( new CompareFigureStatsTasks( constData, ToConstTH1DVector(obsComp[obsIndex]), constData, figSetup.toys ) );
+
+                for (size_t mask = 0; mask < obsTasks[obsIndex]->MaskCount(); ++mask)
+                    masks.push_back( { obsIndex, mask } );
+
+                for (size_t pair = 0; pair < obsTasks[obsIndex]->PairCount(); ++pair)
+                    pairs.push_back( { obsIndex, pair } );
+            }
+
+            ParallelFor( masks.size(), [&]( size_t index )
+            {
+                obsTasks[ masks[index].first ]->CalculateMask( masks[index].second );
+            });
+
+            ParallelFor( pairs.size(), [&]( size_t index )
+            {
+                obsTasks[ pairs[index].first ]->CalculatePair( pairs[index].second );
+            });
+
+            struct ToyBlock { size_t obs, pair, block; };
+            std::vector<ToyBlock> blocks;
+
+            for (const std::pair<size_t, size_t> & pair : pairs)
+            {
+                for (size_t block = 0; block < obsTasks[ pair.first ]->ToyBlockCount( pair.second ); ++block)
+                    blocks.push_back( { pair.first, pair.second, block } );
+            }
+
+            ParallelFor( blocks.size(), [&]( size_t index )
+            {
+                obsTasks[ blocks[index].obs ]->CalculateToyBlock( blocks[index].pair, blocks[index].block );
+            });
+
+            for (size_t obsIndex : figCalc)
+                obsStats[obsIndex] = obsTasks[obsIndex]->Finish();
+        }
+
+        for (size_t obsIndex : figObs)
+        {
+            const TH1DVector & comp = obsComp[obsIndex];
+
+            const std::string & figName  = figNames[obsIndex];
+            std::string         figTitle = comp[0]->GetTitle();
+
+            if (upSummary)     // also of a reused figure
+            {
+                const CompareFigureStats & stats = obsStats[obsIndex];
+
+                for (size_t i = 0; i < comp.size(); ++i)
+                {
+                    CompareSummaryRecord record;
+                    record.figure       = figName;
+                    record.observable   = observables[obsIndex].name;
+                    record.baseModel    = figModels[0].modelName;
+                    record.compModel    = figModels[i + 1].modelName;
+                    record.luminosity   = figSetup.luminosity;
+                    record.stats        = stats.pairStats[i];
+                    record.toys         = stats.pairToys[i];
+                    record.ratioBins    = stats.goodBadCompare[i];
+
+                    upSummary->Write( record );
+                }
+            }
+
+            if (figReuse[obsIndex])
+            {
+                // the comparison hists are cheap, so are written new; the figure is copied
+                writer.Write( comp );
+
+                if (figureOutput & kFigureOutputCanvas)
+                    writer.Write( upPrevFile->Get( figName.c_str() ) );
+
+                if (figureOutput & kFigureOutputDescriptor)
+                {
+                    std::string key = figName + FigureDescriptorSuffix;
+                    writer.Write( upPrevFile->Get( key.c_str() ), key.c_str() );
+                }
+
+                continue;
+            }
+
+            LogCompareFigureStats( obsStats[obsIndex] );    // in observable order
+
+            // with entry scaling, the figure statistics must be those of the luminosity scans at the figure
+            // luminosity (see "Luminosity scaling" in ModelCompare.h)
+            if (s_figureStatsCheck && figBank.entryScaled && !figBank.IsFloat( obsIndex ))
+            {
+                const CompareFigureStats & stats     = obsStats[obsIndex];
+                const double               tolerance = 1E-6;
+
+                TH1DUniquePtr upBase( store.modelBank[ figModelIndex[0] ].MakeHist( obsIndex, 0 ) );   // unscaled
+
+                for (size_t i = 0; i < comp.size(); ++i)
+                {
+                    TH1DUniquePtr upComp( store.modelBank[ figModelIndex[i + 1] ].MakeHist( obsIndex, 0 ) );
+
+                    CompareStats check = CalculateCompareStats( *upBase, *upComp, figBank.modelScale[0], figBank.modelScale[i + 1] );
+
+                    if (!IsSameCompareStats( stats.pairStats[i], check, tolerance ))
+                    {
+                        LogMsgError( "%hs: figure statistics (%hs) differ from CalculateCompareStats (%hs)",
+                                     FMT_HS(comp[i]->GetName()),
+                                     FMT_HS(GetCompareStatsString( stats.pairStats[i] ).c_str()),
+                                     FMT_HS(GetCompareStatsString( check ).c_str()) );
+                    }
+                }
+            }
+
+            ConstTH1DVector constData = ToConstTH1DVector(obsData[obsIndex]);
+            ConstTH1DVector constComp = ToConstTH1DVector(comp);
+
+            // write the comparison hist, once no longer needed here
+            // (the writer deletes them once streamed)
+            std::vector<TObject *> figObjects( comp.cbegin(), comp.cend() );
+
+            if ((figureOutput & kFigureOutputCanvas) || imageExport.IsEnabled())
+            {
+                std::unique_ptr<TCanvas> pCanvas( MakeCompareFigure( figName.c_str(), figTitle.c_str(), constData, constComp,
+                                                                     figSetup.colors, obsStats[obsIndex] ) );
+
+                // export images, the worker renders its own copy of the canvas
+                {
+                    std::unique_lock<std::mutex> pause = writer.Pause();    // no write in progress while forking
+                    ExportPadImages( *pCanvas, figName.c_str(), imageExport );
+                }
+
+                if (figureOutput & kFigureOutputCanvas)
+                    figObjects.push_back( pCanvas.release() );
+            }
+
+            // the figure data are the stored observable histograms scaled by the bank's model scales
+            std::unique_ptr<TObjString> pDescriptor;
+            if (figureOutput & kFigureOutputDescriptor)
+                pDescriptor.reset( MakeCompareFigureDescriptor( figTitle.c_str(), constData, figBank.modelScale, constComp, figSetup.colors, obsStats[obsIndex], figBank.entryScaled ) );
+
+            for (TObject * pObject : figObjects)
+                writer.Write( pObject );
+
+            if (pDescriptor)
+                writer.Write( pDescriptor.release(), (figName + FigureDescriptorSuffix).c_str() );
+        }
+    }
+
+    LogMsgInfo( "Figures: %u updated, %u unchanged", FMT_U(nFigUpdated), FMT_U(nFigReused) );
+    LogMsgInfo( "Model histograms and figure working set: %u bytes peak in memory", FMT_U(store.PeakSize()) );
+
+    writer.Write( new TObjString( figureHashes.c_str() ), FigureHashesKey );
+
+    EndImageExport();
+
+    //upOutputFile->Write( 0, TFile::kOverwrite );
+    writer.Close();
+
+    if (upPrevFile)
+    {
+        upPrevFile->Close();
+        upPrevFile.reset();
+    }
+
+    if (!prevFileName.empty())
+        gSystem->Unlink( prevFileName.c_str() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace ModelCompare
@@ -0,0 +1,80 @@
+//
+//  ModelCompareDraw.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef MODEL_COMPARE_DRAW_H
+#define MODEL_COMPARE_DRAW_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+#include "ImageExport.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// forward declarations
+
+class TCanvas;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The figure drawing, using the ROOT graphics libraries.
+// The loading, filling, caching and statistics are in ModelCompare.h, which does not need them.
+
+void WriteCompareFigure( const char * name, const char * title,
+                         const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                         const RootUtil::ColorVector & dataColors,
+                         const RootUtil::ConstTH1DVector & rawData,
+                         const RootUtil::ToyConfig & toys = RootUtil::ToyConfig() );
+
+void WriteCompareFigure( const char * name, const char * title,
+                         const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                         const RootUtil::ColorVector & dataColors,
+                         const CompareFigureStats & stats,
+                         const RootUtil::ImageExport & imageExport = RootUtil::ImageExport(),
+                         UInt_t figureOutput = kFigureOutputCanvas );
+
+TCanvas * MakeCompareFigure( const char * name, const char * title,
+                             const RootUtil::ConstTH1DVector & data, const RootUtil::ConstTH1DVector & compare,
+                             const RootUtil::ColorVector & dataColors,
+                             const CompareFigureStats & stats );    // caller takes ownership
+
+// Rebuild the canvas of a figure from its descriptor. Caller takes ownership.
+TCanvas * LoadCompareFigure( const char * fileName, const char * name );
+
+// Debug check of the statistics of each figure with FigureSetup::entryScaling against CalculateCompareStats,
+// logging an error if they differ.
+// Rebuilds the histograms and recalculates the statistics serially, outside the memory budget (see ModelStore.h).
+// Observables with kHistStorageFloat are not checked, as the rounding of the stored bins may change the good bins.
+bool GetFigureStatsCheck();
+void SetFigureStatsCheck( bool bCheck );    // false by default
+
+// Optionally also export the figures to image files (see ImageExport),
+// select how the figures are stored in the output file (see FigureOutput),
+// and append the figure statistics to a summary file (see CompareSummaryWriter).
+// With kFigureOutputIncremental and a summary, the statistics of the unchanged figures are still
+// calculated for the summary, but the figures are not drawn again.
+void ModelCompare( const char * outputFileName,
+                   const ModelFileVector & models, const ObservableVector & observables,
+                   const FigureSetupVector & figures,
+                   const char * cacheFileName = nullptr,
+                   const RootUtil::ImageExport & imageExport = RootUtil::ImageExport(),
+                   UInt_t figureOutput = kFigureOutputCanvas,
+                   const char * summaryFileName = nullptr );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
+
+#endif // MODEL_COMPARE_DRAW_H
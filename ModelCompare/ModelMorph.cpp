@@ -0,0 +1,440 @@
+//
+//  ModelMorph.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "ModelMorph.h"
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+
+// Root includes
+#include <TFile.h>
+#include <TH1.h>
+#include <TProfile.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace RootUtil;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+static std::vector<double> GetLagrangePolynomials( const std::vector<double> & points )
+{
+    // Return the power series coefficients of the Lagrange basis polynomials
+    //      L_j(x) = prod_{k != j} (x - x_k) / (x_j - x_k)
+    // as result[j * n + power], where n is the number of points.
+
+    const size_t n = points.size();
+
+    std::vector<double> result( n * n, 0.0 );
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        double * poly = &result[j * n];
+        poly[0] = 1;
+
+        size_t degree = 0;
+        for (size_t k = 0; k < n; ++k)
+        {
+            if (k == j)
+                continue;
+
+            double denom = points[j] - points[k];
+            if (denom == 0)
+                ThrowError( "GetLagrangePolynomials: points must be distinct." );
+
+            // poly *= (x - x_k) / denom
+            ++degree;
+            for (size_t power = degree; power > 0; --power)
+                poly[power] = (poly[power - 1] - points[k] * poly[power]) / denom;
+            poly[0] = -points[k] * poly[0] / denom;
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static std::vector<double> GetLagrangeWeights( const std::vector<double> & points, double x )
+{
+    // Return L_j(x) for each point j
+    std::vector<double> result( points.size(), 1.0 );
+
+    for (size_t j = 0; j < points.size(); ++j)
+    {
+        for (size_t k = 0; k < points.size(); ++k)
+        {
+            if (k != j)
+                result[j] *= (x - points[k]) / (points[j] - points[k]);
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static inline Double_t EvalPolynomial( const Double_t * coef, size_t nCoef, double x )
+{
+    // Horner's method
+    Double_t result = 0;
+    for (size_t power = nCoef; power > 0; --power)
+        result = result * x + coef[power - 1];
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HistMorph::HistMorph( const ConstTH1DVector & basisHists, const std::vector<double> & basisScales,
+                      const std::vector<double> & basisCoefficients )
+{
+    nTerms = basisHists.size();
+
+    if ((nTerms < 2) || (basisScales.size() != nTerms) || (basisCoefficients.size() != nTerms))
+        ThrowError( "HistMorph: at least two basis histograms, with scales and coefficients, are required." );
+
+    std::vector<HistBinView> views;
+    for (const TH1D * pHist : basisHists)
+    {
+        if (!pHist)
+            ThrowError( "HistMorph: undefined basis histogram." );
+
+        views.push_back( HistBinView( *pHist ) );
+    }
+
+    nSize    = views[0].nSize;
+    bProfile = (views[0].pProfile != nullptr);
+
+    for (const HistBinView & view : views)
+    {
+        if (view.nSize != nSize)
+            ThrowError( "HistMorph: basis histogram size mismatch." );
+        if ((view.pProfile != nullptr) != bProfile)
+            ThrowError( "HistMorph: basis histograms must all be TH1D or TProfile." );
+        if (bProfile && !view.pSumw2)
+            ThrowError( "HistMorph: TProfile basis histograms must have sumw2 enabled." );
+    }
+
+    // linear terms: sum_j L_j(c) * s_j * A_j
+    // quadratic terms (variances): sum_j L_j(c)^2 * s_j^2 * V_j
+
+    const size_t nLinear = nTerms;
+    const size_t nQuad   = 2 * nTerms - 1;
+
+    std::vector<double> linear = GetLagrangePolynomials( basisCoefficients );   // linear[j * nLinear + power]
+
+    std::vector<double> quad( nTerms * nQuad, 0.0 );                            // quad[j * nQuad + power]
+    for (size_t j = 0; j < nTerms; ++j)
+        for (size_t k = 0; k < nLinear; ++k)
+            for (size_t l = 0; l < nLinear; ++l)
+                quad[j * nQuad + k + l] += linear[j * nLinear + k] * linear[j * nLinear + l];
+
+    auto AddLinear = [&]( std::vector<Double_t> & coef, Int_t bin, size_t j, Double_t value ) -> void
+    {
+        for (size_t power = 0; power < nLinear; ++power)
+            coef[bin * nLinear + power] += linear[j * nLinear + power] * basisScales[j] * value;
+    };
+
+    auto AddQuad = [&]( std::vector<Double_t> & coef, Int_t bin, size_t j, Double_t value ) -> void
+    {
+        for (size_t power = 0; power < nQuad; ++power)
+            coef[bin * nQuad + power] += quad[j * nQuad + power] * basisScales[j] * basisScales[j] * value;
+    };
+
+    sumw.assign( nSize * nLinear, 0.0 );
+
+    if (!bProfile)
+    {
+        sumw2.assign( nSize * nQuad, 0.0 );
+
+        for (size_t j = 0; j < nTerms; ++j)
+        {
+            const HistBinView & view = views[j];
+
+            for (Int_t bin = 0; bin < nSize; ++bin)
+            {
+                AddLinear( sumw,  bin, j, view.pSumw[bin]       );
+                AddQuad(   sumw2, bin, j, view.ErrorSqr( bin )  );
+            }
+        }
+    }
+    else
+    {
+        // TProfile sums: sumw = sum(w*y), sumw2 = sum(w*y^2), binEntries = sum(w), binSumw2 = sum(w^2)
+
+        sumw2     .assign( nSize * nLinear, 0.0 );
+        binEntries.assign( nSize * nLinear, 0.0 );
+        binSumw2  .assign( nSize * nQuad,   0.0 );
+
+        for (size_t j = 0; j < nTerms; ++j)
+        {
+            const HistBinView & view = views[j];
+
+            for (Int_t bin = 0; bin < nSize; ++bin)
+            {
+                AddLinear( sumw,       bin, j, view.pSumw[bin]       );
+                AddLinear( sumw2,      bin, j, view.pSumw2[bin]      );
+                AddLinear( binEntries, bin, j, view.pBinEntries[bin] );
+                AddQuad(   binSumw2,   bin, j, view.pBinSumw2 ? view.pBinSumw2[bin] : view.pBinEntries[bin] );
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HistMorph::MorphHist( double coefficient, double scale, TH1D & hist ) const
+{
+    HistBinArrays arrays( hist );
+
+    if ((arrays.nSize != nSize) || (arrays.bProfile != bProfile))
+        ThrowError( "HistMorph: histogram does not match the basis histograms." );
+    if (!arrays.pSumw2 || (bProfile && !arrays.pBinSumw2))
+        ThrowError( "HistMorph: histogram must have sumw2 enabled." );
+
+    const size_t   nLinear    = nTerms;
+    const size_t   nQuad      = 2 * nTerms - 1;
+    const Double_t scaleSqr   = scale * scale;
+
+    for (Int_t bin = 0; bin < nSize; ++bin)
+    {
+        arrays.pSumw[bin] = scale * EvalPolynomial( &sumw[bin * nLinear], nLinear, coefficient );
+
+        if (!bProfile)
+        {
+            arrays.pSumw2[bin] = scaleSqr * EvalPolynomial( &sumw2[bin * nQuad], nQuad, coefficient );
+        }
+        else
+        {
+            arrays.pSumw2[bin]      = scale    * EvalPolynomial( &sumw2     [bin * nLinear], nLinear, coefficient );
+            arrays.pBinEntries[bin] = scale    * EvalPolynomial( &binEntries[bin * nLinear], nLinear, coefficient );
+            arrays.pBinSumw2[bin]   = scaleSqr * EvalPolynomial( &binSumw2  [bin * nQuad],   nQuad,   coefficient );
+        }
+    }
+
+    hist.ResetStats();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelMorph::ModelMorph( const ModelFileVector & basisModels, const std::vector<double> & basisCoefficients,
+                        const std::vector<TH1DVector> & basisHists )
+  : basisModels(basisModels), basisCoefficients(basisCoefficients)
+{
+    if ((basisHists.size() != basisModels.size()) || (basisCoefficients.size() != basisModels.size()))
+        ThrowError( "ModelMorph: basis models, coefficients, and histograms must have the same size." );
+    if (basisModels.empty())
+        ThrowError( "ModelMorph: no basis models." );
+
+    // normalize each basis to expected events for 1 fb^-1
+    std::vector<double> basisScales = GetUnitLuminosityScales( basisModels, basisHists );
+
+    nEvents = (size_t)basisHists[0][0]->GetEntries();
+
+    const size_t nObs = basisHists[0].size();
+    for (size_t obsIndex = 0; obsIndex < nObs; ++obsIndex)
+    {
+        ConstTH1DVector obsHists;   // obsHists[model]
+        for (const TH1DVector & data : basisHists)
+            obsHists.push_back( data.at(obsIndex) );
+
+        obsMorph.push_back( HistMorph( obsHists, basisScales, basisCoefficients ) );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double ModelMorph::CrossSection( double coefficient ) const
+{
+    std::vector<double> weights = GetLagrangeWeights( basisCoefficients, coefficient );
+
+    double result = 0;
+    for (size_t j = 0; j < basisModels.size(); ++j)
+        result += weights[j] * basisModels[j].crossSection;
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double ModelMorph::CrossSectionError( double coefficient ) const
+{
+    std::vector<double> weights = GetLagrangeWeights( basisCoefficients, coefficient );
+
+    double result = 0;
+    for (size_t j = 0; j < basisModels.size(); ++j)
+        result += weights[j] * weights[j] * basisModels[j].crossSectionError * basisModels[j].crossSectionError;
+
+    return std::sqrt(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelFile ModelMorph::MakeModel( double coefficient, const char * modelName, const char * modelTitle ) const
+{
+    return ModelFile( "", modelName, modelTitle, CrossSection(coefficient), CrossSectionError(coefficient), nEvents );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1DVector ModelMorph::MakeHists( double coefficient, const ObservableVector & observables,
+                                  const char * modelName, const char * modelTitle ) const
+{
+    if (observables.size() != obsMorph.size())
+        ThrowError( "ModelMorph: observable count mismatch." );
+
+    TH1DVector hists;
+
+    for (const Observable & obs : observables)
+        hists.push_back( obs.MakeHist( modelName, modelTitle ) );
+
+    MorphHists( coefficient, hists );
+
+    return hists;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelMorph::MorphHists( double coefficient, const TH1DVector & hists ) const
+{
+    if (hists.size() != obsMorph.size())
+        ThrowError( "ModelMorph: histogram count mismatch." );
+
+    double crossSection = CrossSection( coefficient ) * 1000;  // fb
+    if (crossSection <= 0)
+        ThrowError( "ModelMorph: non-positive cross section for coefficient " + std::to_string(coefficient) );
+
+    // normalize to nEvents events of the morphed model; this changes the event weights, not the luminosity,
+    // so keeps the effective entries (luminosity scales are applied later, see "Luminosity scaling")
+    double scale = nEvents / crossSection;
+
+    for (size_t obsIndex = 0; obsIndex < hists.size(); ++obsIndex)
+    {
+        TH1D * pHist = hists[obsIndex];
+
+        obsMorph[obsIndex].MorphHist( coefficient, scale, *pHist );
+
+        pHist->SetEntries( (Double_t)nEvents );    // for GetLuminosityScale
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelMorph LoadModelMorph( const ModelFileVector & models, const ObservableVector & observables, const MorphBasisVector & basis,
+                           const char * cacheFileName /*= nullptr*/ )
+{
+    ModelFileVector     basisModels;
+    std::vector<double> basisCoefficients;
+
+    for (const MorphBasis & b : basis)
+    {
+        auto MatchModelName = [&b](const ModelFile & elem) -> bool { return strcmp(elem.modelName, b.modelName) == 0; };
+
+        auto itr = std::find_if( models.cbegin(), models.cend(), MatchModelName );
+        if (itr == models.cend())
+            ThrowError( std::invalid_argument("Model " + std::string(b.modelName) + " not found.") );
+
+        basisModels      .push_back( *itr );
+        basisCoefficients.push_back( b.coefficient );
+    }
+
+    std::vector<TH1DVector> basisHists;     // basisHists[model][observable]
+    LoadHistData( basisModels, observables, basisHists, cacheFileName );
+
+    std::vector< TH1DUniquePtr > ownHists;  // basis histograms are not needed after construction
+    for ( const TH1DVector & data : basisHists )
+        for ( TH1D * pHist : data )
+            ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    return ModelMorph( basisModels, basisCoefficients, basisHists );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CoefficientScan( const char * outputFileName,
+                      const ModelFileVector & models, const ObservableVector & observables,
+                      const char * baseModelName, const MorphBasisVector & basis,
+                      const std::vector<double> & coefficients, double luminosity,
+                      const char * cacheFileName /*= nullptr*/ )
+{
+    // Compare the morphed model at each coefficient against the base model at the given luminosity,
+    // and write the p-values of CalculateCompareStats as graphs of p-value vs. coefficient.
+    // One set of morphed histograms is updated in place for each coefficient.
+
+    // disable automatic histogram addition to current directory
+    TH1::AddDirectory(kFALSE);
+    // enable automatic sumw2 for every histogram
+    TH1::SetDefaultSumw2(kTRUE);
+
+    if (coefficients.empty())
+        ThrowError( "CoefficientScan: no coefficients." );
+    if (luminosity <= 0)
+        ThrowError( "CoefficientScan: luminosity must be positive." );
+
+    LogMsgInfo( "Output file: %hs", FMT_HS(outputFileName) );
+    std::unique_ptr<TFile> upOutputFile( new TFile( outputFileName, "RECREATE" ) );
+    if (upOutputFile->IsZombie() || !upOutputFile->IsOpen())    // IsZombie is true if constructor failed
+    {
+        LogMsgError( "Failed to create output file (%hs).", FMT_HS(outputFileName) );
+        ThrowError( std::invalid_argument( outputFileName ) );
+    }
+
+    // load the base model
+
+    ModelFileVector baseModels = SelectLoadModels( models, { FigureSetup( { baseModelName } ) } );
+
+    std::vector<TH1DVector> baseData;   // baseData[0][observable]
+    LoadHistData( baseModels, observables, baseData, cacheFileName );
+
+    std::vector< TH1DUniquePtr > ownHists;
+    for ( TH1D * pHist : baseData[0] )
+        ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    const double baseScale = GetLuminosityScale( luminosity, baseModels[0], baseData[0] );
+
+    // setup the morph
+
+    ModelMorph morph = LoadModelMorph( models, observables, basis, cacheFileName );
+
+    TH1DVector morphHists = morph.MakeHists( coefficients[0], observables, "morph", "Morph" );
+    for ( TH1D * pHist : morphHists )
+        ownHists.push_back( TH1DUniquePtr(pHist) );
+
+    std::vector<CompareStatsGraphs> graphs;  // graphs[observable]
+    for ( const Observable & obs : observables )
+    {
+        std::string name  = "scan_morph_vs_" + std::string(baseModels[0].modelName) + "_" + obs.name;
+        std::string title = "Morph vs " + std::string(baseModels[0].modelTitle) + " - " + obs.title;
+
+        graphs.emplace_back( name, title, coefficients.size(), "Coefficient" );
+    }
+
+    // scan
+
+    for (size_t index = 0; index < coefficients.size(); ++index)
+    {
+        double coefficient = coefficients[index];
+
+        morph.MorphHists( coefficient, morphHists );
+
+        ModelFile morphModel = morph.MakeModel( coefficient, "morph", "Morph" );
+
+        const double morphScale = GetLuminosityScale( luminosity, morphModel, morphHists );
+
+        for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+        {
+            CompareStats stats = CalculateCompareStats( *baseData[0][obsIndex], *morphHists[obsIndex], baseScale, morphScale );
+
+            graphs[obsIndex].SetPoint( index, coefficient, stats );
+
+            LogMsgInfo( "%hs c = %g: %hs", FMT_HS(observables[obsIndex].name), FMT_F(coefficient), FMT_HS(GetCompareStatsString(stats).c_str()) );
+        }
+    }
+
+    for (const CompareStatsGraphs & obsGraphs : graphs)
+        obsGraphs.Write( upOutputFile.get() );
+
+    upOutputFile->Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace ModelCompare
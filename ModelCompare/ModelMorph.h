@@ -0,0 +1,119 @@
+//
+//  ModelMorph.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef MODEL_MORPH_H
+#define MODEL_MORPH_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// forward declarations
+
+class TH1D;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Morphing of a single operator coefficient c.
+//
+// Each bin of the morphed histogram is a polynomial in c, e.g. for three basis samples
+//      h(c) = h_SM + c * h_lin + c^2 * h_quad
+// The polynomial is determined exactly from basis samples at distinct coefficient values
+// (e.g. SM at c = 0, and EFT samples at two non-zero values of c).
+// The basis samples are statistically independent, so sumw2 is propagated as
+//      sumw2(c) = sum_i w_i(c)^2 * sumw2_i
+// where w_i(c) are the Lagrange weights of the basis samples.
+
+struct MorphBasis
+{
+    const char *    modelName;      // name of a ModelFile
+    double          coefficient;    // operator coefficient of the model
+};
+
+typedef std::vector<MorphBasis> MorphBasisVector;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// morphing of a single observable histogram
+struct HistMorph
+{
+    Int_t                   nSize       = 0;        // number of bins, including under/overflow
+    size_t                  nTerms      = 0;        // number of basis samples (polynomial degree + 1)
+    bool                    bProfile    = false;
+
+    // per bin polynomial coefficients [bin * nTerms + power], normalized to cross section (pb)
+    // linear sums have nTerms coefficients, quadratic sums have 2 * nTerms - 1 coefficients
+    std::vector<Double_t>   sumw;           // linear
+    std::vector<Double_t>   sumw2;          // TH1D: quadratic, TProfile: linear
+    std::vector<Double_t>   binEntries;     // TProfile only, linear
+    std::vector<Double_t>   binSumw2;       // TProfile only, quadratic
+
+    HistMorph() = default;
+    HistMorph( const RootUtil::ConstTH1DVector & basisHists, const std::vector<double> & basisScales,
+               const std::vector<double> & basisCoefficients );
+
+    // Set the histogram bin sums to the morphed values for coefficient, scaled by scale.
+    // The histogram must have the same type and binning as the basis histograms.
+    void MorphHist( double coefficient, double scale, TH1D & hist ) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// morphing of a model for all observables
+struct ModelMorph
+{
+    ModelFileVector         basisModels;
+    std::vector<double>     basisCoefficients;
+    std::vector<HistMorph>  obsMorph;       // obsMorph[observable]
+    size_t                  nEvents = 0;    // number of events of each morphed histogram
+
+    ModelMorph() = default;
+    ModelMorph( const ModelFileVector & basisModels, const std::vector<double> & basisCoefficients,
+                const std::vector<RootUtil::TH1DVector> & basisHists );   // basisHists[model][observable]
+
+    double CrossSection(      double coefficient ) const;   // in pb
+    double CrossSectionError( double coefficient ) const;   // in pb
+
+    // The returned ModelFile has no event file. The name and title are not copied,
+    // so they must persist for the lifetime of the returned object.
+    ModelFile MakeModel( double coefficient, const char * modelName, const char * modelTitle ) const;
+
+    // Make new histograms (caller takes ownership), or update existing histograms for a new coefficient.
+    // The morphed histograms are normalized to nEvents events of the model returned by MakeModel.
+    RootUtil::TH1DVector MakeHists( double coefficient, const ObservableVector & observables,
+                                    const char * modelName, const char * modelTitle ) const;
+    void                 MorphHists( double coefficient, const RootUtil::TH1DVector & hists ) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+ModelMorph LoadModelMorph( const ModelFileVector & models, const ObservableVector & observables, const MorphBasisVector & basis,
+                           const char * cacheFileName = nullptr );
+
+void CoefficientScan( const char * outputFileName,
+                      const ModelFileVector & models, const ObservableVector & observables,
+                      const char * baseModelName, const MorphBasisVector & basis,
+                      const std::vector<double> & coefficients, double luminosity,
+                      const char * cacheFileName = nullptr );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif // MODEL_MORPH_H
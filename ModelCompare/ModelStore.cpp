@@ -0,0 +1,343 @@
+//
+//  ModelStore.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "ModelStore.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <TH1.h>
+#include <TProfile.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace RootUtil;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t s_modelMemoryBudget = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+size_t GetModelMemoryBudget()
+{
+    return s_modelMemoryBudget;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SetModelMemoryBudget( size_t bytes )
+{
+    s_modelMemoryBudget = bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t GetHistMemorySize( const TH1D & hist )
+{
+    if (IsHistBinsReleased( hist ))
+        return 0;
+
+    HistBinView view( hist );
+
+    size_t nArrays = 1;
+    if (view.pSumw2)
+        ++nArrays;
+    if (view.pBinEntries)
+        ++nArrays;
+    if (view.pBinSumw2)
+        ++nArrays;
+
+    return nArrays * (size_t)view.nSize * sizeof(Double_t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t EstimateFigureMemorySize( const std::vector<size_t> & figObs, size_t nModels, const ObservableVector & observables )
+{
+    const size_t nCompare = nModels ? nModels - 1 : 0;
+
+    size_t bankBytes = 0;   // one bank of the figure models
+    size_t histBytes = 0;   // data and comparison histograms of all observables
+    size_t drawBytes = 0;   // drawn copies of the largest figure
+
+    for (size_t obsIndex : figObs)
+    {
+        const Observable & obs   = observables[obsIndex];
+        const size_t       nSize = (size_t)obs.nBins + 2;   // including under/overflow
+
+        const size_t valueSize = (obs.storage & kHistStorageFloat) ? sizeof(Float_t) : sizeof(Double_t);
+        bankBytes += 2 * nModels * nSize * valueSize;  // content and error^2
+
+        // a TProfile has 4 bin arrays, a TH1D 2
+        const size_t figBytes = (4 * nModels + 2 * nCompare) * nSize * sizeof(Double_t);
+        histBytes += figBytes;
+
+        // each histogram is drawn as a copy, with a copy of its bad bins
+        drawBytes = std::max( drawBytes, 2 * figBytes );
+    }
+
+    return 2 * bankBytes + histBytes + drawBytes;  // figure and ratio banks
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<size_t> ScheduleFigures( const FigureSetupVector & figures, const ModelFileVector & loadModels )
+{
+    // greedy: the next figure is the first one sharing the most models with the previous figure
+
+    std::vector< std::vector<size_t> > figModels;  // figModels[figure]
+    for (const FigureSetup & figSetup : figures)
+        figModels.push_back( FindFigureModels( figSetup, loadModels ) );
+
+    std::vector<size_t> order;
+    std::vector<bool>   done( figures.size(), false );
+    std::vector<bool>   previous( loadModels.size(), false );  // previous[model], used by the previous figure
+
+    while (order.size() < figures.size())
+    {
+        size_t best       = figures.size();
+        size_t bestShared = 0;
+
+        for (size_t figIndex = 0; figIndex < figures.size(); ++figIndex)
+        {
+            if (done[figIndex])
+                continue;
+
+            size_t shared = 0;
+            for (size_t model : figModels[figIndex])
+                shared += previous[model] ? 1 : 0;
+
+            if ((best == figures.size()) || (shared > bestShared))
+            {
+                best       = figIndex;
+                bestShared = shared;
+            }
+        }
+
+        order.push_back( best );
+        done[best] = true;
+
+        previous.assign( loadModels.size(), false );
+        for (size_t model : figModels[best])
+            previous[model] = true;
+    }
+
+    return order;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelStore::ModelStore( const ModelFileVector & loadModels, const ObservableVector & observables, const ObsSelection & select,
+                        const char * cacheFileName, size_t budget, const std::vector<UInt_t> * pBankStorage /*= nullptr*/ )
+  : loadModels(loadModels), observables(observables), select(select),
+    cacheFileName(cacheFileName ? cacheFileName : ""), budget(budget), pBankStorage(pBankStorage)
+{
+    if (select.size() != loadModels.size())
+        ThrowError( "ModelStore: selection count mismatch." );
+
+    if (pBankStorage && (pBankStorage->size() != observables.size()))
+        ThrowError( "ModelStore: storage count mismatch." );
+
+    if (!budget)
+        return;
+
+    if (this->cacheFileName.empty())
+        ThrowError( "ModelStore: a memory budget requires a cache file." );
+
+    for (size_t obsIndex = 0; obsIndex < observables.size(); ++obsIndex)
+    {
+        if (!observables[obsIndex].IsAutoRange())
+            continue;
+
+        for (const std::vector<bool> & modelSelect : select)
+        {
+            if (modelSelect[obsIndex])
+                ThrowError( "ModelStore: auto-range observable " + std::string(observables[obsIndex].name) + " with a memory budget." );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ModelStore::~ModelStore()
+{
+    for (const TH1DVector & data : modelData)
+        for (TH1D * pHist : data)
+            delete pHist;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelStore::Load( const LoadFunction & loadFunc )
+{
+    const size_t nModels = loadModels.size();
+
+    modelData .assign( nModels, TH1DVector() );
+    modelBank .assign( nModels, HistBank() );
+    unitScale .assign( nModels, 0.0 );
+    modelBytes.assign( nModels, 0 );
+    lastUse   .assign( nModels, 0 );
+
+    if (!budget)
+    {
+        // all models in one pass, needed for auto-range observables
+        LoadHistData( loadModels, observables, modelData, cacheFileName.c_str(), {}, nullptr, &select );
+
+        for (size_t model = 0; model < nModels; ++model)
+            usedBytes += ModelMemorySize( model );
+    }
+
+    for (size_t model = 0; model < nModels; ++model)
+    {
+        if (budget)
+        {
+            modelData[model] = LoadModel( model );
+            usedBytes += ModelMemorySize( model );
+        }
+
+        unitScale[model] = GetLuminosityScale( 1.0, loadModels[model], modelData[model] );
+
+        loadFunc( modelData[model] );
+
+        const size_t loadBytes = ModelMemorySize( model );     // all bins, before the bank
+
+        MakeBank( model );
+
+        modelBytes[model] = ModelMemorySize( model );
+
+        // the bank is made before the bins are released
+        peakBytes = std::max( peakBytes, usedBytes + modelBank[model].MemorySize() );
+        usedBytes = usedBytes - loadBytes + modelBytes[model];
+
+        if (budget && (peakBytes > budget))
+        {
+            ThrowError( StringFormat( "ModelStore: model %hs needs %u bytes to load, over the budget of %u bytes.",
+                                      FMT_HS(loadModels[model].modelName), FMT_U(peakBytes), FMT_U(budget) ) );
+        }
+
+        if (budget)
+        {
+            Release( model );
+            usedBytes -= modelBytes[model];
+        }
+    }
+
+    peakBytes = std::max( peakBytes, usedBytes );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelStore::Require( const std::vector<size_t> & models, size_t workBytes /*= 0*/ )
+{
+    if (!budget)
+        return;
+
+    ++useTime;
+
+    this->workBytes = workBytes;
+
+    size_t needBytes = 0;
+    for (size_t model : models)
+    {
+        if (modelData[model].empty())
+            needBytes += modelBytes[model];
+
+        lastUse[model] = useTime;
+    }
+
+    // evict the least recently used models, except those required
+    while (usedBytes + needBytes + workBytes > budget)
+    {
+        size_t evict = modelData.size();
+        for (size_t model = 0; model < modelData.size(); ++model)
+        {
+            if (modelData[model].empty() || (lastUse[model] == useTime))
+                continue;
+
+            if ((evict == modelData.size()) || (lastUse[model] < lastUse[evict]))
+                evict = model;
+        }
+
+        if (evict == modelData.size())
+        {
+            ThrowError( StringFormat( "ModelStore: the models and working set of a figure need %u bytes, over the budget of %u bytes.",
+                                      FMT_U(usedBytes + needBytes + workBytes), FMT_U(budget) ) );
+        }
+
+        Evict( evict );
+    }
+
+    for (size_t model : models)
+    {
+        if (modelData[model].empty())
+        {
+            modelData[model] = LoadModel( model );
+            MakeBank( model );
+            usedBytes += modelBytes[model];
+        }
+    }
+
+    peakBytes = std::max( peakBytes, usedBytes + workBytes );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1DVector ModelStore::LoadModel( size_t model ) const
+{
+    std::vector<TH1DVector> hists;
+    ObsSelection            modelSelect( 1, select[model] );
+
+    LoadHistData( { loadModels[model] }, observables, hists, cacheFileName.c_str(), {}, nullptr, &modelSelect );
+
+    return hists[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelStore::MakeBank( size_t model )
+{
+    if (!pBankStorage)
+        return;
+
+    modelBank[model] = HistBank( std::vector<TH1DVector>( 1, modelData[model] ), *pBankStorage );
+
+    // the bank owns the bin contents, the TH1D keep only their binning and attributes
+    for (TH1D * pHist : modelData[model])
+    {
+        if (pHist && !pHist->InheritsFrom(TProfile::Class()))
+            ReleaseHistBins( *pHist );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ModelStore::ModelMemorySize( size_t model ) const
+{
+    size_t size = modelBank[model].MemorySize();
+
+    for (const TH1D * pHist : modelData[model])
+        size += pHist ? GetHistMemorySize( *pHist ) : 0;
+
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelStore::Release( size_t model )
+{
+    for (TH1D * pHist : modelData[model])
+        delete pHist;
+
+    modelData[model].clear();
+    modelBank[model] = HistBank();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ModelStore::Evict( size_t model )
+{
+    Release( model );
+    usedBytes -= modelBytes[model];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
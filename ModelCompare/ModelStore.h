@@ -0,0 +1,123 @@
+//
+//  ModelStore.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef MODEL_STORE_H
+#define MODEL_STORE_H
+
+#include "common.h"
+#include "RootUtil.h"
+#include "ModelCompare.h"
+#include "HistBank.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// forward declarations
+
+class TH1D;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ModelCompare
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Memory budget of the model stages of ModelCompare and CompareMatrix (see ModelStore), in bytes of bin arrays:
+// the histograms and banks of the models in memory, plus the working set of the figure being made
+// (see EstimateFigureMemorySize) and the output queue, which is limited to the working set of the largest figure.
+// Not counted are the ROOT objects other than bin arrays (axes, attributes, canvas primitives), the buffers of
+// the compression of an output object, and the event pass of a model not yet cached.
+// The budget is a hard limit: a model, or the models and working set of a single figure (or pair of
+// CompareMatrix), that alone do not fit in the budget throw an error, rather than run over it.
+// 0 = no limit, all models are kept in memory (default).
+size_t GetModelMemoryBudget();
+void   SetModelMemoryBudget( size_t bytes );
+
+size_t GetHistMemorySize( const TH1D & hist );  // bin arrays only, 0 if released (see ReleaseHistBins)
+
+// Upper bound of the working set of the figure stage of ModelCompare for one figure, besides its models:
+// the figure bank and its ratio bank, the data and comparison histograms made of them for all the figure
+// observables, with all bins dense and TProfile data, and the copies drawn in the largest canvas.
+size_t EstimateFigureMemorySize( const std::vector<size_t> & figObs, size_t nModels, const ObservableVector & observables );
+
+// Order of the figures, such that each figure shares as many models as possible with the one before it.
+// Returns the figure indices.
+std::vector<size_t> ScheduleFigures( const FigureSetupVector & figures, const ModelFileVector & loadModels );
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The model histograms of the figure stage, modelData[model][observable].
+//
+// Without a budget, all models are loaded once and kept in memory.
+// With a budget, each model is loaded once to fill the cache file, then loaded from the cache
+// only while a figure needs it (see Require). The least recently used models not needed by the
+// figure are deleted to stay within the budget. Auto-range observables cannot be used with a
+// budget, as their range is set from all the models loaded together.
+//
+// With a bank storage, the bin contents of each model are kept in a one-model HistBank with that
+// storage (see HistStorage), and the bins of its TH1D are released once loaded, so the TH1D keep
+// only their binning and attributes, as sources of the bank. TProfile observables are excluded:
+// a TProfile keeps its bins in addition to the bank (see HistBank).
+struct ModelStore
+{
+    std::vector<RootUtil::TH1DVector>   modelData;  // [model][observable], empty if not in memory
+    std::vector<HistBank>               modelBank;  // [model], no models if not in memory or no bank storage
+    std::vector<double>                 unitScale;  // [model] luminosity scale for 1 fb^-1 (see GetUnitLuminosityScales)
+
+    ModelStore( const ModelFileVector & loadModels, const ObservableVector & observables, const ObsSelection & select,
+                const char * cacheFileName, size_t budget,
+                const std::vector<UInt_t> * pBankStorage = nullptr );   // [observable] HistStorage flags
+    ~ModelStore();  // deletes the histograms in memory
+
+    ModelStore( const ModelStore & ) = delete;
+    ModelStore & operator=( const ModelStore & ) = delete;
+
+    typedef std::function<void (const RootUtil::TH1DVector & hists)> LoadFunction;
+
+    // Load all models, and pass the histograms of each model to loadFunc, in model order.
+    // The histograms have all their bins until loadFunc returns; then the bins are moved to the
+    // bank, and with a budget the histograms are deleted. Throws if a model alone does not fit in the budget.
+    void Load( const LoadFunction & loadFunc );
+
+    // Ensure the histograms of the models are in memory, with workBytes left in the budget for the
+    // working set made from them, until the next Require. Throws if they do not fit in the budget
+    // once all the other models are evicted.
+    void Require( const std::vector<size_t> & models, size_t workBytes = 0 );
+
+    bool   IsBounded() const    { return budget != 0; }
+    size_t PeakSize() const     { return peakBytes; }   // bytes of the models and working set in memory
+
+private:
+    RootUtil::TH1DVector LoadModel( size_t model ) const;
+    void                 MakeBank( size_t model );
+    size_t               ModelMemorySize( size_t model ) const;
+    void                 Release( size_t model );
+    void                 Evict( size_t model );
+
+    const ModelFileVector &     loadModels;
+    const ObservableVector &    observables;
+    const ObsSelection &        select;
+    std::string                 cacheFileName;
+    size_t                      budget      = 0;
+    const std::vector<UInt_t> * pBankStorage = nullptr;
+
+    std::vector<size_t>         modelBytes;         // [model]
+    std::vector<size_t>         lastUse;            // [model] time of the last Require
+    size_t                      useTime     = 0;
+    size_t                      usedBytes   = 0;    // models in memory
+    size_t                      workBytes   = 0;    // working set of the last Require
+    size_t                      peakBytes   = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace ModelCompare
+
+#endif // MODEL_STORE_H
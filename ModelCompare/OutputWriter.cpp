@@ -0,0 +1,427 @@
+//
+//  OutputWriter.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "OutputWriter.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <RVersion.h>
+#include <RZip.h>
+#include <TBufferFile.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TThread.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static OutputCompression    s_outputCompression;
+static bool                 s_bOutputAsync = true;
+
+////////////////////////////////////////////////////////////////////////////////
+OutputCompression GetOutputCompression()
+{
+    return s_outputCompression;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SetOutputCompression( const OutputCompression & compression )
+{
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,10,0)
+    if (compression.algorithm == kCompressLZ4)
+        ThrowError( "SetOutputCompression: LZ4 requires ROOT 6.10 or later." );
+#endif
+
+    s_outputCompression = compression;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void ZipBuffer( Int_t level, Int_t * pSourceSize, char * pSource, Int_t * pTargetSize, char * pTarget,
+                       Int_t * pZipSize, Int_t algorithm )
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,12,0)
+    R__zipMultipleAlgorithm( level, pSourceSize, pSource, pTargetSize, pTarget, pZipSize, static_cast<ROOT::ECompressionAlgorithm>(algorithm) );
+#else
+    R__zipMultipleAlgorithm( level, pSourceSize, pSource, pTargetSize, pTarget, pZipSize, algorithm );
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Key of an object streamed by OutputWriter::StreamItem. This does what TKey( const TObject *, ... ) does
+// after streaming the object: compresses the buffer and allocates the key in the file. The key is owned
+// by the file, and is written with WriteFile.
+//
+// The object is streamed after space for the key header, so its internal references are offsets as
+// read by TKey::ReadObj. The key always has 64-bit file positions, so the header size is known in advance.
+
+class OutputKey : public TKey
+{
+public:
+    OutputKey( const char * name, const char * title, const char * className, Int_t keyLength,
+               TBufferFile * pBuffer, TDirectory * pDir );  // takes ownership of pBuffer
+
+    static Int_t HeaderSize( const std::string & className, const std::string & name, const std::string & title );
+};
+
+const Int_t MaxZipBufferSize = 0xffffff;    // same as TKey
+
+////////////////////////////////////////////////////////////////////////////////
+Int_t OutputKey::HeaderSize( const std::string & className, const std::string & name, const std::string & title )
+{
+    // same as TKey::Sizeof with 64-bit file positions (version > 1000), TString::Sizeof for the strings
+    auto StringSize = []( const std::string & str ) -> Int_t { return (Int_t)str.size() + ((str.size() > 254) ? 5 : 1); };
+
+    return 22 + 8 + 4 + StringSize( className ) + StringSize( name ) + StringSize( title );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+OutputKey::OutputKey( const char * name, const char * title, const char * className, Int_t keyLength,
+                      TBufferFile * pBuffer, TDirectory * pDir )
+  : TKey( pDir )
+{
+    fBufferRef = pBuffer;   // deleted with the key if not written
+
+    SetName(  name  );
+    SetTitle( title );
+
+    Build( pDir, className, -1 );
+
+    if (fVersion <= 1000)
+        fVersion += 1000;   // 64-bit file positions
+
+    fKeylen = Sizeof();
+    if (fKeylen != keyLength)
+        ThrowError( std::string("OutputWriter: unexpected key header size for ") + name );
+
+    fCycle  = fMotherDir->AppendKey( this );
+    fObjlen = fBufferRef->Length() - fKeylen;
+
+    // compress as TKey
+
+    const Int_t level     = GetFile()->GetCompressionLevel();
+    const Int_t algorithm = GetFile()->GetCompressionAlgorithm();
+
+    Int_t nZipped = 0;  // total compressed size, 0 if not compressed
+
+    if ((level > 0) && (fObjlen > 256))
+    {
+        const Int_t nBuffers = 1 + (fObjlen - 1) / MaxZipBufferSize;
+        const Int_t bufSize  = std::max( 512, fKeylen + fObjlen + 9 * nBuffers + 28 );
+
+        fBuffer = new char[bufSize];
+
+        char * pSource = fBufferRef->Buffer() + fKeylen;
+        char * pTarget = fBuffer + fKeylen;
+
+        for (Int_t i = 0; i < nBuffers; ++i)
+        {
+            Int_t nSource = (i == nBuffers - 1) ? fObjlen - i * MaxZipBufferSize : MaxZipBufferSize;
+            Int_t nTarget = nSource;
+            Int_t nOut    = 0;
+
+            ZipBuffer( level, &nSource, pSource, &nTarget, pTarget, &nOut, algorithm );
+
+            if ((nOut == 0) || (nOut >= fObjlen))
+            {
+                // the buffer cannot be compressed
+                delete [] fBuffer;
+                fBuffer = nullptr;
+                nZipped = 0;
+                break;
+            }
+
+            pSource += MaxZipBufferSize;
+            pTarget += nOut;
+            nZipped += nOut;
+        }
+    }
+
+    if (nZipped > 0)
+    {
+        Create( nZipped );
+
+        fBufferRef->SetBufferOffset( 0 );
+        Streamer( *fBufferRef );    // key header, with the position set by Create
+        memcpy( fBuffer, fBufferRef->Buffer(), fKeylen );
+
+        delete fBufferRef;
+        fBufferRef = nullptr;
+    }
+    else
+    {
+        fBuffer = fBufferRef->Buffer();
+        Create( fObjlen );
+
+        fBufferRef->SetBufferOffset( 0 );
+        Streamer( *fBufferRef );    // key header, with the position set by Create
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool GetOutputAsync()
+{
+    return s_bOutputAsync;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SetOutputAsync( bool bAsync )
+{
+    s_bOutputAsync = bAsync;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+OutputWriter::OutputWriter( const char * fileName )
+{
+    const OutputCompression compression = GetOutputCompression();
+
+    upFile.reset( new TFile( fileName, "RECREATE", "", compression.Settings() ) );
+    if (upFile->IsZombie() || !upFile->IsOpen())    // IsZombie is true if constructor failed
+    {
+        LogMsgError( "Failed to create output file (%hs).", FMT_HS(fileName) );
+        ThrowError( std::invalid_argument( fileName ) );
+    }
+
+    LogMsgInfo( "Output file: %hs (compression %i)", FMT_HS(fileName), FMT_I(compression.Settings()) );
+
+    bAsync = GetOutputAsync();
+
+    if (bAsync)
+    {
+        // enable ROOT's internal locking and thread-local gDirectory and gPad
+        TThread::Initialize();
+
+        worker = std::thread( [this]() { WorkerLoop(); } );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+OutputWriter::~OutputWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception & e)
+    {
+        LogMsgError( "OutputWriter: %hs", FMT_HS(e.what()) );
+    }
+    catch (...)
+    {
+        LogMsgError( "OutputWriter: unknown error." );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::Write( TObject * pObject, const char * keyName /*= nullptr*/, bool bOwn /*= true*/ )
+{
+    if (!pObject)
+        return;
+
+    if (!upFile)
+    {
+        if (bOwn)
+            delete pObject;
+        ThrowError( "OutputWriter: file is closed." );
+    }
+
+    // stream and delete the object on this thread, as ROOT objects must not be used concurrently
+    Item item;
+    {
+        std::unique_ptr<TObject> upOwned( bOwn ? pObject : nullptr );
+
+        item = StreamItem( *pObject, keyName );
+    }
+
+    if (!bAsync)
+    {
+        WriteItem( item );
+        ThrowIfFailed();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+
+        const size_t bytes = item.bufferSize;
+        cvDone.wait( lock, [&]() { return !queueLimit || !queueBytes || (queueBytes + bytes <= queueLimit); } );
+
+        queueBytes += bytes;
+        queue.push_back( std::move(item) );
+    }
+
+    cvWork.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::Write( const TH1DVector & hists, bool bOwn /*= true*/ )
+{
+    for (TH1D * pHist : hists)
+        Write( pHist, nullptr, bOwn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::Flush()
+{
+    if (bAsync)
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+        cvDone.wait( lock, [this]() { return queue.empty() && !bBusy; } );
+    }
+
+    ThrowIfFailed();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::Close()
+{
+    if (!upFile)
+        return;
+
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            bStop = true;
+        }
+        cvWork.notify_one();
+
+        worker.join();  // writes the remaining items first
+    }
+
+    upFile->Close();
+    upFile.reset();
+
+    ThrowIfFailed();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::unique_lock<std::mutex> OutputWriter::Pause()
+{
+    return std::unique_lock<std::mutex>( writeMutex );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+OutputWriter::Item OutputWriter::StreamItem( TObject & object, const char * keyName )
+{
+    Item item;
+    item.keyName   = (keyName && keyName[0]) ? keyName : object.GetName();
+    item.title     = object.GetTitle();
+    item.className = object.ClassName();
+    item.keyLength = OutputKey::HeaderSize( item.className, item.keyName, item.title );
+
+    // stream as TKey, after the key header (see OutputKey)
+    item.upBuffer.reset( new TBufferFile( TBuffer::kWrite, item.keyLength + TBuffer::kInitialSize ) );
+    item.upBuffer->SetParent( upFile.get() );   // the file records the streamer infos used
+    item.upBuffer->SetBufferOffset( item.keyLength );
+    item.upBuffer->MapObject( &object );        // register object in map in case of self reference
+    object.Streamer( *item.upBuffer );
+
+    item.bufferSize = (size_t)item.upBuffer->BufferSize();
+
+    return item;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::WriteItem( Item & item )
+{
+    std::lock_guard<std::mutex> writeLock( writeMutex );
+
+    try
+    {
+        bool bSkip;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            bSkip = bFailed;
+        }
+
+        // skip writing after a failure, so the file contents remain in order
+        if (!bSkip)
+        {
+            // as TDirectoryFile::WriteTObject, the key is owned by the file
+            OutputKey * pKey = new OutputKey( item.keyName.c_str(), item.title.c_str(), item.className.c_str(), item.keyLength,
+                                              item.upBuffer.release(), upFile.get() );
+
+            if (!pKey->GetSeekKey())
+            {
+                upFile->GetListOfKeys()->Remove( pKey );
+                delete pKey;
+                ThrowError( "OutputWriter: failed to allocate " + item.keyName );
+            }
+
+            upFile->SumBuffer( pKey->GetObjlen() );
+
+            if ((pKey->WriteFile( 0 ) <= 0) || upFile->TestBit( TFile::kWriteError ))
+                ThrowError( "OutputWriter: failed to write " + item.keyName );
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        if (!bFailed)
+            error = std::current_exception();
+        bFailed = true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::WorkerLoop()
+{
+    for ( ; ; )
+    {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            cvWork.wait( lock, [this]() { return !queue.empty() || bStop; } );
+
+            if (queue.empty())
+                break;  // stopped, and all items written
+
+            item = std::move( queue.front() );
+            queue.pop_front();
+            bBusy = true;
+        }
+
+        WriteItem( item );
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            bBusy = false;
+            queueBytes -= item.bufferSize;
+        }
+        cvDone.notify_all();
+    }
+
+    cvDone.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void OutputWriter::ThrowIfFailed()
+{
+    std::exception_ptr e;
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        e = error;
+        error = nullptr;
+    }
+
+    if (e)
+        std::rethrow_exception( e );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
@@ -0,0 +1,127 @@
+//
+//  OutputWriter.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include "common.h"
+#include "RootUtil.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// Root includes
+#include <Rtypes.h>
+
+class TBufferFile;
+class TFile;
+class TObject;
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum OutputCompressionAlgorithm
+{
+    kCompressDefault    = 0,    // ROOT global default
+    kCompressZLIB       = 1,
+    kCompressLZMA       = 2,    // smallest files, slowest
+    kCompressLZ4        = 4,    // fastest, requires ROOT 6.10 or later (SetOutputCompression throws otherwise)
+};
+
+struct OutputCompression
+{
+    Int_t   algorithm   = kCompressDefault;     // OutputCompressionAlgorithm
+    Int_t   level       = 1;                    // 0 = no compression, up to 9
+
+    OutputCompression() = default;
+    OutputCompression( Int_t a, Int_t l ) : algorithm(a), level(l) {}
+
+    Int_t Settings() const { return algorithm * 100 + level; }  // see TFile::SetCompressionSettings
+};
+
+// compression and asynchronous writing of new OutputWriter objects
+OutputCompression GetOutputCompression();
+void              SetOutputCompression( const OutputCompression & compression );
+
+bool GetOutputAsync();
+void SetOutputAsync( bool bAsync );     // true by default
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Output file (RECREATE) that writes objects on a helper thread, in the order they are passed to Write.
+// Write streams the object into a buffer on the caller's thread, and deletes it if owned, so the object
+// may be modified or deleted as soon as Write returns. Only the compression and disk I/O of the buffer
+// happen on the helper thread, which creates no other ROOT objects than the keys of the file.
+struct OutputWriter
+{
+    explicit OutputWriter( const char * fileName );
+    ~OutputWriter();    // calls Close, but does not throw
+
+    OutputWriter( const OutputWriter & ) = delete;
+    OutputWriter & operator=( const OutputWriter & ) = delete;
+
+    void Write( TObject * pObject, const char * keyName = nullptr, bool bOwn = true );   // keyName = nullptr uses the object name
+    void Write( const TH1DVector & hists, bool bOwn = true );
+
+    // With a limit, Write waits while the streamed objects not yet written would exceed it (an object
+    // larger than the limit is queued alone); 0 = no limit (default).
+    void   SetQueueLimit( size_t bytes )    { queueLimit = bytes; }
+    size_t GetQueueLimit() const            { return queueLimit; }
+
+    void Flush();   // wait for all objects to be written; throws if any write failed
+    void Close();   // flush and close the file; throws if any write failed
+
+    // Wait for the current write to finish, and hold off further writes while the lock is held.
+    // Use this around fork, so the child does not inherit locks held by the helper thread.
+    std::unique_lock<std::mutex> Pause();
+
+private:
+    struct Item
+    {
+        std::string                     keyName;
+        std::string                     title;
+        std::string                     className;
+        Int_t                           keyLength = 0;  // bytes reserved for the key header at the start of the buffer
+        std::unique_ptr<TBufferFile>    upBuffer;       // the streamed object, after keyLength bytes
+        size_t                          bufferSize = 0; // bytes allocated by upBuffer
+    };
+
+    Item StreamItem( TObject & object, const char * keyName );
+    void WriteItem( Item & item );
+    void WorkerLoop();
+    void ThrowIfFailed();
+
+    std::unique_ptr<TFile>      upFile;
+    bool                        bAsync = false;
+
+    std::thread                 worker;
+    std::mutex                  mutex;              // queue and state
+    std::mutex                  writeMutex;         // held while writing an item, see Pause
+    std::condition_variable     cvWork;
+    std::condition_variable     cvDone;
+    std::deque<Item>            queue;
+    size_t                      queueLimit  = 0;    // see SetQueueLimit
+    size_t                      queueBytes  = 0;    // bufferSize of the items queued or being written
+    bool                        bBusy   = false;    // worker is writing an item
+    bool                        bStop   = false;
+    bool                        bFailed = false;    // a write failed, the following objects are not written
+    std::exception_ptr          error;              // first failure not yet thrown
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // OUTPUT_WRITER_H
@@ -0,0 +1,103 @@
+//
+//  Parallel.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "Parallel.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t s_parallelThreadCount = 0;    // 0 = hardware concurrency
+
+static thread_local bool t_bInParallelFor = false;  // set on worker threads, including the calling thread
+
+////////////////////////////////////////////////////////////////////////////////
+size_t GetParallelThreadCount()
+{
+    if (s_parallelThreadCount != 0)
+        return s_parallelThreadCount;
+
+    size_t nThreads = std::thread::hardware_concurrency();  // 0 if unknown
+
+    return std::max( nThreads, size_t(1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SetParallelThreadCount( size_t nThreads )
+{
+    s_parallelThreadCount = nThreads;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ParallelFor( size_t count, const std::function<void(size_t index)> & func )
+{
+    const size_t nThreads = t_bInParallelFor ? 1 : std::min( GetParallelThreadCount(), count );
+
+    if (nThreads <= 1)
+    {
+        for (size_t index = 0; index < count; ++index)
+            func( index );
+        return;
+    }
+
+    std::atomic<size_t> nextIndex( 0 );
+    std::atomic<bool>   bFailed( false );
+    std::exception_ptr  firstError;
+    std::mutex          errorMutex;
+
+    auto Worker = [&]()
+    {
+        const bool bWasInParallelFor = t_bInParallelFor;
+        t_bInParallelFor = true;
+
+        while (!bFailed)
+        {
+            size_t index = nextIndex++;
+            if (index >= count)
+                break;
+
+            try
+            {
+                func( index );
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock( errorMutex );
+                if (!firstError)
+                    firstError = std::current_exception();
+                bFailed = true;
+            }
+        }
+
+        t_bInParallelFor = bWasInParallelFor;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; ++i)
+        threads.push_back( std::thread( Worker ) );
+
+    Worker();   // the calling thread is also a worker
+
+    for (std::thread & thread : threads)
+        thread.join();
+
+    if (firstError)
+        std::rethrow_exception( firstError );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
@@ -0,0 +1,36 @@
+//
+//  Parallel.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// number of worker threads to use, the hardware concurrency by default
+size_t GetParallelThreadCount();
+void   SetParallelThreadCount( size_t nThreads );  // 0 = hardware concurrency
+
+// Call func(index) for each index in [0, count), distributed over the worker threads.
+// Each index is called exactly once, in no particular order. The function must not
+// modify shared ROOT objects. The first exception thrown is re-thrown once all threads
+// have finished; the remaining indices are then skipped.
+// A nested call from within func runs on the calling thread only.
+void ParallelFor( size_t count, const std::function<void(size_t index)> & func );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // PARALLEL_H
@@ -0,0 +1,158 @@
+//
+//  QuantileSketch.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "QuantileSketch.h"
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+QuantileSketch::QuantileSketch( size_t capacity /*= 8192*/, UInt_t seed /*= 4357*/ )
+  : capacity( std::max( capacity, size_t(2) ) ), levels( 1 ), random( seed ? seed : 1 )
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool QuantileSketch::RandomBit()
+{
+    // xorshift32, deterministic for a given seed
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    return (random & 1) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QuantileSketch::Add( Double_t value )
+{
+    if (count == 0)
+    {
+        minValue = value;
+        maxValue = value;
+    }
+    else
+    {
+        minValue = std::min( minValue, value );
+        maxValue = std::max( maxValue, value );
+    }
+
+    ++count;
+
+    levels[0].push_back( value );
+
+    if (levels[0].size() >= capacity)
+        Compact( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QuantileSketch::Compact( size_t level )
+{
+    while ((level < levels.size()) && (levels[level].size() >= capacity))
+    {
+        if (level + 1 == levels.size())
+            levels.push_back( std::vector<Double_t>() );
+
+        std::vector<Double_t> & values = levels[level];
+        std::vector<Double_t> & next   = levels[level + 1];
+
+        std::sort( values.begin(), values.end() );
+
+        // an odd value out stays in this level
+        Double_t keep     = 0;
+        bool     bKeepOne = (values.size() % 2) != 0;
+        if (bKeepOne)
+        {
+            keep = values.back();
+            values.pop_back();
+        }
+
+        for (size_t i = RandomBit() ? 1 : 0; i < values.size(); i += 2)
+            next.push_back( values[i] );
+
+        values.clear();
+        if (bKeepOne)
+            values.push_back( keep );
+
+        ++level;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QuantileSketch::Merge( const QuantileSketch & other )
+{
+    if (other.count == 0)
+        return;
+
+    if (count == 0)
+    {
+        minValue = other.minValue;
+        maxValue = other.maxValue;
+    }
+    else
+    {
+        minValue = std::min( minValue, other.minValue );
+        maxValue = std::max( maxValue, other.maxValue );
+    }
+
+    count += other.count;
+
+    if (levels.size() < other.levels.size())
+        levels.resize( other.levels.size() );
+
+    for (size_t level = 0; level < other.levels.size(); ++level)
+        levels[level].insert( levels[level].end(), other.levels[level].cbegin(), other.levels[level].cend() );
+
+    for (size_t level = 0; level < levels.size(); ++level)  // levels may be added while compacting
+        Compact( level );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t QuantileSketch::Quantile( Double_t q ) const
+{
+    if (count == 0)
+        ThrowError( "QuantileSketch: no values." );
+
+    if (q <= 0) return minValue;
+    if (q >= 1) return maxValue;
+
+    std::vector< std::pair<Double_t, Double_t> > weighted;     // (value, weight)
+    Double_t totalWeight = 0;
+
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        const Double_t weight = std::ldexp( 1.0, (int)level );
+
+        for (Double_t value : levels[level])
+            weighted.push_back( { value, weight } );
+
+        totalWeight += weight * levels[level].size();
+    }
+
+    std::sort( weighted.begin(), weighted.end() );
+
+    const Double_t rank = q * totalWeight;
+
+    Double_t cumulative = 0;
+    for (const auto & vw : weighted)
+    {
+        cumulative += vw.second;
+        if (cumulative >= rank)
+            return vw.first;
+    }
+
+    return maxValue;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
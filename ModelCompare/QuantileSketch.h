@@ -0,0 +1,62 @@
+//
+//  QuantileSketch.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include "common.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Streaming quantile sketch with bounded memory, which can be merged with other sketches.
+//
+// Values are kept in a hierarchy of compactors, as in the KLL sketch of Karnin, Lang and
+// Liberty (2016), with the same capacity at every level. Each value in level l has weight 2^l.
+// When a level is full it is sorted, and every second value (from a random offset) is moved
+// to the next level. The rank error is of order log2(count / capacity) / capacity.
+// The minimum and maximum are exact.
+
+struct QuantileSketch
+{
+    explicit QuantileSketch( size_t capacity = 8192, UInt_t seed = 4357 );
+
+    void Add( Double_t value );
+
+    void Merge( const QuantileSketch & other );
+
+    Double_t Quantile( Double_t q ) const;     // q in [0, 1]
+
+    size_t      Count() const   { return count; }
+    Double_t    Min()   const   { return minValue; }
+    Double_t    Max()   const   { return maxValue; }
+
+private:
+    void Compact( size_t level );
+    bool RandomBit();
+
+    size_t                                  capacity    = 0;
+    std::vector< std::vector<Double_t> >    levels;         // levels[l] = values of weight 2^l
+    size_t                                  count       = 0;
+    Double_t                                minValue    = 0;
+    Double_t                                maxValue    = 0;
+    UInt_t                                  random      = 0;    // xorshift state
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // QUANTILE_SKETCH_H
@@ -0,0 +1,226 @@
+//
+//  RootDraw.cpp
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#include "RootDraw.h"
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <TH1.h>
+#include <TProfile.h>
+#include <TVirtualPad.h>
+#include <TStyle.h>
+#include <THistPainter.h>
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+void GetHistDrawMinMax( const TH1D & hist, Double_t & ymin, Double_t & ymax, bool bLogY /*= false*/ )
+{
+    // Same y-axis range as drawing the histogram with the default option into an empty pad
+    // (see THistPainter::PaintInit), but calculated directly from the bins, without a pad.
+    // Errors are included if the histogram is drawn with error bars by default (Sumw2 or TProfile).
+
+    const bool bErrors = hist.GetSumw2N() || hist.InheritsFrom(TProfile::Class());
+
+    const Double_t yMargin      = gStyle ? gStyle->GetHistTopMargin()   : 0.05;
+    const bool     bMinimumZero = gStyle ? gStyle->GetHistMinimumZero() : false;
+
+    ymax = -1E32;
+    ymin =  1E32;
+
+    Double_t allchan = 0;
+
+    const Int_t first = hist.GetXaxis()->GetFirst();
+    const Int_t last  = hist.GetXaxis()->GetLast();
+
+    for (Int_t bin = first; bin <= last; ++bin)
+    {
+        Double_t c1 = hist.GetBinContent(bin);
+
+        ymax = std::max( ymax, c1 );
+        if (!bLogY || (c1 > 0))
+            ymin = std::min( ymin, c1 );
+
+        if (bErrors)
+        {
+            Double_t e1 = hist.GetBinError(bin);
+
+            ymax = std::max( ymax, c1 + e1 );
+            if (!bLogY || (c1 - e1 > 0.01 * std::abs(c1)))
+                ymin = std::min( ymin, c1 - e1 );
+        }
+
+        allchan += c1;
+    }
+
+    if (bLogY && (ymin <= 0))
+        ymin = (ymax >= 1) ? std::max( 0.005, ymax * 1E-10 ) : 0.001 * ymax;
+
+    const bool bMaximum = (hist.GetMaximumStored() != -1111);
+    const bool bMinimum = (hist.GetMinimumStored() != -1111);
+
+    if (bMaximum) ymax = hist.GetMaximumStored();
+    if (bMinimum) ymin = hist.GetMinimumStored();
+
+    if (bLogY && (ymin < 0))
+        ThrowError( "GetHistDrawMinMax: log scale with a negative minimum." );
+
+    if (bLogY && (ymax == 0))    // empty histogram in log scale
+    {
+        ymin = 0.01;
+        ymax = 10;
+    }
+
+    if (ymin >= ymax)
+    {
+        if (bLogY)
+        {
+            if (ymax <= 0)
+                ThrowError( "GetHistDrawMinMax: log scale with a maximum less or equal 0." );
+            ymin = 0.001 * ymax;
+        }
+        else if (ymin > 0)
+        {
+            ymin  = 0;
+            ymax *= 2;
+        }
+        else if (ymin < 0)
+        {
+            ymax  = 0;
+            ymin *= 2;
+        }
+        else
+        {
+            ymin = 0;
+            ymax = 1;
+        }
+    }
+
+    // precision guard, as in THistPainter
+    if (std::abs(ymax - ymin) <= 1E-15 * std::max( std::abs(ymin), std::abs(ymax) ))
+    {
+        ymin *= (1 - 1E-14);
+        ymax *= (1 + 1E-14);
+    }
+
+    // normalization factor
+    {
+        Double_t factor = allchan;
+        if (hist.GetNormFactor() > 0)
+            factor = hist.GetNormFactor();
+        if (allchan != 0)
+            factor /= allchan;
+        if (factor == 0)
+            factor = 1;
+
+        ymin *= factor;
+        ymax *= factor;
+
+        if (ymax < ymin)
+            std::swap( ymin, ymax );
+    }
+
+    if (bLogY)
+    {
+        if ((ymin <= 0) || (ymax <= 0))
+            ThrowError( "GetHistDrawMinMax: cannot set y-axis to log scale." );
+
+        // THistPainter works in log10 coordinates
+        if (!bMinimum) ymin *= 0.5;
+        if (!bMaximum) ymax *= 2 * (0.9 / 0.95);
+        return;
+    }
+
+    if (!bMinimum)
+    {
+        Double_t dymin = yMargin * (ymax - ymin);
+
+        if (bMinimumZero)
+            ymin = (ymin >= 0) ? 0 : ymin - dymin;
+        else
+            ymin = ((ymin >= 0) && (ymin - dymin <= 0)) ? 0 : ymin - dymin;
+    }
+
+    if (!bMaximum)
+        ymax += yMargin * (ymax - ymin);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void GetHistDrawMinMax( const ConstTH1DVector & hists, Double_t & ymin, Double_t & ymax, bool bLogY /*= false*/ )
+{
+    ymin = std::numeric_limits<Double_t>::max();
+    ymax = -ymin;
+
+    for (const TH1D * pHist : hists)
+    {
+        Double_t hist_ymin, hist_ymax;
+        GetHistDrawMinMax( *pHist, hist_ymin, hist_ymax, bLogY );
+
+        ymin = std::min( ymin, hist_ymin );
+        ymax = std::max( ymax, hist_ymax );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TH1DVector DrawMultipleHist( const char * title, const ConstTH1DVector & hists, const ColorVector & colors /*= {}*/, const CStringVector drawOptions /*= {}*/ )
+{
+    TH1DVector drawHists;
+
+    Double_t yAxisMin, yAxisMax;
+    GetHistDrawMinMax( hists, yAxisMin, yAxisMax, gPad && gPad->GetLogy() );
+
+    for ( size_t i = 0; i < hists.size(); ++i )
+    {
+        std::string drawOption = (i < drawOptions.size()) ? drawOptions[i] : "";
+
+        if (i != 0)
+            drawOption += " SAME";
+
+        TH1D * pHist = reinterpret_cast<TH1D *>( hists[i]->DrawCopy(drawOption.c_str()) );     // histogram copy is owned by the current pad
+        if (!pHist)
+            ThrowError( "DrawCopy failed" );
+
+        drawHists.push_back(pHist);
+
+        if (i < colors.size())
+        {
+            Color_t color = colors[i];
+            pHist->SetLineColor(   color );
+            pHist->SetMarkerColor( color );
+        }
+
+        pHist->SetBit( TH1::kNoTitle );  // disable title from histogram
+
+        // set the y-axis min/max (Note: do not use TCanvas::RangeAxis as this only works if TCanvas::Range is also set appropriately).
+        pHist->SetMinimum( yAxisMin );
+        pHist->SetMaximum( yAxisMax );
+    }
+
+    // add the title, if defined
+    if (title && title[0])
+    {
+        TH1D            dummyHist;
+        THistPainter    painter;
+
+        dummyHist.SetDirectory( nullptr );  // ensure not owned by any directory
+        dummyHist.SetTitle(title);
+        
+        painter.SetHistogram( &dummyHist );
+        
+        painter.PaintTitle();  // creates a TPaveLabel with the name "title" which is owned by the current pad
+    }
+    
+    return drawHists;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
@@ -0,0 +1,38 @@
+//
+//  RootDraw.h
+//  ModelCompare
+//
+//  Created by Christopher Jacobsen on 18/10/26.
+//  Copyright (c) 2026 Christopher Jacobsen. All rights reserved.
+//
+
+#ifndef ROOT_DRAW_H
+#define ROOT_DRAW_H
+
+#include "common.h"
+#include "RootUtil.h"
+
+// Root includes
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace RootUtil
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Drawing helpers, using the ROOT graphics libraries (Gpad, HistPainter).
+// Kept apart from RootUtil, so the compute code links without them.
+
+// y-axis range of the default histogram drawing, calculated from the bins without drawing
+void GetHistDrawMinMax( const TH1D & hist,             Double_t & ymin, Double_t & ymax, bool bLogY = false );
+void GetHistDrawMinMax( const ConstTH1DVector & hists, Double_t & ymin, Double_t & ymax, bool bLogY = false );
+
+TH1DVector DrawMultipleHist( const char * title, const ConstTH1DVector & hists, const ColorVector & colors = {}, const CStringVector drawOptions = {} );
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace RootUtil
+
+#endif // ROOT_DRAW_H
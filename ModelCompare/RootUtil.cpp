@@ -6,6 +6,7 @@
 //
 
 #include "RootUtil.h"
+#include "HistStats.h"
 #include "common.h"
 
 // Root includes
@@ -19,8 +20,6 @@
 #include <TObjArray.h>
 #include <TBranch.h>
 #include <TLeaf.h>
-#include <TCanvas.h>
-#include <THistPainter.h>
 
 // HepMC includes
 #include <HepMC/IO_GenEvent.h>
@@ -268,12 +267,19 @@ void LogMsgHistEffectiveEntries( const ConstTH1DVector & hists )
 ////////////////////////////////////////////////////////////////////////////////
 void LogMsgHistBinCounts( const TH1D & hist )
 {
+    const HistBinView view( hist );
+
+    std::vector<UChar_t> nonEmpty( view.nSize );
+    std::vector<UChar_t> error(    view.nSize );
+    HistNonEmptyMask( view, nonEmpty.data() );
+    HistErrorMask(    view, error   .data() );
+
     Int_t nBinsA     = hist.GetNbinsX();
     Int_t nBinsB     = hist.GetSize();
-    Int_t nNonEmptyA = (Int_t)HistNonEmptyBinCount(hist, false);
-    Int_t nNonEmptyB = (Int_t)HistNonEmptyBinCount(hist, true );
-    Int_t nErrorA    = (Int_t)HistErrorBinCount(hist, false);
-    Int_t nErrorB    = (Int_t)HistErrorBinCount(hist, true);
+    Int_t nNonEmptyA = (Int_t)CountBinMask( nonEmpty.data(), view.nSize, false );
+    Int_t nNonEmptyB = (Int_t)CountBinMask( nonEmpty.data(), view.nSize, true  );
+    Int_t nErrorA    = (Int_t)CountBinMask( error   .data(), view.nSize, false );
+    Int_t nErrorB    = (Int_t)CountBinMask( error   .data(), view.nSize, true  );
 
     LogMsgInfo( "%hs:\tbins=%i(%i)  non-empty=%i(%i)  errors=%i(%i)", FMT_HS(hist.GetName()),
                 FMT_I(nBinsA),     FMT_I(nBinsB),
@@ -284,12 +290,26 @@ void LogMsgHistBinCounts( const TH1D & hist )
 ////////////////////////////////////////////////////////////////////////////////
 void LogMsgHistBinCounts( const TH1D & hist1, const TH1D & hist2, bool bCountUnion /*= false*/ )
 {
+    if (hist1.GetSize() != hist2.GetSize())
+        ThrowError( "LogMsgHistBinCounts: histogram size mismatch." );
+
+    const HistBinView v1( hist1 );
+    const HistBinView v2( hist2 );
+    const Int_t       nSize = v1.nSize;
+
+    std::vector<UChar_t> nonEmpty1( nSize ), nonEmpty2( nSize );
+    std::vector<UChar_t> error1(    nSize ), error2(    nSize );
+    HistNonEmptyMask( v1, nonEmpty1.data() );
+    HistNonEmptyMask( v2, nonEmpty2.data() );
+    HistErrorMask(    v1, error1   .data() );
+    HistErrorMask(    v2, error2   .data() );
+
     Int_t nBinsA     = hist1.GetNbinsX();
     Int_t nBinsB     = hist1.GetSize();
-    Int_t nNonEmptyA = (Int_t)HistNonEmptyBinCount( hist1, hist2, bCountUnion, false );
-    Int_t nNonEmptyB = (Int_t)HistNonEmptyBinCount( hist1, hist2, bCountUnion, true  );
-    Int_t nErrorA    = (Int_t)HistErrorBinCount(    hist1, hist2, bCountUnion, false );
-    Int_t nErrorB    = (Int_t)HistErrorBinCount(    hist1, hist2, bCountUnion, true  );
+    Int_t nNonEmptyA = (Int_t)CountBinMask( nonEmpty1.data(), nonEmpty2.data(), nSize, bCountUnion, false );
+    Int_t nNonEmptyB = (Int_t)CountBinMask( nonEmpty1.data(), nonEmpty2.data(), nSize, bCountUnion, true  );
+    Int_t nErrorA    = (Int_t)CountBinMask( error1   .data(), error2   .data(), nSize, bCountUnion, false );
+    Int_t nErrorB    = (Int_t)CountBinMask( error1   .data(), error2   .data(), nSize, bCountUnion, true  );
 
     LogMsgInfo( "%hs %hs %hs:\tbins=%i(%i)  non-empty=%i(%i)  errors=%i(%i)",
                 FMT_HS(hist1.GetName()), FMT_HS(bCountUnion ? "||" : "&&" ), FMT_HS(hist2.GetName()),
@@ -403,6 +423,29 @@ bool IsHistSumw2Enabled( const TH1D & hist )
     return hist.GetSumw2()->fN != 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void ReleaseHistBins( TH1D & hist )
+{
+    if (hist.InheritsFrom(TProfile::Class()))
+        ThrowError( "ReleaseHistBins: TProfile is not supported." );
+
+    static_cast<TArrayD &>(hist).Set( 0 );
+    hist.GetSumw2()->Set( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RestoreHistBins( TH1D & hist )
+{
+    if (IsHistBinsReleased( hist ))
+        hist.SetBinsLength();   // all bins of the axis, zero
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool IsHistBinsReleased( const TH1D & hist )
+{
+    return hist.GetArray() == nullptr;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void SetupHist( TH1D & hist, const char * xAxisTitle, const char * yAxisTitle,
                 Color_t lineColor /*= -1*/, Color_t markerColor /*= -1*/, Color_t fillColor /*= -1*/ )
@@ -426,8 +469,7 @@ void SetupHist( TH1D & hist, const char * xAxisTitle, const char * yAxisTitle,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void ScaleHistToLuminosity( double luminosity, TH1D & hist, size_t nEvents, double crossSection,
-                            double crossSectionError, bool bApplyCrossSectionError /*= false*/ )
+void ScaleHistEntries( TH1D & hist, double scale )
 {
     // Luminosity scaling is not the same as scaling by a constant.
     // Instead we want to change the number of effective entries:
@@ -444,38 +486,39 @@ void ScaleHistToLuminosity( double luminosity, TH1D & hist, size_t nEvents, doub
     // effective entries:   binEntries^2 / binSumw2
     // scaling by s:        binError *= 1/sqrt(s)
 
-    double scale = luminosity * crossSection * 1000 / nEvents;
+    HistBinArrays arrays( hist );
 
-    LogMsgInfo( "Scaling %hs with %g", FMT_HS(hist.GetName()), FMT_F(scale) );
+    for (Int_t bin = 0; bin < arrays.nSize; ++bin)
+    {
+        arrays.pSumw[bin] *= scale;
 
-    //LogMsgInfo( "------ before luminosity scale ------" );
-    //hist.Print("all");
-    //LogMsgHistStats(hist);
-    //LogMsgHistEffectiveEntries(hist);
+        if (arrays.pSumw2)
+            arrays.pSumw2[bin] *= scale;
 
-    MyProfile * pProf = hist.InheritsFrom(TProfile::Class()) ? static_cast<MyProfile *>(&hist) : nullptr;
+        if (arrays.pBinEntries)
+            arrays.pBinEntries[bin] *= scale;
 
-    Double_t * pSumw        = hist.GetArray();
-    Double_t * pSumw2       = hist.GetSumw2()->GetArray(); // can be null
-    Double_t * pBinEntries  = pProf ? pProf->fBinEntries.GetArray()    : nullptr;
-    Double_t * pBinSumw2    = pProf ? pProf->GetBinSumw2()->GetArray() : nullptr;
+        if (arrays.pBinSumw2)
+            arrays.pBinSumw2[bin] *= scale;
+    }
 
-    const Int_t nSize = hist.GetSize();
-    for (Int_t bin = 0; bin < nSize; ++bin)
-    {
-        pSumw[bin] *= scale;
+    hist.ResetStats();
+}
 
-        if (pSumw2)
-            pSumw2[bin] *= scale;
+////////////////////////////////////////////////////////////////////////////////
+void ScaleHistToLuminosity( double luminosity, TH1D & hist, size_t nEvents, double crossSection,
+                            double crossSectionError, bool bApplyCrossSectionError /*= false*/ )
+{
+    double scale = luminosity * crossSection * 1000 / nEvents;
 
-        if (pBinEntries)
-            pBinEntries[bin] *= scale;
+    LogMsgInfo( "Scaling %hs with %g", FMT_HS(hist.GetName()), FMT_F(scale) );
 
-        if (pBinSumw2)
-            pBinSumw2[bin] *= scale;
-    }
+    //LogMsgInfo( "------ before luminosity scale ------" );
+    //hist.Print("all");
+    //LogMsgHistStats(hist);
+    //LogMsgHistEffectiveEntries(hist);
 
-    hist.ResetStats();
+    ScaleHistEntries( hist, scale );
 
     //LogMsgInfo( "------ after luminosity scale ------" );
     //LogMsgHistStats(hist);
@@ -746,237 +789,316 @@ bool LoadCacheTuple( const char * cacheFileName, TNtupleD * & pTuple )
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void GetHistDrawMinMax( const TH1D & hist, Double_t & ymin, Double_t & ymax )
+Double_t GetHistBinEffectiveEntries( const TH1D & hist, Int_t bin )
 {
-    ymin = std::numeric_limits<Double_t>::max();
-    ymax = -ymin;
+    if ((bin < 0) || (bin >= hist.GetSize()))
+        return 0;
 
-    TVirtualPad * oldpad = gPad;
+    return HistBinView( hist ).EffectiveEntries( bin );
+}
 
-    {
-        TCanvas canvas;
+////////////////////////////////////////////////////////////////////////////////
+size_t HistNonEmptyBinCount( const TH1D & hist, bool bIncludeUnderOverflow /*= false*/ )
+{
+    const HistBinView view( hist );
 
-        hist.DrawCopy();  // histogram copy is owned by the current pad (i.e. canvas)
+    std::vector<UChar_t> mask( view.nSize );
+    HistNonEmptyMask( view, mask.data() );
 
-        canvas.Update();  // calculate new ranges
+    return CountBinMask( mask.data(), view.nSize, bIncludeUnderOverflow );
+}
 
-        Double_t xmin, xmax;
-        canvas.GetRangeAxis( xmin, ymin, xmax, ymax );
-    }
+////////////////////////////////////////////////////////////////////////////////
+size_t HistErrorBinCount( const TH1D & hist, bool bIncludeUnderOverflow /*= false*/ )
+{
+    const HistBinView view( hist );
+
+    std::vector<UChar_t> mask( view.nSize );
+    HistErrorMask( view, mask.data() );
 
-    if (oldpad) oldpad->cd();
+    return CountBinMask( mask.data(), view.nSize, bIncludeUnderOverflow );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void GetHistDrawMinMax( const ConstTH1DVector & hists, Double_t & ymin, Double_t & ymax )
+size_t HistNonEmptyBinCount( const TH1D & h1, const TH1D & h2, bool bCountUnion /*= false*/, bool bIncludeUnderOverflow /*= false*/ )
 {
-    ymin = std::numeric_limits<Double_t>::max();
-    ymax = -ymin;
+    if (h1.GetSize() != h2.GetSize())
+        ThrowError( "HistNonEmptyBinCount: histogram size mismatch." );
 
-    for (const TH1D * pHist : hists)
-    {
-        Double_t hist_ymin, hist_ymax;
-        GetHistDrawMinMax( *pHist, hist_ymin, hist_ymax );
+    const HistBinView v1( h1 );
+    const HistBinView v2( h2 );
 
-        ymin = std::min( ymin, hist_ymin );
-        ymax = std::max( ymax, hist_ymax );
-    }
+    std::vector<UChar_t> mask1( v1.nSize );
+    std::vector<UChar_t> mask2( v2.nSize );
+    HistNonEmptyMask( v1, mask1.data() );
+    HistNonEmptyMask( v2, mask2.data() );
+
+    return CountBinMask( mask1.data(), mask2.data(), v1.nSize, bCountUnion, bIncludeUnderOverflow );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TH1DVector DrawMultipleHist( const char * title, const ConstTH1DVector & hists, const ColorVector & colors /*= {}*/, const CStringVector drawOptions /*= {}*/ )
+size_t HistErrorBinCount( const TH1D & h1, const TH1D & h2, bool bCountUnion /*= false*/, bool bIncludeUnderOverflow /*= false*/ )
 {
-    TH1DVector drawHists;
+    if (h1.GetSize() != h2.GetSize())
+        ThrowError( "HistErrorBinCount: histogram size mismatch." );
 
-    Double_t yAxisMin, yAxisMax;
-    GetHistDrawMinMax( hists, yAxisMin, yAxisMax );
+    const HistBinView v1( h1 );
+    const HistBinView v2( h2 );
 
-    for ( size_t i = 0; i < hists.size(); ++i )
-    {
-        std::string drawOption = (i < drawOptions.size()) ? drawOptions[i] : "";
+    std::vector<UChar_t> mask1( v1.nSize );
+    std::vector<UChar_t> mask2( v2.nSize );
+    HistErrorMask( v1, mask1.data() );
+    HistErrorMask( v2, mask2.data() );
+
+    return CountBinMask( mask1.data(), mask2.data(), v1.nSize, bCountUnion, bIncludeUnderOverflow );
+}
 
-        if (i != 0)
-            drawOption += " SAME";
+////////////////////////////////////////////////////////////////////////////////
+void ZeroHistBin( TH1D & hist, Int_t bin )
+{
+    hist.SetBinContent( bin, 0 );
+    hist.SetBinError(   bin, 0 );
 
-        TH1D * pHist = reinterpret_cast<TH1D *>( hists[i]->DrawCopy(drawOption.c_str()) );     // histogram copy is owned by the current pad
-        if (!pHist)
-            ThrowError( "DrawCopy failed" );
+    if (hist.InheritsFrom(TProfile::Class()))
+        static_cast<TProfile &>(hist).SetBinEntries( bin, 0 );
+}
 
-        drawHists.push_back(pHist);
+////////////////////////////////////////////////////////////////////////////////
+void ZeroHistEmptyBins( TH1D & h1, TH1D & h2 )
+{
+    // zero bins if either are zero
 
-        if (i < colors.size())
-        {
-            Color_t color = colors[i];
-            pHist->SetLineColor(   color );
-            pHist->SetMarkerColor( color );
-        }
+    if (h1.GetSize() != h2.GetSize())
+        ThrowError( "ZeroHistEmptyBins: histogram size mismatch." );
 
-        pHist->SetBit( TH1::kNoTitle );  // disable title from histogram
+    const Int_t nSize = h1.GetSize();
 
-        // set the y-axis min/max (Note: do not use TCanvas::RangeAxis as this only works if TCanvas::Range is also set appropriately).
-        pHist->SetMinimum( yAxisMin );
-        pHist->SetMaximum( yAxisMax );
-    }
+    std::vector<UChar_t> nonEmpty1( nSize );
+    std::vector<UChar_t> nonEmpty2( nSize );
+    HistNonEmptyMask( HistBinView( h1 ), nonEmpty1.data() );
+    HistNonEmptyMask( HistBinView( h2 ), nonEmpty2.data() );
 
-    // add the title, if defined
-    if (title && title[0])
+    // only the few bins that differ are zeroed, with the side effects of SetBinContent
+    for (Int_t bin = 0; bin < nSize; ++bin)  // include under/overflow bins
     {
-        TH1D            dummyHist;
-        THistPainter    painter;
-
-        dummyHist.SetDirectory( nullptr );  // ensure not owned by any directory
-        dummyHist.SetTitle(title);
-        
-        painter.SetHistogram( &dummyHist );
-        
-        painter.PaintTitle();  // creates a TPaveLabel with the name "title" which is owned by the current pad
+        if (nonEmpty1[bin] == nonEmpty2[bin])  // both empty or both non-empty
+            continue;
+
+        ZeroHistBin( nonEmpty1[bin] ? h1 : h2, bin );
     }
-    
-    return drawHists;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-Double_t GetHistBinEffectiveEntries( const TH1D & hist, Int_t bin )
+void HistEffectiveEntries( const HistBinView & view, Double_t * pEffEntries )
 {
-    if (hist.InheritsFrom(TProfile::Class()))
-        return static_cast<const TProfile &>(hist).GetBinEffectiveEntries(bin);
+    const Int_t nSize = view.nSize;
 
-    if ((bin < 0) || (bin >= hist.GetSize()))
-        return 0;
+    if (view.pProfile)
+    {
+        // same as TProfile::GetBinEffectiveEntries
+        const Double_t * pW  = view.pBinEntries;
+        const Double_t * pW2 = view.pBinSumw2;
+
+        if (!pW2)
+        {
+            std::copy( pW, pW + nSize, pEffEntries );
+            return;
+        }
 
-    Double_t sumW = hist.GetArray()[bin];
+        for (Int_t bin = 0; bin < nSize; ++bin)
+            pEffEntries[bin] = (pW2[bin] > 0 ? pW[bin] * pW[bin] / pW2[bin] : 0);
 
-    if (bin >= hist.GetSumw2()->GetSize())
-        return sumW;
+        return;
+    }
 
-    Double_t sumW2 = hist.GetSumw2()->GetArray()[bin];
+    const Double_t * pW  = view.pSumw;
+    const Double_t * pW2 = view.pSumw2;
 
-    Double_t nEff = (sumW2 > 0 ? sumW * sumW / sumW2 : sumW);
+    if (!pW2)
+    {
+        std::copy( pW, pW + nSize, pEffEntries );
+        return;
+    }
 
-    return nEff;
+    for (Int_t bin = 0; bin < nSize; ++bin)
+        pEffEntries[bin] = (pW2[bin] > 0 ? pW[bin] * pW[bin] / pW2[bin] : pW[bin]);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-size_t HistNonEmptyBinCount( const TH1D & hist, bool bIncludeUnderOverflow /*= false*/ )
+void HistNonEmptyMask( const HistBinView & view, UChar_t * pMask )
 {
-    size_t nNonEmpty(0);
+    const Int_t nSize = view.nSize;
 
-    const Int_t first = bIncludeUnderOverflow ? 0 : 1;
-    const Int_t last  = hist.GetSize() - 1 - first;
-
-    for (Int_t bin = first; bin <= last; ++bin)
+    if (view.pProfile || view.pSumw2)
     {
-        if (GetHistBinEffectiveEntries( hist, bin ) != 0)
-            ++nNonEmpty;
+        std::vector<Double_t> effEntries( nSize );
+        HistEffectiveEntries( view, effEntries.data() );
+
+        for (Int_t bin = 0; bin < nSize; ++bin)
+            pMask[bin] = (effEntries[bin] != 0);
+
+        return;
     }
 
-    return nNonEmpty;
+    const Double_t * pW = view.pSumw;
+
+    for (Int_t bin = 0; bin < nSize; ++bin)
+        pMask[bin] = (pW[bin] != 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-size_t HistErrorBinCount( const TH1D & hist, bool bIncludeUnderOverflow /*= false*/ )
+void HistErrorMask( const HistBinView & view, UChar_t * pMask )
 {
-    size_t nError(0);
+    const Int_t nSize = view.nSize;
 
-    const Int_t first = bIncludeUnderOverflow ? 0 : 1;
-    const Int_t last  = hist.GetSize() - 1 - first;
-
-    for (Int_t bin = first; bin <= last; ++bin)
+    if (view.pProfile)
     {
-        if (hist.GetBinError(bin) != 0)
-            ++nError;
+        // the TProfile error depends on the error option and the bin spread, so use GetBinError
+        for (Int_t bin = 0; bin < nSize; ++bin)
+            pMask[bin] = (view.pProfile->GetBinError(bin) != 0);
+
+        return;
     }
 
-    return nError;
+    // same as TH1::GetBinError: sqrt(sumw2), or sqrt(|content|) without sumw2
+    const Double_t * pErr = view.pSumw2 ? view.pSumw2 : view.pSumw;
+
+    for (Int_t bin = 0; bin < nSize; ++bin)
+        pMask[bin] = (pErr[bin] != 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-size_t HistNonEmptyBinCount( const TH1D & h1, const TH1D & h2, bool bCountUnion /*= false*/, bool bIncludeUnderOverflow /*= false*/ )
+size_t CountBinMask( const UChar_t * pMask, Int_t nSize, bool bIncludeUnderOverflow /*= false*/ )
 {
-    if (h1.GetSize() != h2.GetSize())
-        ThrowError( "HistNonEmptyBinCount: histogram size mismatch." );
+    const Int_t first = bIncludeUnderOverflow ? 0     : 1;
+    const Int_t end   = bIncludeUnderOverflow ? nSize : nSize - 1;
 
-    size_t nNonEmpty(0);
+    size_t count(0);
+    for (Int_t bin = first; bin < end; ++bin)
+        count += (pMask[bin] != 0);
 
-    const Int_t first = bIncludeUnderOverflow ? 0 : 1;
-    const Int_t last  = h1.GetSize() - 1 - first;
+    return count;
+}
 
-    for (Int_t bin = first; bin <= last; ++bin)
-    {
-        bool ne1 = (GetHistBinEffectiveEntries( h1, bin ) != 0);
-        bool ne2 = (GetHistBinEffectiveEntries( h2, bin ) != 0);
+////////////////////////////////////////////////////////////////////////////////
+size_t CountBinMask( const UChar_t * pMask1, const UChar_t * pMask2, Int_t nSize, bool bCountUnion /*= false*/, bool bIncludeUnderOverflow /*= false*/ )
+{
+    const Int_t first = bIncludeUnderOverflow ? 0     : 1;
+    const Int_t end   = bIncludeUnderOverflow ? nSize : nSize - 1;
+
+    size_t count(0);
 
-        if ((ne1 && ne2) || (bCountUnion && (ne1 || ne2)))
-            ++nNonEmpty;
+    if (bCountUnion)
+    {
+        for (Int_t bin = first; bin < end; ++bin)
+            count += ((pMask1[bin] | pMask2[bin]) != 0);
+    }
+    else
+    {
+        for (Int_t bin = first; bin < end; ++bin)
+            count += ((pMask1[bin] != 0) & (pMask2[bin] != 0));
     }
 
-    return nNonEmpty;
+    return count;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-size_t HistErrorBinCount( const TH1D & h1, const TH1D & h2, bool bCountUnion /*= false*/, bool bIncludeUnderOverflow /*= false*/ )
+void ZeroHistBins( const HistBinArrays & arrays, const UChar_t * pMask, UChar_t zeroValue )
 {
-    if (h1.GetSize() != h2.GetSize())
-        ThrowError( "HistErrorBinCount: histogram size mismatch." );
+    const Int_t nSize = arrays.nSize;
+
+    for (Double_t * pArray : { arrays.pSumw, arrays.pSumw2, arrays.pBinEntries, arrays.pBinSumw2 })
+    {
+        if (!pArray)
+            continue;
 
-    size_t nError(0);
+        for (Int_t bin = 0; bin < nSize; ++bin)
+            pArray[bin] = (pMask[bin] == zeroValue) ? 0 : pArray[bin];
+    }
+}
 
-    const Int_t first = bIncludeUnderOverflow ? 0 : 1;
-    const Int_t last  = h1.GetSize() - 1 - first;
+////////////////////////////////////////////////////////////////////////////////
+HistBinView::HistBinView( const TH1D & hist )
+{
+    pHist    = &hist;
+    pProfile = hist.InheritsFrom(TProfile::Class()) ? static_cast<const TProfile *>(&hist) : nullptr;
+    pSumw    = hist.GetArray();
+    pSumw2   = (hist.GetSumw2()->fN != 0) ? hist.GetSumw2()->GetArray() : nullptr;
+    nSize    = hist.GetSize();
 
-    for (Int_t bin = first; bin <= last; ++bin)
+    if (pProfile)
     {
-        bool err1 = (h1.GetBinError(bin) != 0);
-        bool err2 = (h2.GetBinError(bin) != 0);
+        const MyProfile * pProf = static_cast<const MyProfile *>(pProfile);
 
-        if ((err1 && err2) || (bCountUnion && (err1 || err2)))
-            ++nError;
+        pBinEntries = pProf->fBinEntries.GetArray();
+        pBinSumw2   = (pProf->GetBinSumw2()->fN != 0) ? pProf->GetBinSumw2()->GetArray() : nullptr;
     }
+}
 
-    return nError;
+////////////////////////////////////////////////////////////////////////////////
+HistBinView::HistBinView( const Double_t * pSumw, const Double_t * pSumw2, Int_t nSize )
+  : pSumw(pSumw), pSumw2(pSumw2), nSize(nSize)
+{
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void ZeroHistBin( TH1D & hist, Int_t bin )
+HistBinArrays::HistBinArrays( TH1D & hist )
 {
-    hist.SetBinContent( bin, 0 );
-    hist.SetBinError(   bin, 0 );
+    MyProfile * pProf = hist.InheritsFrom(TProfile::Class()) ? static_cast<MyProfile *>(&hist) : nullptr;
 
-    if (hist.InheritsFrom(TProfile::Class()))
-        static_cast<TProfile &>(hist).SetBinEntries( bin, 0 );
+    pSumw       = hist.GetArray();
+    pSumw2      = (hist.GetSumw2()->fN != 0) ? hist.GetSumw2()->GetArray() : nullptr;
+    pBinEntries = pProf ? pProf->fBinEntries.GetArray() : nullptr;
+    pBinSumw2   = (pProf && (pProf->GetBinSumw2()->fN != 0)) ? pProf->GetBinSumw2()->GetArray() : nullptr;
+    nSize       = hist.GetSize();
+    bProfile    = (pProf != nullptr);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void ZeroHistEmptyBins( TH1D & h1, TH1D & h2 )
+Double_t HistBinView::Content( Int_t bin, Double_t scale /*= 1*/ ) const
 {
-    // zero bins if either are zero
+    if (pProfile)
+        return pProfile->GetBinContent(bin);    // mean is independent of luminosity
 
-    if (h1.GetSize() != h2.GetSize())
-        ThrowError( "ZeroHistEmptyBins: histogram size mismatch." );
+    return pSumw[bin] * scale;
+}
 
-    const Int_t nSize = h1.GetSize();
-    for (Int_t bin = 0; bin < nSize; ++bin)  // include under/overflow bins
+////////////////////////////////////////////////////////////////////////////////
+Double_t HistBinView::ErrorSqr( Int_t bin, Double_t scale /*= 1*/ ) const
+{
+    if (pProfile)
     {
-        bool empty1 = (GetHistBinEffectiveEntries( h1, bin ) == 0);
-        bool empty2 = (GetHistBinEffectiveEntries( h2, bin ) == 0);
-
-        if (empty1 == empty2)  // both true or both false
-            continue;
-
-        ZeroHistBin( empty1 ? h2 : h1, bin );
+        Double_t error = pProfile->GetBinError(bin);
+        return error * error / scale;           // error on the mean scales as 1/sqrt(entries)
     }
+
+    return (pSumw2 ? pSumw2[bin] : std::abs(pSumw[bin])) * scale;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-Double_t KolmogorovTest_NonEmptyBins( const TH1D & h1, const TH1D & h2 )
+Double_t HistBinView::EffectiveEntries( Int_t bin, Double_t scale /*= 1*/ ) const
 {
-    TH1DUniquePtr p1( (TH1D *)h1.Clone() );
-    TH1DUniquePtr p2( (TH1D *)h2.Clone() );
+    if (pProfile)
+        return pProfile->GetBinEffectiveEntries(bin) * scale;
+
+    // same as GetHistBinEffectiveEntries
+
+    Double_t sumW  = pSumw[bin];
+    Double_t sumW2 = pSumw2 ? pSumw2[bin] : 0;
+
+    Double_t nEff = (sumW2 > 0 ? sumW * sumW / sumW2 : sumW);
+
+    return nEff * scale;
+}
 
-    ZeroHistEmptyBins( *p1, *p2 );  // zero bins if either are zero
+////////////////////////////////////////////////////////////////////////////////
+Double_t KolmogorovTest_NonEmptyBins( const TH1D & h1, const TH1D & h2, const UChar_t * pSelect1 /*= nullptr*/, const UChar_t * pSelect2 /*= nullptr*/ )
+{
+    HistBinView v1( h1 );
+    HistBinView v2( h2 );
 
-    // KolmogorovTest ignores bins where BOTH are zero
-    return p1->KolmogorovTest( p2.get() );
+    // same as KolmogorovTest after ZeroHistEmptyBins (zero bins if either are zero)
+    return StatKolmogorovTest( StatBins(v1).Select(pSelect1), StatBins(v2).Select(pSelect2), StatBinMaskNonEmpty );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -988,89 +1110,63 @@ Double_t HistPointChi2Test( const TH1D & p1, const TH1D & p2, Double_t & chi2, I
     if (p1.GetSize() != p2.GetSize())
         ThrowError( "HistValueChi2Test: profile size mismatch." );
 
-    const Int_t nBins = p1.GetSize() - 2;
-
-    chi2 = 0;
-    ndf  = nBins - 1;
-
-    for (Int_t bin = 1; bin <= nBins; ++bin)  // do not include under/overflow
-    {
-        Double_t n1 = GetHistBinEffectiveEntries(p1, bin);
-        Double_t n2 = GetHistBinEffectiveEntries(p2, bin);
-
-        if ((n1 == 0) || (n2 == 0))
-        {
-            // skip this bin, and reduce the ndf
-            --ndf;
-            continue;
-        }
-
-        Double_t v1 = p1.GetBinContent(bin);
-        Double_t v2 = p2.GetBinContent(bin);
-
-        Double_t e1 = p1.GetBinError(bin);
-        Double_t e2 = p2.GetBinError(bin);
-
-        Double_t delta  = v1 - v2;
-        Double_t errsqr = e1*e1 + e2*e2;
+    HistBinView v1( p1 );
+    HistBinView v2( p2 );
 
-        if (errsqr == 0)
-        {
-            // skip this bin, and reduce the ndf
-            --ndf;
-            continue;
-        }
-
-        Double_t chisqr = delta * delta / errsqr;
-
-        chi2 += chisqr;
-    }
+    Chi2Result res = StatPointChi2Test( StatBins(v1), StatBins(v2) );
 
-    if (ndf < 0) ndf = 0; 
+    chi2 = res.chi2;
+    ndf  = res.ndf;
 
-    Double_t prob = TMath::Prob( chi2, ndf );   // can handle ndf <= 0 (see TMath.cxx)
-
-    return prob;
+    return res.prob;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void Chi2Result::Chi2Test( const TH1D & h1, const TH1D & h2 )
+void Chi2Result::Chi2Test( const TH1D & h1, const TH1D & h2, const UChar_t * pSelect1 /*= nullptr*/, const UChar_t * pSelect2 /*= nullptr*/,
+                           std::vector<std::string> * pLog /*= nullptr*/ )
 {
-    if (!h1.InheritsFrom(TProfile::Class()) && !h2.InheritsFrom(TProfile::Class()))
+    HistBinView v1( h1 );
+    HistBinView v2( h2 );
+
+    if (!v1.pProfile && !v2.pProfile)
     {
         // both are TH1D
 
         // We want the Chi2Test to skip bins if either are empty,
         // however, Chi2TestX only skips bins if both are empty.
-        // To accomplish the desired behavior we make sure that if a bin is empty
-        // in one, it is also empty in the other.
+        // To accomplish the desired behavior the bins empty in only one are masked out,
+        // which is the same as zeroing them with ZeroHistEmptyBins.
 
-        TH1DUniquePtr p1( (TH1D *)h1.Clone() );
-        TH1DUniquePtr p2( (TH1D *)h2.Clone() );
+        size_t nUnion(0), nBoth(0);
+        for (Int_t bin = 1; bin < v1.nSize - 1; ++bin)
+        {
+            bool ne1 = (!pSelect1 || pSelect1[bin]) && (v1.EffectiveEntries(bin) != 0);
+            bool ne2 = (!pSelect2 || pSelect2[bin]) && (v2.EffectiveEntries(bin) != 0);
 
-        ZeroHistEmptyBins( *p1, *p2 );  // zero bins if either are zero
+            if (ne1 || ne2) ++nUnion;
+            if (ne1 && ne2) ++nBoth;
+        }
 
-        LogMsgInfo( "Chi2Test(%hs, %hs): %u -> %u non-empty bins", FMT_HS(h1.GetName()), FMT_HS(h2.GetName()),
-                    FMT_U(HistNonEmptyBinCount(h1,h2,true)), FMT_U(HistNonEmptyBinCount(*p1,*p2,true)) );
+        std::string msg = StringFormat( "Chi2Test(%hs, %hs): %u -> %u non-empty bins", FMT_HS(h1.GetName()), FMT_HS(h2.GetName()),
+                                        FMT_U(nUnion), FMT_U(nBoth) );
+        if (pLog)
+            pLog->push_back( msg );
+        else
+            LogMsgInfo( "%hs", FMT_HS(msg.c_str()) );
 
         // perform chi2test
 
-        prob     = p1->Chi2TestX( p2.get(), chi2, ndf, igood, "WW" );
-        chi2_ndf = (ndf > 0 ? chi2 / ndf : 0.0);
+        *this = StatChi2Test( StatBins(v1).Select(pSelect1), StatBins(v2).Select(pSelect2), kChi2TestWW, StatBinMaskNonEmpty );
     }
     else
     {
-        if (!h1.InheritsFrom(TProfile::Class()) || !h2.InheritsFrom(TProfile::Class()))
+        if (!v1.pProfile || !v2.pProfile)
             ThrowError( "Chi2Test: both histograms must inherit from TProfile" );
 
-        // both are TProfile
-
-        const TProfile & p1 = static_cast<const TProfile &>(h1);
-        const TProfile & p2 = static_cast<const TProfile &>(h2);
+        // both are TProfile, same as HistPointChi2Test
 
-        prob     = HistPointChi2Test( p1, p2, chi2, ndf );
-        chi2_ndf = (ndf > 0 ? chi2 / ndf : 0.0);
-        igood    = 0;
+        *this = StatPointChi2Test( StatBins(v1).Select(pSelect1), StatBins(v2).Select(pSelect2) );
+        igood = 0;
     }
 }
 
@@ -22,6 +22,7 @@
 
 class TFile;
 class TH1D;
+class TProfile;
 class TNtupleD;
 
 namespace HepMC
@@ -127,9 +128,19 @@ TH1D * ConvertTProfileToTH1D( const TH1D * pProfile, bool bDeleteProfile );
 
 bool IsHistSumw2Enabled( const TH1D & hist );
 
+// Free the bin arrays of a TH1D (not a TProfile), keeping its binning and attributes, when its contents
+// are kept elsewhere (see HistBank). RestoreHistBins allocates empty bin arrays again, e.g. in a clone.
+void ReleaseHistBins( TH1D & hist );
+void RestoreHistBins( TH1D & hist );
+bool IsHistBinsReleased( const TH1D & hist );
+
 void SetupHist( TH1D & hist, const char * xAxisTitle = nullptr, const char * yAxisTitle = nullptr,
                 Color_t lineColor = -1, Color_t markerColor = -1, Color_t fillColor = -1 );
 
+// Scale the entries of hist, as a change of luminosity: all internal sums are multiplied by scale,
+// so the effective entries are too (unlike TH1::Scale, which leaves them unchanged).
+void ScaleHistEntries( TH1D & hist, double scale );
+
 void ScaleHistToLuminosity( double luminosity, const TH1D & hist, size_t nEvents, double crossSection,
                             double crossSectionError, bool bApplyCrossSectionError = false );
 
@@ -138,13 +149,6 @@ void ScaleHistToLuminosity( double luminosity, const TH1DVector & hist, size_t n
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void GetHistDrawMinMax( const TH1D & hist,             Double_t & ymin, Double_t & ymax );
-void GetHistDrawMinMax( const ConstTH1DVector & hists, Double_t & ymin, Double_t & ymax );
-
-TH1DVector DrawMultipleHist( const char * title, const ConstTH1DVector & hists, const ColorVector & colors = {}, const CStringVector drawOptions = {} );
-
-////////////////////////////////////////////////////////////////////////////////
-
 Double_t GetHistBinEffectiveEntries( const TH1D & hist, Int_t bin );
 
 size_t HistNonEmptyBinCount( const TH1D & hist, bool bIncludeUnderOverflow = false );
@@ -158,7 +162,62 @@ void ZeroHistEmptyBins( TH1D & h1, TH1D & h2 );
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Double_t KolmogorovTest_NonEmptyBins( const TH1D & h1, const TH1D & h2 );
+// Read-only bin access to a TH1D or TProfile, with the type resolved once on construction.
+// The optional scale is a luminosity scale, applied as in ScaleHistEntries:
+//   TH1D:     content *= scale, error^2 *= scale
+//   TProfile: content unchanged, error^2 /= scale
+// In both cases the effective entries are multiplied by scale.
+
+struct HistBinView
+{
+    const TH1D *        pHist       = nullptr;
+    const TProfile *    pProfile    = nullptr;  // set if pHist is a TProfile
+    const Double_t *    pSumw       = nullptr;
+    const Double_t *    pSumw2      = nullptr;  // can be null
+    const Double_t *    pBinEntries = nullptr;  // TProfile only
+    const Double_t *    pBinSumw2   = nullptr;  // TProfile only, can be null
+    Int_t               nSize       = 0;
+
+    explicit HistBinView( const TH1D & hist );
+    HistBinView( const Double_t * pSumw, const Double_t * pSumw2, Int_t nSize );  // bare TH1D arrays, no histogram
+
+    Double_t Content(          Int_t bin, Double_t scale = 1 ) const;
+    Double_t ErrorSqr(         Int_t bin, Double_t scale = 1 ) const;
+    Double_t EffectiveEntries( Int_t bin, Double_t scale = 1 ) const;
+};
+
+// Writable access to the internal bin sums of a TH1D or TProfile.
+// Call ResetStats on the histogram after modifying the sums.
+
+struct HistBinArrays
+{
+    Double_t *          pSumw       = nullptr;
+    Double_t *          pSumw2      = nullptr;  // can be null
+    Double_t *          pBinEntries = nullptr;  // TProfile only
+    Double_t *          pBinSumw2   = nullptr;  // TProfile only, can be null
+    Int_t               nSize       = 0;
+    bool                bProfile    = false;
+
+    explicit HistBinArrays( TH1D & hist );
+};
+
+// Bin kernels on all bins of a histogram, including under/overflow, with [nSize] arrays.
+// The histogram type is resolved once per call, not per bin, and the TH1D loops are branch-free.
+
+void HistEffectiveEntries( const HistBinView & view, Double_t * pEffEntries );  // same as GetHistBinEffectiveEntries
+void HistNonEmptyMask(     const HistBinView & view, UChar_t * pMask );         // 1 if effective entries != 0
+void HistErrorMask(        const HistBinView & view, UChar_t * pMask );         // 1 if bin error != 0
+
+size_t CountBinMask( const UChar_t * pMask, Int_t nSize, bool bIncludeUnderOverflow = false );
+size_t CountBinMask( const UChar_t * pMask1, const UChar_t * pMask2, Int_t nSize, bool bCountUnion = false, bool bIncludeUnderOverflow = false );
+
+// zero the bins where pMask[bin] == zeroValue; call ResetStats on the histogram afterwards
+void ZeroHistBins( const HistBinArrays & arrays, const UChar_t * pMask, UChar_t zeroValue );
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The optional per-bin selections exclude bins where they are zero (see StatBins::pSelect).
+Double_t KolmogorovTest_NonEmptyBins( const TH1D & h1, const TH1D & h2, const UChar_t * pSelect1 = nullptr, const UChar_t * pSelect2 = nullptr );
 
 Double_t HistPointChi2Test( const TH1D & p1, const TH1D & p2, Double_t & chi2, Int_t & ndf );
 
@@ -170,7 +229,9 @@ struct Chi2Result
     Double_t prob     = 0;
     Double_t chi2_ndf = 0;
 
-    void Chi2Test( const TH1D & h1, const TH1D & h2 );
+    // the log message is appended to *pLog instead, if given
+    void Chi2Test( const TH1D & h1, const TH1D & h2, const UChar_t * pSelect1 = nullptr, const UChar_t * pSelect2 = nullptr,
+                   std::vector<std::string> * pLog = nullptr );
 
     std::string Label();
 };
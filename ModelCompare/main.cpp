@@ -7,7 +7,12 @@
 //
 
 #include "ModelCompare.h"
+#if !MODELCOMPARE_HEADLESS
+#include "ModelCompareDraw.h"
+#endif
 #include "RootUtil.h"
+#include "OutputWriter.h"
+#include "ModelStore.h"
 #include "common.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -148,11 +153,20 @@ static const FigureSetupVector CompareFinal =
     { { "AGC_g1",     "EFT_cW"   }, 10.0, { kBlue,  kRed } },
     { { "AGC_kappa",  "EFT_cB"   }, 10.0, { kBlue,  kRed } },
     { { "AGC_all",    "EFT_all"  }, 10.0, { kBlue,  kRed } },
+  //{ { "AGC_all",    "EFT_all"  }, 10.0, { kBlue,  kRed }, { "PTZ", "MWZ" } },   // compare only these observables
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 int main()
 {
+  //RootUtil::SetOutputCompression( { RootUtil::kCompressLZMA, 9 } );   // archive
+  //RootUtil::SetOutputCompression( { RootUtil::kCompressZLIB, 1 } );   // scratch
+  //ModelCompare::SetModelMemoryBudget( size_t(2) << 30 );              // 2 GB of model histograms and figure working set (see ModelStore.h)
+
+#if MODELCOMPARE_HEADLESS
+    // ModelCompareFill target: fill the histogram cache only, without the graphics libraries
+    ModelCompare::FillHistCache( Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root" );
+#else
   //ModelCompare::ModelCompare( "compare/compare1.root",  Models_1E4, Observables1, Compare1 );
   //ModelCompare::ModelCompare( "compare/compare2b.root", Models_1E4, Observables1, Compare2 );
   //ModelCompare::ModelCompare( "compare/compare3.root" , Models_1E6, Observables1, Compare3 );
@@ -161,6 +175,17 @@ int main()
   //ModelCompare::ModelCompare( "compare/compare6.root" , Models_1E6, Observables1, Compare6 );
 
     ModelCompare::ModelCompare( "compare/compare_final.root", Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root" );
+  //ModelCompare::ModelCompare( "compare/compare_final.root", Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root", { "compare/figures", { "pdf", "png" } } );
+  //ModelCompare::ModelCompare( "compare/compare_final.root", Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root", {}, ModelCompare::kFigureOutputDescriptor );
+  //ModelCompare::ModelCompare( "compare/compare_final.root", Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root", {}, ModelCompare::kFigureOutputCanvas | ModelCompare::kFigureOutputIncremental );
+  //ModelCompare::ModelCompare( "compare/compare_final.root", Models_1E6, Observables2, CompareFinal, "compare/cache_1E6.root", {}, ModelCompare::kFigureOutputCanvas, "compare/summary_final.jsonl" );
+
+  //ModelCompare::MinimumLuminositySearch( Models_1E6, Observables2, CompareFinal, 0.05, "compare/cache_1E6.root" );
+  //ModelCompare::LuminositySweep( "compare/sweep_final.root", Models_1E6, Observables2, CompareFinal, MakeLuminosityRange( 0.1, 1000, 41 ), "compare/cache_1E6.root" );
+  //ModelCompare::CompareMatrix( "compare/matrix_final.root", Models_1E6, Observables2, 0, "compare/cache_1E6.root" );
+  //ModelCompare::UnbinnedCompare( Models_1E6, Observables2, CompareFinal, 1000, "compare/cache_1E6.root" );
+  //ModelCompare::CombinedCompare( Models_1E6, Observables2, CompareFinal, { 0, 1, 2 }, "compare/cache_1E6.root" );
+#endif
 
     LogMsgInfo( "Done." );
     return 0;